@@ -0,0 +1,344 @@
+#include "../src/CeTuHashMap.h"
+#include "../src/CeTuFlatHashMap.h"
+#include "../src/CeTuDenseHashMap.h"
+#include "../src/CeTuRobinHoodHashMap.h"
+#include "../src/CeTuStringHashMap.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#ifdef CETU_BENCH_ABSL
+#include <absl/container/flat_hash_map.h>
+#endif
+#ifdef CETU_BENCH_BOOST
+#include <boost/unordered/unordered_flat_map.hpp>
+#endif
+
+// Workloads: insert (building the map from scratch), lookup hits, lookup misses, erase
+// (emptying a built map) and a mixed workload of 80% lookups, 10% inserts and 10%
+// erases. Lookups and the mixed workload draw keys either uniformly or from a Zipfian
+// distribution. Maps with lookup_async also run uniform hits through CeTuLookupScheduler
+// at several group sizes, next to a plain find() loop over the same keys. The largest
+// size run is capped by CETU_BENCH_MAX_ENTRIES (default 16M); set it to 100000000 for
+// the full range. Use --benchmark_filter to pick a subset.
+
+namespace {
+
+// 256 bytes, to see the cost of moving large values around
+struct LargeValue {
+    std::array<uint64_t, 32> data{};
+};
+
+uint64_t splitmix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Key number i, distinct for distinct i. Integer keys stay below the dense map's empty key.
+template<typename K>
+K makeKey(uint64_t i) {
+    if constexpr (std::is_same_v<K, std::string>) {
+        return "key:" + std::to_string(splitmix(i));
+    } else {
+        return static_cast<K>(splitmix(i) >> 1);
+    }
+}
+
+template<typename V>
+V makeValue(uint64_t i) {
+    if constexpr (std::is_same_v<V, LargeValue>) {
+        LargeValue value;
+        value.data[0] = i;
+        return value;
+    } else {
+        return static_cast<V>(i);
+    }
+}
+
+// Zipfian ranks in [0, n), rank 0 being the most frequent (Gray et al., as in YCSB)
+class ZipfianGenerator {
+public:
+    explicit ZipfianGenerator(uint64_t _n, double _theta = 0.99) : n(_n), theta(_theta) {
+        zetan = zeta(n);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / static_cast<double>(n), 1.0 - theta)) / (1.0 - zeta(2) / zetan);
+    }
+
+    template<typename Random>
+    uint64_t operator()(Random& random) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        double uz = u * zetan;
+        if(uz < 1.0) {
+            return 0;
+        }
+        if(uz < 1.0 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        return std::min<uint64_t>(n - 1, static_cast<uint64_t>(static_cast<double>(n) * std::pow(eta * u - eta + 1.0, alpha)));
+    }
+
+private:
+    uint64_t n;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+
+    double zeta(uint64_t count) const {
+        double sum = 0.0;
+        for(uint64_t i = 1; i <= count; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+};
+
+enum class Distribution { Uniform, Zipfian };
+
+// Key numbers for queries into a map holding keys 0 .. size - 1. Zipfian ranks are
+// scattered over the keys, so the hot keys do not share buckets.
+std::vector<uint64_t> makeQueries(uint64_t size, Distribution distribution) {
+    constexpr uint64_t queryCount = 1 << 20;
+    std::mt19937_64 random(size);
+    std::vector<uint64_t> queries(queryCount);
+    if(distribution == Distribution::Uniform) {
+        std::uniform_int_distribution<uint64_t> pick(0, size - 1);
+        std::generate(queries.begin(), queries.end(), [&] { return pick(random); });
+    } else {
+        ZipfianGenerator pick(size);
+        std::generate(queries.begin(), queries.end(), [&] { return splitmix(pick(random)) % size; });
+    }
+    return queries;
+}
+
+// The CeTu maps and the std-like baselines differ in how inserts and hits are spelled
+template<typename Map, typename K, typename V>
+void put(Map& map, const K& key, const V& value) {
+    if constexpr (requires { map.insert_or_assign(key, value); }) {
+        map.insert_or_assign(key, value);
+    } else {
+        map.insert(key, value);
+    }
+}
+
+template<typename Map, typename K>
+bool has(const Map& map, const K& key) {
+    if constexpr (requires { { map.find(key) != map.end() } -> std::convertible_to<bool>; }) {
+        return map.find(key) != map.end();
+    } else {
+        return map.find(key) != nullptr;
+    }
+}
+
+template<typename Map, typename K, typename V>
+Map build(uint64_t size) {
+    Map map;
+    for(uint64_t i = 0; i < size; ++i) {
+        put(map, makeKey<K>(i), makeValue<V>(i));
+    }
+    return map;
+}
+
+template<typename Map, typename K, typename V>
+void insertBenchmark(benchmark::State& state, uint64_t size) {
+    std::vector<K> keys(size);
+    for(uint64_t i = 0; i < size; ++i) {
+        keys[i] = makeKey<K>(i);
+    }
+    const V value = makeValue<V>(1);
+    for(auto _ : state) {
+        Map map;
+        for(const K& key : keys) {
+            put(map, key, value);
+        }
+        benchmark::DoNotOptimize(map);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+
+template<typename Map, typename K, typename V>
+void lookupBenchmark(benchmark::State& state, uint64_t size, Distribution distribution, bool hit) {
+    Map map = build<Map, K, V>(size);
+    std::vector<K> queries;
+    for(uint64_t query : makeQueries(size, distribution)) {
+        // Missing keys are numbered past the inserted ones
+        queries.push_back(makeKey<K>(hit ? query : size + query));
+    }
+
+    size_t next = 0;
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(has(map, queries[next]));
+        next = (next + 1) & (queries.size() - 1);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Resolves the keys a group of queryGroup at a time, either interleaved by
+// CeTuLookupScheduler or (groupSize 0) one after the other with find()
+template<typename Map, typename K, typename V>
+void lookupAsyncBenchmark(benchmark::State& state, uint64_t size, size_t groupSize) {
+    constexpr size_t queryGroup = 1 << 10;
+    const Map map = build<Map, K, V>(size);
+    std::vector<K> queries;
+    for(uint64_t query : makeQueries(size, Distribution::Uniform)) {
+        queries.push_back(makeKey<K>(query));
+    }
+    std::vector<const V*> results(queryGroup);
+    const CeTuLookupScheduler scheduler(groupSize == 0 ? 1 : groupSize);
+
+    size_t next = 0;
+    for(auto _ : state) {
+        std::span<const K> keys(queries.data() + next, queryGroup);
+        if(groupSize == 0) {
+            for(size_t i = 0; i < queryGroup; ++i) {
+                results[i] = map.find(keys[i]);
+            }
+        } else {
+            scheduler.run(map, keys, results);
+        }
+        benchmark::DoNotOptimize(results.data());
+        benchmark::ClobberMemory();
+        next = (next + queryGroup) & (queries.size() - 1);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * queryGroup));
+}
+
+template<typename Map, typename K, typename V>
+void eraseBenchmark(benchmark::State& state, uint64_t size) {
+    std::vector<K> keys(size);
+    for(uint64_t i = 0; i < size; ++i) {
+        keys[i] = makeKey<K>(i);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(size));
+    for(auto _ : state) {
+        state.PauseTiming();
+        Map map = build<Map, K, V>(size);
+        state.ResumeTiming();
+        for(const K& key : keys) {
+            map.erase(key);
+        }
+        benchmark::DoNotOptimize(map);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+
+template<typename Map, typename K, typename V>
+void mixedBenchmark(benchmark::State& state, uint64_t size, Distribution distribution) {
+    Map map = build<Map, K, V>(size);
+    std::vector<K> keys;
+    for(uint64_t query : makeQueries(size, distribution)) {
+        keys.push_back(makeKey<K>(query));
+    }
+    const V value = makeValue<V>(1);
+
+    size_t next = 0;
+    for(auto _ : state) {
+        const K& key = keys[next];
+        switch(next % 10) {
+        case 0:
+            put(map, key, value);
+            break;
+        case 5:
+            map.erase(key);
+            break;
+        default:
+            benchmark::DoNotOptimize(has(map, key));
+        }
+        next = (next + 1) & (keys.size() - 1);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+uint64_t maxEntries() {
+    if(const char* value = std::getenv("CETU_BENCH_MAX_ENTRIES")) {
+        return std::strtoull(value, nullptr, 10);
+    }
+    return 1 << 24;
+}
+
+// From L1-resident up to 100M entries
+const std::vector<uint64_t> sizes = {1 << 8, 1 << 12, 1 << 16, 1 << 20, 1 << 24, 100'000'000};
+
+template<typename Map, typename K, typename V>
+void registerMap(const std::string& mapName, const std::string& typeName) {
+    for(uint64_t size : sizes) {
+        if(size > maxEntries()) {
+            continue;
+        }
+        std::string suffix = "/" + mapName + "/" + typeName + "/" + std::to_string(size);
+        benchmark::RegisterBenchmark(("Insert" + suffix).c_str(), [size](benchmark::State& state) {
+            insertBenchmark<Map, K, V>(state, size);
+        })->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("Erase" + suffix).c_str(), [size](benchmark::State& state) {
+            eraseBenchmark<Map, K, V>(state, size);
+        })->Unit(benchmark::kMillisecond);
+        for(Distribution distribution : {Distribution::Uniform, Distribution::Zipfian}) {
+            std::string name = (distribution == Distribution::Uniform ? "Uniform" : "Zipfian") + suffix;
+            benchmark::RegisterBenchmark(("LookupHit/" + name).c_str(), [size, distribution](benchmark::State& state) {
+                lookupBenchmark<Map, K, V>(state, size, distribution, true);
+            });
+            benchmark::RegisterBenchmark(("Mixed/" + name).c_str(), [size, distribution](benchmark::State& state) {
+                mixedBenchmark<Map, K, V>(state, size, distribution);
+            });
+        }
+        // Misses do not depend on the distribution
+        benchmark::RegisterBenchmark(("LookupMiss" + suffix).c_str(), [size](benchmark::State& state) {
+            lookupBenchmark<Map, K, V>(state, size, Distribution::Uniform, false);
+        });
+        if constexpr (requires(const Map& map, const K& key) { map.lookup_async(key); }) {
+            for(size_t groupSize : {0, 4, 8, 16, 32}) {
+                std::string name = "LookupAsync/" + (groupSize == 0 ? std::string("find") : std::to_string(groupSize)) + suffix;
+                benchmark::RegisterBenchmark(name.c_str(), [size, groupSize](benchmark::State& state) {
+                    lookupAsyncBenchmark<Map, K, V>(state, size, groupSize);
+                });
+            }
+        }
+    }
+}
+
+template<typename K, typename V>
+void registerType(const std::string& typeName) {
+    registerMap<CeTuHashMap<K, V>, K, V>("CeTuHashMap", typeName);
+    registerMap<CeTuFlatHashMap<K, V>, K, V>("CeTuFlatHashMap", typeName);
+    registerMap<CeTuRobinHoodHashMap<K, V>, K, V>("CeTuRobinHoodHashMap", typeName);
+    if constexpr (TriviallyCopyableKeyValue<K, V>) {
+        registerMap<CeTuDenseHashMap<K, V>, K, V>("CeTuDenseHashMap", typeName);
+    }
+    if constexpr (std::is_same_v<K, std::string>) {
+        registerMap<CeTuStringHashMap<V>, K, V>("CeTuStringHashMap", typeName);
+    }
+    registerMap<std::unordered_map<K, V>, K, V>("std::unordered_map", typeName);
+#ifdef CETU_BENCH_ABSL
+    registerMap<absl::flat_hash_map<K, V>, K, V>("absl::flat_hash_map", typeName);
+#endif
+#ifdef CETU_BENCH_BOOST
+    registerMap<boost::unordered_flat_map<K, V>, K, V>("boost::unordered_flat_map", typeName);
+#endif
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    registerType<uint64_t, uint64_t>("int");
+    registerType<std::string, uint64_t>("string");
+    registerType<uint64_t, LargeValue>("large");
+
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
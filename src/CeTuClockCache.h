@@ -0,0 +1,385 @@
+#ifndef CETU_CLOCK_CACHE_H
+#define CETU_CLOCK_CACHE_H
+
+#include "CeTuHashMapCommon.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+// Default eviction callback of CeTuClockCache, which ignores the evicted entries
+struct CeTuIgnoreEviction {
+    template<typename K, typename V>
+    void operator()(const K&, V&) const noexcept {}
+};
+
+// Fixed-capacity cache with CLOCK eviction. All memory is allocated by the constructor:
+// the entries live in one array, one flags byte per entry holds the live and referenced
+// bits, and an open-addressing index of entry numbers finds them. lookup only sets the
+// referenced bit, so a hit is O(1) and allocates nothing. Inserting into a full cache
+// evicts first: a hand sweeps the entries, clearing referenced bits, and evicts the first
+// entry whose bit is already clear. New entries start unreferenced, so entries that are
+// never looked up again go first.
+// With a nonzero ttl, entries expire ttl after their last insert; expired entries are
+// misses and are evicted when found or swept, or by evict_expired().
+// onEvict(key, value) is called on every entry evicted or expired, before it is
+// destroyed, e.g. to write it back to disk; erase() and clear() do not call it.
+// Attention: CeTuClockCache is not thread-safe, lookups included.
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>,
+         typename OnEvict = CeTuIgnoreEviction>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+class CeTuClockCache final {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // capacity must be positive and below 2^32
+    explicit CeTuClockCache(size_t capacity, Clock::duration ttl = Clock::duration::zero(), OnEvict onEvict = OnEvict());
+    ~CeTuClockCache() noexcept { destroyEntries(); }
+
+    // Disable copying
+    CeTuClockCache(const CeTuClockCache&) = delete;
+    CeTuClockCache& operator=(const CeTuClockCache&) = delete;
+
+    // Enable moving, the moved-from cache may only be destroyed or assigned to
+    CeTuClockCache(CeTuClockCache&& other) noexcept;
+    CeTuClockCache& operator=(CeTuClockCache&& other) noexcept;
+
+    // Inserts or replaces the entry of key, restarting its ttl
+    void insert(K key, V value);
+    // Hits mark the entry as recently used
+    std::optional<V> lookup(const K& key);
+    V* find(const K& key);
+    // Does not mark the entry as used
+    bool contains(const K& key) const;
+    void erase(const K& key);
+    // Evicts every expired entry now; returns how many there were
+    size_t evict_expired();
+    // Removes every entry without calling onEvict
+    void clear() noexcept;
+
+    size_t size() const { return currentSize; }
+    bool empty() const { return currentSize == 0; }
+    size_t capacity() const { return entryCount; }
+    Clock::duration ttl() const { return timeToLive; }
+
+    // Calls visitor(key, value) for every entry, expired ones included, in no particular order
+    template<typename F>
+    void for_each(F&& visitor) const;
+
+private:
+    struct Entry {
+        K key;
+        V value;
+        size_t hash;
+        Clock::time_point expiry;
+    };
+
+    // Constructed only while flagged live
+    union EntrySlot {
+        EntrySlot() {}
+        ~EntrySlot() {}
+        Entry entry;
+    };
+
+    static constexpr uint8_t liveFlag = 1;
+    static constexpr uint8_t referencedFlag = 2;
+    // Index slots hold the upper half of the hash and the entry number plus one, 0 when empty
+    static constexpr uint64_t entryMask = 0xFFFFFFFFull;
+    static constexpr size_t minIndexSize = 16;
+
+    std::unique_ptr<EntrySlot[]> entries;
+    std::unique_ptr<uint8_t[]> flags;
+    std::unique_ptr<uint32_t[]> freeEntries;
+    std::unique_ptr<uint64_t[]> index;
+    size_t entryCount;
+    size_t indexMask;
+    size_t currentSize;
+    // Entries at and above nextUnused have never been used; erased ones below wait in freeEntries
+    size_t nextUnused;
+    size_t freeCount;
+    size_t hand;
+    Clock::duration timeToLive;
+    CeTuDetail::SeededHash<Hash> hasher;
+    [[no_unique_address]] KeyEqual keyEqual;
+    [[no_unique_address]] OnEvict onEvict;
+
+    size_t hash(const K& key) const { return CeTuDetail::hashKey(hasher, key); }
+    bool expired(const Entry& entry) const { return timeToLive != Clock::duration::zero() && Clock::now() >= entry.expiry; }
+    // Returns the index slot of key, or indexMask + 1
+    size_t findSlot(const K& key, size_t keyHash) const;
+    // Index slot pointing to the live entry number
+    size_t slotOf(size_t entry) const;
+    // Erases index slot pos, shifting the rest of its run back
+    void removeSlot(size_t pos) noexcept;
+    // Evicts the entry behind index slot pos through onEvict
+    void evict(size_t pos);
+    // Destroys the entry behind index slot pos
+    void removeEntry(size_t pos) noexcept;
+    // Evicts the entry the hand stops at; the cache must be full
+    void evictOne();
+    void destroyEntries() noexcept;
+};
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::CeTuClockCache(size_t capacity, Clock::duration ttl, OnEvict _onEvict) :
+    entryCount(capacity), currentSize(0), nextUnused(0), freeCount(0), hand(0), timeToLive(ttl), onEvict(std::move(_onEvict)) {
+    if(capacity == 0 || capacity >= entryMask) {
+        throw std::invalid_argument("CeTuClockCache: capacity must be positive and below 2^32");
+    }
+    if(ttl < Clock::duration::zero()) {
+        throw std::invalid_argument("CeTuClockCache: ttl must not be negative");
+    }
+
+    // At most half full, so probe runs stay short even when the cache is full
+    size_t indexSize = std::bit_ceil(std::max(2 * capacity, minIndexSize));
+    indexMask = indexSize - 1;
+    entries = std::make_unique<EntrySlot[]>(capacity);
+    flags = std::make_unique<uint8_t[]>(capacity);
+    freeEntries = std::make_unique<uint32_t[]>(capacity);
+    index = std::make_unique<uint64_t[]>(indexSize);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::CeTuClockCache(CeTuClockCache&& other) noexcept :
+    entries(std::move(other.entries)), flags(std::move(other.flags)), freeEntries(std::move(other.freeEntries)),
+    index(std::move(other.index)), entryCount(other.entryCount), indexMask(other.indexMask),
+    currentSize(std::exchange(other.currentSize, 0)), nextUnused(std::exchange(other.nextUnused, 0)),
+    freeCount(std::exchange(other.freeCount, 0)), hand(other.hand), timeToLive(other.timeToLive),
+    hasher(other.hasher), keyEqual(std::move(other.keyEqual)), onEvict(std::move(other.onEvict)) {}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>& CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::operator=(CeTuClockCache&& other) noexcept {
+    if(this != &other) {
+        destroyEntries();
+        entries = std::move(other.entries);
+        flags = std::move(other.flags);
+        freeEntries = std::move(other.freeEntries);
+        index = std::move(other.index);
+        entryCount = other.entryCount;
+        indexMask = other.indexMask;
+        currentSize = std::exchange(other.currentSize, 0);
+        nextUnused = std::exchange(other.nextUnused, 0);
+        freeCount = std::exchange(other.freeCount, 0);
+        hand = other.hand;
+        timeToLive = other.timeToLive;
+        hasher = other.hasher;
+        keyEqual = std::move(other.keyEqual);
+        onEvict = std::move(other.onEvict);
+    }
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::insert(K key, V value) {
+    size_t keyHash = hash(key);
+    Clock::time_point expiry = timeToLive == Clock::duration::zero() ? Clock::time_point() : Clock::now() + timeToLive;
+    size_t pos = findSlot(key, keyHash);
+    if(pos <= indexMask) {
+        size_t entry = (index[pos] & entryMask) - 1;
+        entries[entry].entry.value = std::move(value);
+        entries[entry].entry.expiry = expiry;
+        flags[entry] |= referencedFlag;
+        return;
+    }
+
+    if(currentSize == entryCount) {
+        evictOne();
+    }
+    size_t entry = freeCount != 0 ? freeEntries[freeCount - 1] : nextUnused;
+    std::construct_at(&entries[entry].entry, Entry{std::move(key), std::move(value), keyHash, expiry});
+    if(freeCount != 0) {
+        --freeCount;
+    } else {
+        ++nextUnused;
+    }
+    flags[entry] = liveFlag;
+
+    // The run of the home slot ends before an empty slot, and eviction may have moved it
+    pos = keyHash & indexMask;
+    while(index[pos] != 0) {
+        pos = (pos + 1) & indexMask;
+    }
+    index[pos] = (keyHash & ~entryMask) | (entry + 1);
+    ++currentSize;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+std::optional<V> CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::lookup(const K& key) {
+    if(const V* value = find(key)) {
+        return *value;
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+V* CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::find(const K& key) {
+    size_t pos = findSlot(key, hash(key));
+    if(pos > indexMask) {
+        return nullptr;
+    }
+    size_t entry = (index[pos] & entryMask) - 1;
+    if(expired(entries[entry].entry)) {
+        evict(pos);
+        return nullptr;
+    }
+    flags[entry] |= referencedFlag;
+    return &entries[entry].entry.value;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+bool CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::contains(const K& key) const {
+    size_t pos = findSlot(key, hash(key));
+    return pos <= indexMask && !expired(entries[(index[pos] & entryMask) - 1].entry);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::erase(const K& key) {
+    size_t pos = findSlot(key, hash(key));
+    if(pos <= indexMask) {
+        removeEntry(pos);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+size_t CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::evict_expired() {
+    if(timeToLive == Clock::duration::zero()) {
+        return 0;
+    }
+    size_t evicted = 0;
+    Clock::time_point now = Clock::now();
+    for(size_t entry = 0; entry < nextUnused; ++entry) {
+        if((flags[entry] & liveFlag) && now >= entries[entry].entry.expiry) {
+            evict(slotOf(entry));
+            ++evicted;
+        }
+    }
+    return evicted;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::clear() noexcept {
+    destroyEntries();
+    std::fill_n(index.get(), indexMask + 1, 0);
+    currentSize = 0;
+    nextUnused = 0;
+    freeCount = 0;
+    hand = 0;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+template<typename F>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::for_each(F&& visitor) const {
+    for(size_t entry = 0; entry < nextUnused; ++entry) {
+        if(flags[entry] & liveFlag) {
+            visitor(entries[entry].entry.key, entries[entry].entry.value);
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+size_t CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::findSlot(const K& key, size_t keyHash) const {
+    const uint64_t tag = keyHash & ~entryMask;
+    for(size_t pos = keyHash & indexMask; index[pos] != 0; pos = (pos + 1) & indexMask) {
+        if((index[pos] & ~entryMask) == tag) {
+            const Entry& entry = entries[(index[pos] & entryMask) - 1].entry;
+            if(keyEqual(entry.key, key)) {
+                return pos;
+            }
+        }
+    }
+    return indexMask + 1;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+size_t CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::slotOf(size_t entry) const {
+    size_t pos = entries[entry].entry.hash & indexMask;
+    while((index[pos] & entryMask) != entry + 1) {
+        pos = (pos + 1) & indexMask;
+    }
+    return pos;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::removeSlot(size_t hole) noexcept {
+    // Shifts back every following slot of the run that may use the hole, i.e. whose home
+    // slot is not between the hole and its own slot
+    for(size_t pos = (hole + 1) & indexMask; index[pos] != 0; pos = (pos + 1) & indexMask) {
+        size_t home = entries[(index[pos] & entryMask) - 1].entry.hash & indexMask;
+        if(((pos - home) & indexMask) >= ((pos - hole) & indexMask)) {
+            index[hole] = index[pos];
+            hole = pos;
+        }
+    }
+    index[hole] = 0;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::evict(size_t pos) {
+    // If onEvict throws, the entry stays
+    Entry& entry = entries[(index[pos] & entryMask) - 1].entry;
+    onEvict(std::as_const(entry.key), entry.value);
+    removeEntry(pos);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::removeEntry(size_t pos) noexcept {
+    size_t entry = (index[pos] & entryMask) - 1;
+    removeSlot(pos);
+    std::destroy_at(&entries[entry].entry);
+    flags[entry] = 0;
+    freeEntries[freeCount++] = static_cast<uint32_t>(entry);
+    --currentSize;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::evictOne() {
+    // Every entry is live, so the hand stops within two turns
+    Clock::time_point now = timeToLive == Clock::duration::zero() ? Clock::time_point() : Clock::now();
+    while(true) {
+        size_t entry = hand;
+        hand = hand + 1 == entryCount ? 0 : hand + 1;
+        bool stale = timeToLive != Clock::duration::zero() && now >= entries[entry].entry.expiry;
+        if((flags[entry] & referencedFlag) && !stale) {
+            flags[entry] &= ~referencedFlag;
+            continue;
+        }
+        evict(slotOf(entry));
+        return;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename OnEvict>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && std::is_invocable_v<OnEvict&, const K&, V&>
+void CeTuClockCache<K, V, Hash, KeyEqual, OnEvict>::destroyEntries() noexcept {
+    for(size_t entry = 0; entry < nextUnused; ++entry) {
+        if(flags[entry] & liveFlag) {
+            std::destroy_at(&entries[entry].entry);
+            flags[entry] = 0;
+        }
+    }
+}
+
+#endif // CETU_CLOCK_CACHE_H
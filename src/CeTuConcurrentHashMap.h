@@ -0,0 +1,257 @@
+#ifndef CETU_CONCURRENT_HASHMAP_H
+#define CETU_CONCURRENT_HASHMAP_H
+
+#include "CeTuHashMap.h"
+#include "CeTuParallel.h"
+
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <shared_mutex>
+#include <stdexcept>
+#include <vector>
+
+// Thread-safe map made of independently locked CeTuHashMap shards. The high bits of the
+// mixed hash pick the shard (the shard itself indexes its buckets with the low bits), so
+// threads working on different keys rarely wait for each other. Every shard lives on its
+// own cache line and takes a shared lock for reads and an exclusive one for writes.
+// The shards themselves are allocated through Allocator, like the buckets and nodes.
+// Values are returned by copy: a reference into a shard would outlive its lock.
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>,
+         typename Allocator = std::allocator<std::pair<const K, V>>>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+class CeTuConcurrentHashMap final {
+public:
+    // shardCount is rounded up to a power of two
+    explicit CeTuConcurrentHashMap(size_t shardCount = defaultShardCount, const Allocator& allocator = Allocator());
+
+    ~CeTuConcurrentHashMap() noexcept { destroyShards(shardCount); }
+
+    // Disable copying and moving, other threads may hold references to the map
+    CeTuConcurrentHashMap(const CeTuConcurrentHashMap&) = delete;
+    CeTuConcurrentHashMap& operator=(const CeTuConcurrentHashMap&) = delete;
+
+    void insert(K key, V value);
+    std::optional<V> lookup(const K& key) const;
+    bool contains(const K& key) const;
+    void erase(const K& key);
+    // Sum of the shard sizes; concurrent writers may change it while it is computed
+    size_t size() const;
+    size_t shard_count() const { return shardCount; }
+    // Makes room for n entries spread evenly over the shards
+    void reserve(size_t n);
+
+    // Calls update on the value stored for key, default-constructing it first if key is
+    // absent, all under the shard lock. Returns whether key was inserted.
+    template<typename F>
+    bool insert_or_update(const K& key, F&& update) requires std::is_default_constructible_v<V>;
+
+    // Returns the value stored for key, inserting compute() first if key is absent.
+    // compute is called at most once and under the shard lock, so it must not use the map.
+    template<typename F>
+    V compute_if_absent(const K& key, F&& compute);
+
+    // CeTuHashMap::upsert under the shard lock
+    template<typename F>
+    void upsert(K key, V value, F&& combine);
+
+    // Upserts every key/value pair of a random access range, without contending for the
+    // shard locks: the range is split over up to threads threads, each combining its slice
+    // into private maps laid out like the shards, and then every shard merges the private
+    // maps of all threads on a thread of its own. The result is that of upserting the
+    // pairs in order if combine is associative; it is called from several threads at once.
+    template<std::ranges::random_access_range Range, typename F>
+    void aggregate(const Range& entries, size_t threads, F&& combine) requires CopyAssignableAndConstructible<K, V>;
+
+private:
+    using Map = CeTuHashMap<K, V, Hash, KeyEqual, Allocator>;
+
+    struct alignas(CeTuDetail::cacheLineSize) Shard {
+        mutable std::shared_mutex mutex;
+        Map map;
+
+        explicit Shard(const Allocator& allocator) : map(allocator) {}
+    };
+    using ShardAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Shard>;
+    using ShardTraits = std::allocator_traits<ShardAllocator>;
+
+    static constexpr size_t defaultShardCount = 64;
+
+    [[no_unique_address]] ShardAllocator shardAllocator;
+    Shard* shards;
+    size_t shardCount;
+    int shardBits;
+    CeTuDetail::SeededHash<Hash> hasher;
+
+    size_t shardIndex(const K& key) const { return shardBits == 0 ? 0 : CeTuDetail::hashKey(hasher, key) >> (64 - shardBits); }
+    Shard& shardFor(const K& key) const { return shards[shardIndex(key)]; }
+    // Destroys the first constructed shards and frees the array
+    void destroyShards(size_t constructed) noexcept;
+};
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::CeTuConcurrentHashMap(size_t _shardCount, const Allocator& allocator) :
+    shardAllocator(allocator) {
+    if(_shardCount == 0) {
+        throw std::invalid_argument("CeTuConcurrentHashMap: shardCount must be positive");
+    }
+
+    shardCount = std::bit_ceil(_shardCount);
+    shardBits = std::countr_zero(shardCount);
+    shards = ShardTraits::allocate(shardAllocator, shardCount);
+    size_t constructed = 0;
+    try {
+        for(; constructed < shardCount; ++constructed) {
+            ShardTraits::construct(shardAllocator, shards + constructed, allocator);
+        }
+    } catch(...) {
+        destroyShards(constructed);
+        throw;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::destroyShards(size_t constructed) noexcept {
+    for(size_t i = 0; i < constructed; ++i) {
+        ShardTraits::destroy(shardAllocator, shards + i);
+    }
+    ShardTraits::deallocate(shardAllocator, shards, shardCount);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::insert(K key, V value) {
+    Shard& shard = shardFor(key);
+    std::unique_lock lock(shard.mutex);
+    shard.map.insert(std::move(key), std::move(value));
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+std::optional<V> CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::lookup(const K& key) const {
+    const Shard& shard = shardFor(key);
+    std::shared_lock lock(shard.mutex);
+    return shard.map.lookup(key);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+bool CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::contains(const K& key) const {
+    const Shard& shard = shardFor(key);
+    std::shared_lock lock(shard.mutex);
+    return shard.map.contains(key);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::erase(const K& key) {
+    Shard& shard = shardFor(key);
+    std::unique_lock lock(shard.mutex);
+    shard.map.erase(key);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+size_t CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::size() const {
+    size_t total = 0;
+    for(size_t i = 0; i < shardCount; ++i) {
+        std::shared_lock lock(shards[i].mutex);
+        total += shards[i].map.size();
+    }
+    return total;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::reserve(size_t n) {
+    size_t perShard = (n + shardCount - 1) / shardCount;
+    for(size_t i = 0; i < shardCount; ++i) {
+        std::unique_lock lock(shards[i].mutex);
+        shards[i].map.reserve(perShard);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+bool CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::insert_or_update(const K& key, F&& update) requires std::is_default_constructible_v<V> {
+    Shard& shard = shardFor(key);
+    std::unique_lock lock(shard.mutex);
+    auto [value, inserted] = shard.map.try_emplace(key);
+    std::forward<F>(update)(*value);
+    return inserted;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+V CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::compute_if_absent(const K& key, F&& compute) {
+    Shard& shard = shardFor(key);
+    {
+        std::shared_lock lock(shard.mutex);
+        if(const V* value = shard.map.find(key)) {
+            return *value;
+        }
+    }
+
+    // Another thread may have inserted key in between
+    std::unique_lock lock(shard.mutex);
+    if(V* value = shard.map.find(key)) {
+        return *value;
+    }
+    return *shard.map.try_emplace(key, std::forward<F>(compute)()).first;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+void CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::upsert(K key, V value, F&& combine) {
+    Shard& shard = shardFor(key);
+    std::unique_lock lock(shard.mutex);
+    shard.map.upsert(std::move(key), std::move(value), std::forward<F>(combine));
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<std::ranges::random_access_range Range, typename F>
+void CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>::aggregate(const Range& entries, size_t threads, F&& combine)
+    requires CopyAssignableAndConstructible<K, V> {
+    const size_t count = std::ranges::size(entries);
+    threads = std::max<size_t>(threads, 1);
+
+    // partials[t * shardCount + s] holds the keys of shard s seen by thread t. They share
+    // the allocator and the seed of their shard, so merging them only relinks nodes and
+    // reuses the stored hashes.
+    std::vector<Map> partials;
+    partials.reserve(threads * shardCount);
+    for(size_t t = 0; t < threads; ++t) {
+        for(size_t s = 0; s < shardCount; ++s) {
+            std::shared_lock lock(shards[s].mutex);
+            partials.push_back(Map::empty_like(shards[s].map));
+        }
+    }
+    CeTuDetail::parallelFor(threads, [&](size_t t) {
+        for(size_t i = count * t / threads; i < count * (t + 1) / threads; ++i) {
+            const auto& [key, value] = entries[i];
+            partials[t * shardCount + shardIndex(key)].upsert(key, value, combine);
+        }
+    });
+
+    // Each shard is locked by a single reducer, which merges the threads in slice order
+    const size_t reducers = std::min(threads, shardCount);
+    CeTuDetail::parallelFor(reducers, [&](size_t r) {
+        for(size_t s = r; s < shardCount; s += reducers) {
+            std::unique_lock lock(shards[s].mutex);
+            for(size_t t = 0; t < threads; ++t) {
+                shards[s].map.merge(std::move(partials[t * shardCount + s]), combine);
+            }
+        }
+    });
+}
+
+#endif // CETU_CONCURRENT_HASHMAP_H
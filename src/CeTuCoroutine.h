@@ -0,0 +1,221 @@
+#ifndef CETU_COROUTINE_H
+#define CETU_COROUTINE_H
+
+#include "CeTuHashMapCommon.h"
+
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <ranges>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace CeTuDetail {
+
+// Recycles coroutine frames on the thread that freed them, so that a long run of lookups
+// does not go through the global allocator for every key. Frames are pooled by size
+// class; larger ones are not pooled.
+class FramePool final {
+public:
+    static void* allocate(size_t size) {
+        size_t sizeClass = classOf(size);
+        if(sizeClass < classCount) {
+            FreeFrame*& head = local().heads[sizeClass];
+            if(head != nullptr) {
+                FreeFrame* frame = head;
+                head = frame->next;
+                return frame;
+            }
+            return ::operator new((sizeClass + 1) * granularity);
+        }
+        return ::operator new(size);
+    }
+
+    static void deallocate(void* frame, size_t size) noexcept {
+        size_t sizeClass = classOf(size);
+        if(sizeClass < classCount) {
+            FreeFrame*& head = local().heads[sizeClass];
+            head = ::new(frame) FreeFrame{head};
+            return;
+        }
+        ::operator delete(frame);
+    }
+
+private:
+    struct FreeFrame {
+        FreeFrame* next;
+    };
+
+    struct Lists {
+        FreeFrame* heads[16] = {};
+
+        ~Lists() {
+            for(FreeFrame* head : heads) {
+                while(head != nullptr) {
+                    FreeFrame* next = head->next;
+                    ::operator delete(head);
+                    head = next;
+                }
+            }
+        }
+    };
+
+    static constexpr size_t granularity = 64;
+    static constexpr size_t classCount = 16;
+
+    static size_t classOf(size_t size) { return (size + granularity - 1) / granularity - 1; }
+    static Lists& local() {
+        thread_local Lists lists;
+        return lists;
+    }
+};
+
+// Awaited before touching address: issues the prefetch and suspends, so that the
+// scheduler can run other lookups while the line is on its way
+struct PrefetchAwaiter {
+    const void* address;
+
+    bool await_ready() const noexcept {
+        prefetch(address);
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<>) const noexcept {}
+    void await_resume() const noexcept {}
+};
+
+} // namespace CeTuDetail
+
+// Lazily started coroutine computing a T, as returned by the lookup_async members of the
+// maps. It does nothing until resumed, suspends before each memory access that is likely
+// to miss the cache, and must not be resumed once done().
+template<typename T>
+class CeTuLookupTask final {
+public:
+    struct promise_type {
+        T value{};
+        std::exception_ptr failure;
+
+        static void* operator new(size_t size) { return CeTuDetail::FramePool::allocate(size); }
+        static void operator delete(void* frame, size_t size) noexcept { CeTuDetail::FramePool::deallocate(frame, size); }
+
+        CeTuLookupTask get_return_object() noexcept { return CeTuLookupTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_always final_suspend() const noexcept { return {}; }
+        void return_value(T result) noexcept { value = std::move(result); }
+        void unhandled_exception() noexcept { failure = std::current_exception(); }
+    };
+
+    CeTuLookupTask(CeTuLookupTask&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    CeTuLookupTask& operator=(CeTuLookupTask&& other) noexcept {
+        if(this != &other) {
+            reset();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~CeTuLookupTask() noexcept { reset(); }
+
+    bool done() const { return handle.done(); }
+    // Runs up to the next suspension point
+    void resume() const { handle.resume(); }
+    // Runs to completion and returns the result, rethrowing what the lookup threw
+    T get() const;
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit CeTuLookupTask(std::coroutine_handle<promise_type> _handle) noexcept : handle(_handle) {}
+    void reset() noexcept {
+        if(handle) {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+};
+
+template<typename T>
+T CeTuLookupTask<T>::get() const {
+    while(!handle.done()) {
+        handle.resume();
+    }
+    if(handle.promise().failure) {
+        std::rethrow_exception(handle.promise().failure);
+    }
+    return handle.promise().value;
+}
+
+// Interleaves the lookup_async coroutines of up to groupSize keys on the calling thread.
+// Each one is resumed in turn until it suspends on its next prefetch, so the cache misses
+// of the whole group overlap; a finished lookup hands its slot to the next key. The group
+// should be about as large as the number of misses the core keeps in flight, more only
+// pays off while the frames still fit in L1.
+class CeTuLookupScheduler final {
+public:
+    static constexpr size_t defaultGroupSize = 16;
+
+    explicit CeTuLookupScheduler(size_t _groupSize = defaultGroupSize) : groupSize(_groupSize) {
+        if(groupSize == 0) {
+            throw std::invalid_argument("CeTuLookupScheduler: groupSize must be positive");
+        }
+    }
+
+    size_t group_size() const { return groupSize; }
+
+    // results[i] receives map.lookup_async(keys[i]); the ranges must have the same size
+    template<typename Map, std::ranges::random_access_range Keys, std::ranges::random_access_range Results>
+    void run(Map& map, const Keys& keys, Results&& results) const;
+
+private:
+    size_t groupSize;
+};
+
+template<typename Map, std::ranges::random_access_range Keys, std::ranges::random_access_range Results>
+void CeTuLookupScheduler::run(Map& map, const Keys& keys, Results&& results) const {
+    const size_t count = std::ranges::size(keys);
+    if(count != std::ranges::size(results)) {
+        throw std::invalid_argument("CeTuLookupScheduler: run needs as many results as keys");
+    }
+
+    using Task = decltype(map.lookup_async(keys[0]));
+    std::vector<Task> group;
+    std::vector<size_t> indices;
+    group.reserve(std::min(groupSize, count));
+    indices.reserve(std::min(groupSize, count));
+    // Starting a lookup already issues its first prefetch
+    size_t next = 0;
+    for(; next < count && group.size() < groupSize; ++next) {
+        group.push_back(map.lookup_async(keys[next]));
+        indices.push_back(next);
+        group.back().resume();
+    }
+
+    // The first active lookups are pending, the others are finished
+    size_t active = group.size();
+    while(active > 0) {
+        for(size_t slot = 0; slot < active;) {
+            Task& task = group[slot];
+            if(!task.done()) {
+                task.resume();
+            }
+            if(!task.done()) {
+                ++slot;
+                continue;
+            }
+            results[indices[slot]] = task.get();
+            if(next < count) {
+                task = map.lookup_async(keys[next]);
+                indices[slot] = next++;
+                task.resume();
+                ++slot;
+            } else {
+                --active;
+                std::swap(group[slot], group[active]);
+                std::swap(indices[slot], indices[active]);
+            }
+        }
+    }
+}
+
+#endif // CETU_COROUTINE_H
@@ -0,0 +1,374 @@
+#ifndef CETU_DENSE_HASHMAP_H
+#define CETU_DENSE_HASHMAP_H
+
+#include "CeTuHashMapCommon.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+// Key reserved to mark the empty slots of a CeTuDenseHashMap, used by its default
+// constructor. Defined for integral types (the maximum value) and pointers (nullptr);
+// specialize it for other key types or pass the key to the constructor.
+template<typename K>
+struct CeTuEmptyKey;
+
+template<typename K>
+requires std::is_integral_v<K>
+struct CeTuEmptyKey<K> {
+    static constexpr K value = std::numeric_limits<K>::max();
+};
+
+template<typename K>
+requires std::is_pointer_v<K>
+struct CeTuEmptyKey<K> {
+    static constexpr K value = nullptr;
+};
+
+// Open addressing engine for trivially copyable keys and values, such as integers.
+// Keys and values live in two separate arrays, so probing only touches keys, and empty
+// slots hold a reserved empty key instead of any metadata bytes. Collisions are resolved
+// by linear probing; erase shifts the following entries back instead of leaving
+// tombstones. Entries are relocated with memcpy when the arrays grow or are copied.
+// Hashing follows CeTuHashMap: Hash plus CeTuDetail::mix unless it is an AvalanchingHash.
+// The empty key itself can never be inserted.
+// Attention: CeTuDenseHashMap is not thread-safe.
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+class CeTuDenseHashMap final {
+public:
+    CeTuDenseHashMap() requires requires { CeTuEmptyKey<K>::value; } : CeTuDenseHashMap(CeTuEmptyKey<K>::value) {}
+    // Reserves room for expectedSize entries up front
+    explicit CeTuDenseHashMap(const K& emptyKey, size_t expectedSize = 0);
+
+    CeTuDenseHashMap(const CeTuDenseHashMap& other);
+    CeTuDenseHashMap& operator=(const CeTuDenseHashMap& other);
+
+    CeTuDenseHashMap(CeTuDenseHashMap&& other) noexcept;
+    CeTuDenseHashMap& operator=(CeTuDenseHashMap&& other) noexcept;
+
+    // Throws std::invalid_argument for the empty key
+    void insert(K key, V value);
+    std::optional<V> lookup(const K& key) const;
+    V* find(const K& key) { return findImpl(key); }
+    const V* find(const K& key) const { return findImpl(key); }
+    bool contains(const K& key) const { return findImpl(key) != nullptr; }
+    void erase(const K& key);
+    size_t size() const { return currentSize; }
+    bool empty() const { return currentSize == 0; }
+    // Erases every entry but keeps the arrays
+    void clear() noexcept;
+    const K& empty_key() const { return emptyKey; }
+
+    // The slot count is always a power of two
+    size_t bucket_count() const { return capacity; }
+    float load_factor() const { return capacity == 0 ? 0.0f : static_cast<float>(currentSize) / capacity; }
+    // Makes room for n entries without any further rehash
+    void reserve(size_t n);
+
+    // Calls visitor(key, value) for every entry, in no particular order
+    template<typename F>
+    void for_each(F&& visitor) const;
+
+private:
+    // RAII wrapper for the key and value arrays. Every key is constructed, as emptyKey
+    // when the slot is free; values are only meaningful next to a used key.
+    class ArraysHolder {
+    public:
+        ArraysHolder() : capacity(0), keys(nullptr), values(nullptr) {}
+        ArraysHolder(size_t _capacity, const K& emptyKey);
+        ~ArraysHolder() { clear(); }
+
+        // Disable copying
+        ArraysHolder(const ArraysHolder&) = delete;
+        ArraysHolder& operator=(const ArraysHolder&) = delete;
+
+        // Enable moving
+        ArraysHolder(ArraysHolder&& other) noexcept;
+        ArraysHolder& operator=(ArraysHolder&& other) noexcept;
+
+        K* getKeys() const { return keys; }
+        V* getValues() const { return values; }
+
+    private:
+        size_t capacity;
+        K* keys;
+        V* values;
+
+        void clear();
+    };
+
+    static constexpr size_t defaultSize = 16;
+    static constexpr float maxLoadFactor = 0.7f;
+
+    ArraysHolder arrays;
+    size_t currentSize;
+    size_t capacity;
+    K emptyKey;
+    CeTuDetail::SeededHash<Hash> hasher;
+    [[no_unique_address]] KeyEqual keyEqual;
+
+    size_t hash(const K& key) const { return CeTuDetail::hashKey(hasher, key); }
+    bool isEmpty(const K& key) const { return keyEqual(key, emptyKey); }
+    // Returns the slot index holding key, or capacity if there is none
+    size_t findIndex(const K& key) const;
+    V* findImpl(const K& key) const;
+    void resize(size_t newCapacity);
+};
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+CeTuDenseHashMap<K, V, Hash, KeyEqual>::CeTuDenseHashMap(const K& _emptyKey, size_t expectedSize) :
+    currentSize(0), capacity(CeTuDetail::capacityFor(expectedSize, maxLoadFactor, defaultSize)), emptyKey(_emptyKey) {
+    arrays = ArraysHolder(capacity, emptyKey);
+}
+
+// Copy constructor
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+CeTuDenseHashMap<K, V, Hash, KeyEqual>::CeTuDenseHashMap(const CeTuDenseHashMap& other) :
+    arrays(other.capacity, other.emptyKey), currentSize(other.currentSize), capacity(other.capacity),
+    emptyKey(other.emptyKey), hasher(other.hasher), keyEqual(other.keyEqual) {
+    if(capacity != 0) {
+        std::memcpy(static_cast<void*>(arrays.getKeys()), other.arrays.getKeys(), capacity * sizeof(K));
+        std::memcpy(static_cast<void*>(arrays.getValues()), other.arrays.getValues(), capacity * sizeof(V));
+    }
+}
+
+// Copy assignment operator
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+CeTuDenseHashMap<K, V, Hash, KeyEqual>& CeTuDenseHashMap<K, V, Hash, KeyEqual>::operator=(const CeTuDenseHashMap& other) {
+    if(this != &other) {
+        CeTuDenseHashMap copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+// Move constructor
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+CeTuDenseHashMap<K, V, Hash, KeyEqual>::CeTuDenseHashMap(CeTuDenseHashMap&& other) noexcept :
+    arrays(std::move(other.arrays)), currentSize(other.currentSize), capacity(other.capacity),
+    emptyKey(other.emptyKey), hasher(std::move(other.hasher)), keyEqual(std::move(other.keyEqual)) {
+    other.currentSize = 0;
+    other.capacity = 0;
+}
+
+// Move assignment operator
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+CeTuDenseHashMap<K, V, Hash, KeyEqual>& CeTuDenseHashMap<K, V, Hash, KeyEqual>::operator=(CeTuDenseHashMap&& other) noexcept {
+    if(this != &other) {
+        arrays = std::move(other.arrays);
+        currentSize = other.currentSize;
+        capacity = other.capacity;
+        emptyKey = other.emptyKey;
+        hasher = std::move(other.hasher);
+        keyEqual = std::move(other.keyEqual);
+        other.currentSize = 0;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuDenseHashMap<K, V, Hash, KeyEqual>::insert(K key, V value) {
+    if(isEmpty(key)) {
+        throw std::invalid_argument("CeTuDenseHashMap: the empty key cannot be inserted");
+    }
+    if(currentSize + 1 > capacity * maxLoadFactor) {
+        resize(capacity == 0 ? defaultSize : capacity * 2);
+    }
+
+    K* keys = arrays.getKeys();
+    size_t mask = capacity - 1;
+    for(size_t index = hash(key) & mask;; index = (index + 1) & mask) {
+        if(isEmpty(keys[index])) {
+            keys[index] = key;
+            std::construct_at(arrays.getValues() + index, value);
+            ++currentSize;
+            return;
+        }
+        if(keyEqual(keys[index], key)) {
+            arrays.getValues()[index] = value;
+            return;
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+std::optional<V> CeTuDenseHashMap<K, V, Hash, KeyEqual>::lookup(const K& key) const {
+    if(const V* value = findImpl(key)) {
+        return *value;
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuDenseHashMap<K, V, Hash, KeyEqual>::erase(const K& key) {
+    size_t hole = findIndex(key);
+    if(hole == capacity) {
+        return;
+    }
+
+    // Shifts back every following entry of the run that may use the hole, i.e. whose home
+    // slot is not between the hole and its own slot
+    K* keys = arrays.getKeys();
+    V* values = arrays.getValues();
+    size_t mask = capacity - 1;
+    for(size_t index = (hole + 1) & mask; !isEmpty(keys[index]); index = (index + 1) & mask) {
+        size_t home = hash(keys[index]) & mask;
+        if(((index - home) & mask) >= ((index - hole) & mask)) {
+            keys[hole] = keys[index];
+            std::memcpy(static_cast<void*>(values + hole), values + index, sizeof(V));
+            hole = index;
+        }
+    }
+    keys[hole] = emptyKey;
+    --currentSize;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuDenseHashMap<K, V, Hash, KeyEqual>::clear() noexcept {
+    std::fill_n(arrays.getKeys(), capacity, emptyKey);
+    currentSize = 0;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuDenseHashMap<K, V, Hash, KeyEqual>::reserve(size_t n) {
+    size_t needed = CeTuDetail::capacityFor(n, maxLoadFactor, defaultSize);
+    if(needed > capacity) {
+        resize(needed);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+void CeTuDenseHashMap<K, V, Hash, KeyEqual>::for_each(F&& visitor) const {
+    const K* keys = arrays.getKeys();
+    const V* values = arrays.getValues();
+    for(size_t i = 0; i < capacity; ++i) {
+        if(!isEmpty(keys[i])) {
+            visitor(keys[i], values[i]);
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+size_t CeTuDenseHashMap<K, V, Hash, KeyEqual>::findIndex(const K& key) const {
+    if(capacity == 0) {
+        return capacity;
+    }
+    // Stops at the first empty slot, which also rejects the empty key itself
+    const K* keys = arrays.getKeys();
+    size_t mask = capacity - 1;
+    for(size_t index = hash(key) & mask;; index = (index + 1) & mask) {
+        if(isEmpty(keys[index])) {
+            return capacity;
+        }
+        if(keyEqual(keys[index], key)) {
+            return index;
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+V* CeTuDenseHashMap<K, V, Hash, KeyEqual>::findImpl(const K& key) const {
+    size_t index = findIndex(key);
+    return index == capacity ? nullptr : arrays.getValues() + index;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuDenseHashMap<K, V, Hash, KeyEqual>::resize(size_t newCapacity) {
+    ArraysHolder grown(newCapacity, emptyKey);
+    K* newKeys = grown.getKeys();
+    V* newValues = grown.getValues();
+    const K* keys = arrays.getKeys();
+    const V* values = arrays.getValues();
+
+    // Keys are unique, so every entry just takes the first empty slot of its run
+    size_t mask = newCapacity - 1;
+    for(size_t i = 0; i < capacity; ++i) {
+        if(isEmpty(keys[i])) {
+            continue;
+        }
+        size_t index = hash(keys[i]) & mask;
+        while(!isEmpty(newKeys[index])) {
+            index = (index + 1) & mask;
+        }
+        newKeys[index] = keys[i];
+        std::memcpy(static_cast<void*>(newValues + index), values + i, sizeof(V));
+    }
+
+    arrays = std::move(grown);
+    capacity = newCapacity;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+CeTuDenseHashMap<K, V, Hash, KeyEqual>::ArraysHolder::ArraysHolder(size_t _capacity, const K& emptyKey) :
+    capacity(_capacity), keys(nullptr), values(nullptr)
+{
+    keys = std::allocator<K>().allocate(capacity);
+    try {
+        values = std::allocator<V>().allocate(capacity);
+    } catch(...) {
+        std::allocator<K>().deallocate(keys, capacity);
+        throw;
+    }
+    std::uninitialized_fill_n(keys, capacity, emptyKey);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+CeTuDenseHashMap<K, V, Hash, KeyEqual>::ArraysHolder::ArraysHolder(ArraysHolder&& other) noexcept :
+    capacity(other.capacity), keys(other.keys), values(other.values)
+{
+    other.capacity = 0;
+    other.keys = nullptr;
+    other.values = nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+CeTuDenseHashMap<K, V, Hash, KeyEqual>::ArraysHolder& CeTuDenseHashMap<K, V, Hash, KeyEqual>::ArraysHolder::operator=(ArraysHolder&& other) noexcept {
+    if(this != &other) {
+        clear();
+        capacity = other.capacity;
+        keys = other.keys;
+        values = other.values;
+        other.capacity = 0;
+        other.keys = nullptr;
+        other.values = nullptr;
+    }
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires DenseHashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuDenseHashMap<K, V, Hash, KeyEqual>::ArraysHolder::clear() {
+    // Keys and values are trivially destructible
+    if(keys) {
+        std::allocator<K>().deallocate(keys, capacity);
+        std::allocator<V>().deallocate(values, capacity);
+        keys = nullptr;
+        values = nullptr;
+    }
+}
+
+#endif // CETU_DENSE_HASHMAP_H
@@ -0,0 +1,901 @@
+#ifndef CETU_FLAT_HASHMAP_H
+#define CETU_FLAT_HASHMAP_H
+
+#include "CeTuHashMapCommon.h"
+#include "CeTuCoroutine.h"
+#include "CeTuGroup.h"
+#include "CeTuSerialization.h"
+
+#include <optional>
+#include <memory>
+#include <cstring>
+#include <bit>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+// Open-addressing storage engine with the same API as CeTuHashMap.
+// Keys and values are stored inline in one contiguous slot array. A parallel array of
+// control bytes marks every slot as empty, deleted or full; full slots keep a 7-bit hash
+// fragment, so most mismatching slots are rejected without touching the slot array.
+// Probing compares the fragment against a whole group of control bytes at once (see CeTuGroup.h).
+// Hashing follows CeTuHashMap: Hash plus CeTuDetail::mix unless it is an AvalanchingHash;
+// the low 7 bits become the fragment and the rest select the starting group. Keys are
+// compared with KeyEqual; lookup and erase also accept any TransparentKey.
+// When CeTuStoreHash<K> is set, every slot also keeps the full hash.
+// Attention: CeTuFlatHashMap is not thread-safe.
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+class CeTuFlatHashMap final {
+    template<bool Const>
+    class Iterator;
+
+public:
+    CeTuFlatHashMap();
+    // Reserves room for expectedSize entries up front
+    explicit CeTuFlatHashMap(size_t expectedSize);
+    ~CeTuFlatHashMap() noexcept;
+
+    CeTuFlatHashMap(const CeTuFlatHashMap& other) requires CopyAssignableAndConstructible<K, V>;
+    CeTuFlatHashMap& operator=(const CeTuFlatHashMap& other) requires CopyAssignableAndConstructible<K, V>;
+
+    CeTuFlatHashMap(CeTuFlatHashMap&& other) noexcept;
+    CeTuFlatHashMap& operator=(CeTuFlatHashMap&& other) noexcept;
+
+    void insert(K key, V value);
+    std::optional<V> lookup(const K& key) const;
+    void erase(const K& key);
+    size_t size() const { return currentSize; }
+    bool empty() const { return currentSize == 0; }
+    // Erases every entry but keeps the slots
+    void clear() noexcept;
+
+    // The slot count is always a power of two. Tombstones count against the load factor.
+    size_t bucket_count() const { return capacity; }
+    float load_factor() const { return capacity == 0 ? 0.0f : static_cast<float>(currentSize) / capacity; }
+    float max_load_factor() const { return maxLoadFactor; }
+    // Must be in (0, 1]; grows the slots right away if size() already exceeds the new limit
+    void max_load_factor(float value);
+    // Makes room for n entries without any further rehash
+    void reserve(size_t n);
+    // Sets the slot count to at least bucketCount and enough for size(); may shrink
+    void rehash(size_t bucketCount);
+    // Shrinks the slots to fit size()
+    void shrink_to_fit() { rehash(0); }
+
+    // Constructs V from args only if key is absent. Returns the stored value and whether
+    // it was inserted.
+    template<typename... Args>
+    std::pair<V*, bool> try_emplace(const K& key, Args&&... args) { return tryEmplaceImpl(key, std::forward<Args>(args)...); }
+    template<typename... Args>
+    std::pair<V*, bool> try_emplace(K&& key, Args&&... args) { return tryEmplaceImpl(std::move(key), std::forward<Args>(args)...); }
+
+    // Like try_emplace, but builds the key from keyArg first
+    template<typename KeyArg, typename... Args>
+    std::pair<V*, bool> emplace(KeyArg&& keyArg, Args&&... args);
+
+    // Inserts value or assigns it over the existing one
+    template<typename M>
+    std::pair<V*, bool> insert_or_assign(const K& key, M&& value);
+    template<typename M>
+    std::pair<V*, bool> insert_or_assign(K&& key, M&& value);
+
+    V& operator[](const K& key) requires std::is_default_constructible_v<V> { return *tryEmplaceImpl(key).first; }
+    V& operator[](K&& key) requires std::is_default_constructible_v<V> { return *tryEmplaceImpl(std::move(key)).first; }
+
+    // Pointer to the value stored for key, or nullptr. The pointer stays valid until the
+    // entry is erased or the map is rehashed.
+    V* find(const K& key) { return findImpl(key); }
+    const V* find(const K& key) const { return findImpl(key); }
+    bool contains(const K& key) const { return findImpl(key) != nullptr; }
+
+    // Heterogeneous overloads, see TransparentKey
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    std::optional<V> lookup(const Q& key) const { return lookupImpl(key); }
+
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    V* find(const Q& key) { return findImpl(key); }
+
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    const V* find(const Q& key) const { return findImpl(key); }
+
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    bool contains(const Q& key) const { return findImpl(key) != nullptr; }
+
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    void erase(const Q& key) { eraseImpl(key); }
+
+    // Batched operations. Keys are hashed and their probe positions prefetched a chunk at a
+    // time before any of them is resolved, so the cache misses overlap.
+    // results[i] receives find(keys[i]); the spans must have the same size.
+    void lookup_batch(std::span<const K> keys, std::span<V*> results);
+    void lookup_batch(std::span<const K> keys, std::span<const V*> results) const;
+    // Same as insert(keys[i], values[i]) for every i
+    void insert_batch(std::span<const K> keys, std::span<const V> values) requires CopyAssignableAndConstructible<K, V>;
+    void erase_batch(std::span<const K> keys);
+
+    // find(key) as a coroutine that suspends before each access likely to miss the cache,
+    // for interleaving many lookups with CeTuLookupScheduler. The task keeps its own copy of
+    // key; the map must not be modified while it is pending.
+    CeTuLookupTask<V*> lookup_async(K key) { return lookupAsyncImpl<V*>(std::move(key)); }
+    CeTuLookupTask<const V*> lookup_async(K key) const { return lookupAsyncImpl<const V*>(std::move(key)); }
+
+    // Forward iterators over all entries. Dereferencing yields a pair of references to the
+    // key and the value. Any insertion or erase invalidates them.
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    iterator begin() { return iterator(const_cast<Slot*>(slots.get()), slots.control(), 0, capacity); }
+    iterator end() { return iterator(const_cast<Slot*>(slots.get()), slots.control(), capacity, capacity); }
+    const_iterator begin() const { return const_iterator(const_cast<Slot*>(slots.get()), slots.control(), 0, capacity); }
+    const_iterator end() const { return const_iterator(const_cast<Slot*>(slots.get()), slots.control(), capacity, capacity); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    // Calls visitor(key, value) for every entry, in no particular order. The map must not
+    // be modified meanwhile.
+    template<typename F>
+    void for_each(F&& visitor) const;
+
+    // Writes all entries to out in batches, see CeTuSerializer for the encoding
+    void serialize(std::ostream& out) const requires CeTuSerializable<K> && CeTuSerializable<V> { CeTuDetail::serializeMap<K, V>(*this, out); }
+    // Reads a map written by serialize, one batch at a time
+    static CeTuFlatHashMap deserialize(std::istream& in) requires CeTuSerializable<K> && CeTuSerializable<V>;
+
+#ifdef CETU_HASHMAP_STATS
+    // Walks every slot, see CeTuHashMapStats
+    CeTuHashMapStats stats() const;
+#endif
+
+private:
+    using ctrl_t = CeTuDetail::ctrl_t;
+    using Group = CeTuDetail::Group;
+
+    static constexpr ctrl_t kEmpty = CeTuDetail::kEmpty;
+    static constexpr ctrl_t kDeleted = CeTuDetail::kDeleted;
+
+    static bool isFull(ctrl_t c) { return c >= 0; }
+
+    static constexpr bool storeHash = CeTuStoreHash<K>::value;
+
+    // Key and value stored inline in the slot array
+    struct Slot {
+        K key;
+        V value;
+        [[no_unique_address]] CeTuDetail::StoredHash<storeHash> storedHash;
+
+        // The value is constructed in place from args
+        template<typename KeyType, typename... Args>
+        Slot(KeyType&& k, Args&&... args) : key(std::forward<KeyType>(k)), value(std::forward<Args>(args)...) {}
+    };
+
+    // RAII wrapper for the control bytes and the slot array.
+    // The first Group::kWidth control bytes are mirrored after the last one, so a group
+    // can be loaded at any slot index without wrapping around.
+    class SlotsHolder {
+    public:
+        SlotsHolder() : capacity(0), ctrl(nullptr), slots(nullptr) {}
+        explicit SlotsHolder(size_t _capacity);
+        ~SlotsHolder() { clear(); }
+
+        // Disable copying
+        SlotsHolder(const SlotsHolder&) = delete;
+        SlotsHolder& operator=(const SlotsHolder&) = delete;
+
+        // Enable moving
+        SlotsHolder(SlotsHolder&& other) noexcept;
+        SlotsHolder& operator=(SlotsHolder&& other) noexcept;
+
+        ctrl_t* control() { return ctrl; }
+        const ctrl_t* control() const { return ctrl; }
+        Slot* get() { return slots; }
+        const Slot* get() const { return slots; }
+
+        void setCtrl(size_t index, ctrl_t value);
+        // Destroys every entry and marks all slots empty, keeping both arrays
+        void destroyAll() noexcept;
+
+    private:
+        size_t capacity;
+        ctrl_t* ctrl;
+        Slot* slots;
+
+        void clear();
+    };
+
+    template<bool Const>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = std::pair<const K, V>;
+        using reference = std::pair<const K&, std::conditional_t<Const, const V&, V&>>;
+        // Keeps the pair of references alive for operator->
+        struct pointer {
+            reference ref;
+            const reference* operator->() const { return &ref; }
+        };
+
+        Iterator() = default;
+        // iterator converts to const_iterator
+        template<bool OtherConst>
+        requires (Const && !OtherConst)
+        Iterator(const Iterator<OtherConst>& other) : slots(other.slots), ctrl(other.ctrl), index(other.index), capacity(other.capacity) {}
+
+        reference operator*() const { return {slots[index].key, slots[index].value}; }
+        pointer operator->() const { return pointer{**this}; }
+        Iterator& operator++() { ++index; settle(); return *this; }
+        Iterator operator++(int) { Iterator old = *this; ++*this; return old; }
+        bool operator==(const Iterator& other) const { return index == other.index; }
+
+    private:
+        friend class CeTuFlatHashMap;
+        template<bool> friend class Iterator;
+
+        Slot* slots = nullptr;
+        const ctrl_t* ctrl = nullptr;
+        size_t index = 0;
+        size_t capacity = 0;
+
+        Iterator(Slot* _slots, const ctrl_t* _ctrl, size_t _index, size_t _capacity) :
+            slots(_slots), ctrl(_ctrl), index(_index), capacity(_capacity) {
+            settle();
+        }
+
+        // Skips to the next full slot, or to capacity
+        void settle() {
+            while(index < capacity && !isFull(ctrl[index])) {
+                ++index;
+            }
+        }
+    };
+
+    SlotsHolder slots;
+    size_t currentSize;
+    size_t deletedCount;
+    size_t capacity;
+    float maxLoadFactor;
+    CeTuDetail::SeededHash<Hash> hasher;
+    [[no_unique_address]] KeyEqual keyEqual;
+#ifdef CETU_HASHMAP_STATS
+    CeTuDetail::RehashCounters rehashCounters;
+#endif
+
+    static constexpr size_t defaultSize = Group::kWidth > 16 ? Group::kWidth : 16;
+    static constexpr float defaultMaxLoadFactor = 0.875f;
+    // Keys hashed and prefetched ahead by the batched operations
+    static constexpr size_t batchChunk = 32;
+
+    template<typename Q>
+    size_t hash(const Q& key) const { return CeTuDetail::hashKey(hasher, key); }
+    // Reuses the stored hash if there is one
+    size_t slotHash(const Slot& slot) const {
+        if constexpr (storeHash) {
+            return slot.storedHash.value;
+        } else {
+            return hash(slot.key);
+        }
+    }
+    static size_t h1(size_t hash) { return hash >> 7; }
+    static ctrl_t h2(size_t hash) { return static_cast<ctrl_t>(hash & 0x7F); }
+
+    // Returns the slot index holding key, or capacity if there is none
+    template<typename Q>
+    size_t findIndex(const Q& key, size_t hash) const;
+    template<typename KeyType, typename... Args>
+    std::pair<V*, bool> tryEmplaceImpl(KeyType&& key, Args&&... args) {
+        size_t keyHash = hash(key);
+        return tryEmplaceHashed(keyHash, std::forward<KeyType>(key), std::forward<Args>(args)...);
+    }
+    template<typename KeyType, typename... Args>
+    std::pair<V*, bool> tryEmplaceHashed(size_t keyHash, KeyType&& key, Args&&... args);
+    template<typename Q>
+    V* findImpl(const Q& key) const { return findImpl(key, hash(key)); }
+    template<typename Q>
+    V* findImpl(const Q& key, size_t keyHash) const;
+    template<typename Q>
+    std::optional<V> lookupImpl(const Q& key) const;
+    template<typename Q>
+    void eraseImpl(const Q& key) { eraseImpl(key, hash(key)); }
+    template<typename Q>
+    void eraseImpl(const Q& key, size_t keyHash);
+    void eraseIndex(size_t index);
+    // Hashes up to batchChunk keys from start into hashes and prefetches their first
+    // probed group; returns how many keys were taken
+    size_t prepareBatch(std::span<const K> keys, size_t start, size_t* hashes) const;
+    template<typename Result>
+    void lookupBatchImpl(std::span<const K> keys, std::span<Result> results) const;
+    // Suspends once on the first probed group, which almost always decides the lookup
+    template<typename Result>
+    // key is taken by value: the coroutine starts lazily and would outlive a referenced
+    // temporary
+    CeTuLookupTask<Result> lookupAsyncImpl(K key) const;
+    // Returns the first empty or deleted slot on the probe sequence of hash
+    static size_t findInsertIndex(const ctrl_t* ctrl, size_t capacity, size_t hash);
+    void rehash();
+    void resize(size_t newCapacity);
+    void copy(const CeTuFlatHashMap& other);
+};
+
+// Constructor
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>::CeTuFlatHashMap() : slots(defaultSize), currentSize(0), deletedCount(0), capacity(defaultSize),
+    maxLoadFactor(defaultMaxLoadFactor) {}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>::CeTuFlatHashMap(size_t expectedSize) :
+    slots(CeTuDetail::capacityFor(expectedSize, defaultMaxLoadFactor, defaultSize)), currentSize(0), deletedCount(0),
+    capacity(CeTuDetail::capacityFor(expectedSize, defaultMaxLoadFactor, defaultSize)), maxLoadFactor(defaultMaxLoadFactor) {}
+
+// Destructor
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>::~CeTuFlatHashMap() noexcept {
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::clear() noexcept {
+    slots.destroyAll();
+    currentSize = 0;
+    deletedCount = 0;
+}
+
+// Copy constructor
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>::CeTuFlatHashMap(const CeTuFlatHashMap& other) requires CopyAssignableAndConstructible<K, V> :
+    currentSize(other.currentSize), deletedCount(other.deletedCount), capacity(other.capacity),
+    maxLoadFactor(other.maxLoadFactor), hasher(other.hasher),
+    keyEqual(other.keyEqual) {
+    copy(other);
+}
+
+// Copy assignment operator
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>& CeTuFlatHashMap<K, V, Hash, KeyEqual>::operator=(const CeTuFlatHashMap& other) requires CopyAssignableAndConstructible<K, V> {
+    if(this == &other) {
+        return *this;
+    }
+
+    // Copy first, so that a failure leaves this map as it was
+    CeTuFlatHashMap copied(other);
+    *this = std::move(copied);
+
+    return *this;
+}
+
+// Move constructor
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>::CeTuFlatHashMap(CeTuFlatHashMap&& other) noexcept : slots(std::move(other.slots)),
+    currentSize(other.currentSize), deletedCount(other.deletedCount), capacity(other.capacity),
+    maxLoadFactor(other.maxLoadFactor), hasher(std::move(other.hasher)), keyEqual(std::move(other.keyEqual)) {
+    other.currentSize = 0;
+    other.deletedCount = 0;
+    other.capacity = 0;
+}
+
+// Move assignment operator
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>& CeTuFlatHashMap<K, V, Hash, KeyEqual>::operator=(CeTuFlatHashMap&& other) noexcept {
+    if(this == &other) {
+        return *this;
+    }
+
+    std::swap(slots, other.slots);
+    std::swap(currentSize, other.currentSize);
+    std::swap(deletedCount, other.deletedCount);
+    std::swap(capacity, other.capacity);
+    std::swap(maxLoadFactor, other.maxLoadFactor);
+    std::swap(hasher, other.hasher);
+    std::swap(keyEqual, other.keyEqual);
+
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual> CeTuFlatHashMap<K, V, Hash, KeyEqual>::deserialize(std::istream& in)
+    requires CeTuSerializable<K> && CeTuSerializable<V> {
+    CeTuFlatHashMap map;
+    CeTuDetail::deserializeMap<K, V>(map, in);
+    return map;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::insert(K key, V value) {
+    auto [current, inserted] = tryEmplaceImpl(std::move(key), std::move(value));
+    if(!inserted) {
+        *current = std::move(value);  // Update existing value
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename KeyType, typename... Args>
+std::pair<V*, bool> CeTuFlatHashMap<K, V, Hash, KeyEqual>::tryEmplaceHashed(size_t keyHash, KeyType&& key, Args&&... args) {
+    if(capacity == 0 || currentSize + deletedCount >= capacity * maxLoadFactor) {
+        rehash();
+    }
+
+    // Check if key already exists
+    size_t index = findIndex(key, keyHash);
+    if(index != capacity) {
+        return {&slots.get()[index].value, false};
+    }
+
+    // Construct the slot in place, then publish it in the control bytes
+    index = findInsertIndex(slots.control(), capacity, keyHash);
+    std::construct_at(slots.get() + index, std::forward<KeyType>(key), std::forward<Args>(args)...);
+    slots.get()[index].storedHash.set(keyHash);
+    if(slots.control()[index] == kDeleted) {
+        deletedCount--;
+    }
+    slots.setCtrl(index, h2(keyHash));
+    currentSize++;
+
+    return {&slots.get()[index].value, true};
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+std::optional<V> CeTuFlatHashMap<K, V, Hash, KeyEqual>::lookup(const K& key) const {
+    return lookupImpl(key);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::erase(const K& key) {
+    eraseImpl(key);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename KeyArg, typename... Args>
+std::pair<V*, bool> CeTuFlatHashMap<K, V, Hash, KeyEqual>::emplace(KeyArg&& keyArg, Args&&... args) {
+    return tryEmplaceImpl(K(std::forward<KeyArg>(keyArg)), std::forward<Args>(args)...);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename M>
+std::pair<V*, bool> CeTuFlatHashMap<K, V, Hash, KeyEqual>::insert_or_assign(const K& key, M&& value) {
+    auto result = tryEmplaceImpl(key, std::forward<M>(value));
+    if(!result.second) {
+        *result.first = std::forward<M>(value);
+    }
+    return result;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename M>
+std::pair<V*, bool> CeTuFlatHashMap<K, V, Hash, KeyEqual>::insert_or_assign(K&& key, M&& value) {
+    auto result = tryEmplaceImpl(std::move(key), std::forward<M>(value));
+    if(!result.second) {
+        *result.first = std::forward<M>(value);
+    }
+    return result;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+V* CeTuFlatHashMap<K, V, Hash, KeyEqual>::findImpl(const Q& key, size_t keyHash) const {
+    if(currentSize == 0) {
+        return nullptr;
+    }
+
+    size_t index = findIndex(key, keyHash);
+    if(index == capacity) {
+        return nullptr;
+    }
+
+    // Shared by both find() overloads; the const one hands the pointer out as const V*
+    return const_cast<V*>(&slots.get()[index].value);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+std::optional<V> CeTuFlatHashMap<K, V, Hash, KeyEqual>::lookupImpl(const Q& key) const {
+    if(const V* value = findImpl(key)) {
+        return std::make_optional(*value);
+    }
+
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::eraseImpl(const Q& key, size_t keyHash) {
+    if(currentSize == 0) {
+        return;
+    }
+
+    size_t index = findIndex(key, keyHash);
+    if(index != capacity) {
+        eraseIndex(index);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::lookup_batch(std::span<const K> keys, std::span<V*> results) {
+    lookupBatchImpl(keys, results);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::lookup_batch(std::span<const K> keys, std::span<const V*> results) const {
+    lookupBatchImpl(keys, results);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::insert_batch(std::span<const K> keys, std::span<const V> values) requires CopyAssignableAndConstructible<K, V> {
+    if(keys.size() != values.size()) {
+        throw std::invalid_argument("CeTuFlatHashMap: insert_batch needs as many values as keys");
+    }
+
+    // Grow once up front so that the prefetched slots stay put
+    reserve(currentSize + keys.size());
+    size_t hashes[batchChunk];
+    for(size_t start = 0; start < keys.size(); start += batchChunk) {
+        size_t count = prepareBatch(keys, start, hashes);
+        for(size_t i = 0; i < count; ++i) {
+            auto [current, inserted] = tryEmplaceHashed(hashes[i], keys[start + i], values[start + i]);
+            if(!inserted) {
+                *current = values[start + i];
+            }
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::erase_batch(std::span<const K> keys) {
+    size_t hashes[batchChunk];
+    for(size_t start = 0; start < keys.size(); start += batchChunk) {
+        size_t count = prepareBatch(keys, start, hashes);
+        for(size_t i = 0; i < count; ++i) {
+            eraseImpl(keys[start + i], hashes[i]);
+        }
+    }
+}
+
+#ifdef CETU_HASHMAP_STATS
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMapStats CeTuFlatHashMap<K, V, Hash, KeyEqual>::stats() const {
+    CeTuHashMapStats result;
+    result.size = currentSize;
+    result.bucketCount = capacity;
+    result.loadFactor = load_factor();
+    // Groups are probed linearly from the one at h1, see findIndex
+    const ctrl_t* ctrl = slots.control();
+    const size_t mask = capacity - 1;
+    for(size_t i = 0; i < capacity; ++i) {
+        if(isFull(ctrl[i])) {
+            size_t distance = (i - (h1(slotHash(slots.get()[i])) & mask)) & mask;
+            CeTuDetail::addProbe(result, distance / Group::kWidth + 1);
+            result.maxDisplacement = std::max(result.maxDisplacement, distance);
+        }
+    }
+    result.rehashCount = rehashCounters.count;
+    result.rehashTime = rehashCounters.time;
+    result.bucketBytes = capacity == 0 ? 0 : capacity + Group::kWidth;
+    result.entryBytes = capacity * sizeof(Slot);
+    result.tombstones = deletedCount;
+    return result;
+}
+#endif
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::for_each(F&& visitor) const {
+    const ctrl_t* ctrl = slots.control();
+    for(size_t i = 0; i < capacity; ++i) {
+        if(isFull(ctrl[i])) {
+            const Slot& slot = slots.get()[i];
+            visitor(slot.key, slot.value);
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Result>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::lookupBatchImpl(std::span<const K> keys, std::span<Result> results) const {
+    if(keys.size() != results.size()) {
+        throw std::invalid_argument("CeTuFlatHashMap: lookup_batch needs as many results as keys");
+    }
+
+    size_t hashes[batchChunk];
+    for(size_t start = 0; start < keys.size(); start += batchChunk) {
+        size_t count = prepareBatch(keys, start, hashes);
+        for(size_t i = 0; i < count; ++i) {
+            results[start + i] = findImpl(keys[start + i], hashes[i]);
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Result>
+CeTuLookupTask<Result> CeTuFlatHashMap<K, V, Hash, KeyEqual>::lookupAsyncImpl(K key) const {
+    if(currentSize == 0) {
+        co_return nullptr;
+    }
+
+    size_t keyHash = hash(key);
+    size_t pos = h1(keyHash) & (capacity - 1);
+    CeTuDetail::prefetch(slots.control() + pos);
+    co_await CeTuDetail::PrefetchAwaiter{slots.get() + pos};
+    co_return findImpl(key, keyHash);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+size_t CeTuFlatHashMap<K, V, Hash, KeyEqual>::prepareBatch(std::span<const K> keys, size_t start, size_t* hashes) const {
+    size_t count = std::min(batchChunk, keys.size() - start);
+    for(size_t i = 0; i < count; ++i) {
+        hashes[i] = hash(keys[start + i]);
+        if(capacity != 0) {
+            size_t pos = h1(hashes[i]) & (capacity - 1);
+            CeTuDetail::prefetch(slots.control() + pos);
+            CeTuDetail::prefetch(slots.get() + pos);
+        }
+    }
+    return count;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::eraseIndex(size_t index) {
+    std::destroy_at(slots.get() + index);
+    currentSize--;
+
+    // Probing stops at the first group containing an empty slot. If every group that
+    // covers this slot also covers an empty one, no probe ever continued past it and
+    // the slot may become empty instead of a tombstone.
+    const ctrl_t* ctrl = slots.control();
+    auto emptyBefore = Group(ctrl + ((index - Group::kWidth) & (capacity - 1))).maskEmpty();
+    auto emptyAfter = Group(ctrl + index).maskEmpty();
+    if(emptyBefore && emptyAfter &&
+       static_cast<size_t>(emptyBefore.leadingZeros() + emptyAfter.trailingZeros()) < Group::kWidth) {
+        slots.setCtrl(index, kEmpty);
+    } else {
+        slots.setCtrl(index, kDeleted);
+        deletedCount++;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+size_t CeTuFlatHashMap<K, V, Hash, KeyEqual>::findIndex(const Q& key, size_t hash) const {
+    const ctrl_t* ctrl = slots.control();
+    const ctrl_t fragment = h2(hash);
+    const size_t mask = capacity - 1;
+
+    // Groups are probed linearly; stop at the first one that contains an empty slot
+    size_t pos = h1(hash) & mask;
+    for(size_t probed = 0; probed < capacity; probed += Group::kWidth) {
+        Group group(ctrl + pos);
+        for(int i : group.match(fragment)) {
+            size_t index = (pos + i) & mask;
+            const Slot& slot = slots.get()[index];
+            if(slot.storedHash.mayMatch(hash) && keyEqual(slot.key, key)) {
+                return index;
+            }
+        }
+        if(group.maskEmpty()) {
+            break;
+        }
+        pos = (pos + Group::kWidth) & mask;
+    }
+
+    return capacity;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+size_t CeTuFlatHashMap<K, V, Hash, KeyEqual>::findInsertIndex(const ctrl_t* ctrl, size_t capacity, size_t hash) {
+    const size_t mask = capacity - 1;
+
+    // The load factor guarantees that a free slot exists
+    size_t pos = h1(hash) & mask;
+    while(true) {
+        auto free = Group(ctrl + pos).maskEmptyOrDeleted();
+        if(free) {
+            return (pos + free.lowest()) & mask;
+        }
+        pos = (pos + Group::kWidth) & mask;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::max_load_factor(float value) {
+    if(!(value > 0.0f && value <= 1.0f)) {
+        throw std::invalid_argument("CeTuFlatHashMap: max_load_factor must be in (0, 1]");
+    }
+
+    maxLoadFactor = value;
+    reserve(currentSize);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::reserve(size_t n) {
+    size_t newCapacity = CeTuDetail::capacityFor(n, maxLoadFactor, defaultSize);
+    if(newCapacity > capacity) {
+        resize(newCapacity);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::rehash(size_t bucketCount) {
+    size_t newCapacity = std::max(std::bit_ceil(bucketCount), CeTuDetail::capacityFor(currentSize, maxLoadFactor, defaultSize));
+    if(newCapacity != capacity || deletedCount != 0) {
+        resize(newCapacity);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::rehash() {
+    // Tombstones also count against the load factor; if they make up a large part
+    // of it, rebuilding at the same capacity is enough to reclaim them.
+    size_t newCapacity = capacity == 0 ? defaultSize : capacity;
+    if(currentSize >= newCapacity * maxLoadFactor / 2) {
+        newCapacity *= 2;
+    }
+    resize(newCapacity);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::resize(size_t newCapacity) {
+    CETU_HASHMAP_REHASH_TIMER(rehashCounters, true);
+    // The new array is only swapped in once it is complete, and the old slots are destroyed
+    // with it afterwards. Entries are copied when moving them could throw, so that a failure
+    // leaves the map as it was.
+    constexpr bool moveEntries = !(std::is_copy_constructible_v<K> && std::is_copy_constructible_v<V>) ||
+        (std::is_nothrow_move_constructible_v<K> && std::is_nothrow_move_constructible_v<V>);
+    SlotsHolder newSlots(newCapacity);
+    const ctrl_t* ctrl = slots.control();
+
+    for(size_t i = 0; i < capacity; ++i) {
+        if(!isFull(ctrl[i])) {
+            continue;
+        }
+
+        Slot& slot = slots.get()[i];
+        size_t keyHash = slotHash(slot);
+        size_t newIndex = findInsertIndex(newSlots.control(), newCapacity, keyHash);
+
+        if constexpr (moveEntries) {
+            std::construct_at(newSlots.get() + newIndex, std::move(slot.key), std::move(slot.value));
+        } else {
+            std::construct_at(newSlots.get() + newIndex, std::as_const(slot.key), std::as_const(slot.value));
+        }
+        newSlots.get()[newIndex].storedHash = slot.storedHash;
+        // Publish the control byte only once the slot is constructed
+        newSlots.setCtrl(newIndex, h2(keyHash));
+    }
+
+    std::swap(slots, newSlots);
+    capacity = newCapacity;
+    deletedCount = 0;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::copy(const CeTuFlatHashMap& other) {
+    SlotsHolder tempSlots(capacity);
+    const ctrl_t* otherCtrl = other.slots.control();
+    for(size_t i = 0; i < capacity; i++) {
+        if(isFull(otherCtrl[i])) {
+            const Slot& otherSlot = other.slots.get()[i];
+            std::construct_at(tempSlots.get() + i, otherSlot.key, otherSlot.value);
+            tempSlots.get()[i].storedHash = otherSlot.storedHash;
+        }
+        // Publish the control byte only once the slot is constructed
+        tempSlots.setCtrl(i, otherCtrl[i]);
+    }
+    slots = std::move(tempSlots);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>::SlotsHolder::SlotsHolder(size_t _capacity) :
+    capacity(_capacity), ctrl(new ctrl_t[capacity + Group::kWidth]), slots(nullptr)
+{
+    std::memset(ctrl, kEmpty, capacity + Group::kWidth);
+    try {
+        slots = std::allocator<Slot>().allocate(capacity);
+    } catch(...) {
+        delete[] ctrl;
+        throw;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>::SlotsHolder::SlotsHolder(SlotsHolder&& other) noexcept :
+    capacity(other.capacity), ctrl(other.ctrl), slots(other.slots)
+{
+    other.capacity = 0;
+    other.ctrl = nullptr;
+    other.slots = nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuFlatHashMap<K, V, Hash, KeyEqual>::SlotsHolder& CeTuFlatHashMap<K, V, Hash, KeyEqual>::SlotsHolder::operator=(SlotsHolder&& other) noexcept {
+    if(this == &other) {
+        return *this;
+    }
+
+    std::swap(capacity, other.capacity);
+    std::swap(ctrl, other.ctrl);
+    std::swap(slots, other.slots);
+
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::SlotsHolder::setCtrl(size_t index, ctrl_t value) {
+    ctrl[index] = value;
+    if(index < Group::kWidth) {
+        ctrl[capacity + index] = value;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::SlotsHolder::destroyAll() noexcept {
+    if(!ctrl) {
+        return;
+    }
+    // Trivially destructible slots only need their control bytes reset
+    if constexpr (!std::is_trivially_destructible_v<Slot>) {
+        for(size_t i = 0; i < capacity; ++i) {
+            if(isFull(ctrl[i])) {
+                std::destroy_at(slots + i);
+            }
+        }
+    }
+    std::memset(ctrl, kEmpty, capacity + Group::kWidth);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuFlatHashMap<K, V, Hash, KeyEqual>::SlotsHolder::clear() {
+    if(ctrl) {
+        destroyAll();
+        std::allocator<Slot>().deallocate(slots, capacity);
+        delete[] ctrl;
+        ctrl = nullptr;
+        slots = nullptr;
+    }
+}
+
+#endif // CETU_FLAT_HASHMAP_H
@@ -0,0 +1,151 @@
+#ifndef CETU_GROUP_H
+#define CETU_GROUP_H
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+// The group implementation is picked at compile time: AVX2 (32 slots), SSE2 (16 slots),
+// NEON (16 slots) or a portable 8-slot SWAR fallback. Define CETU_HASHMAP_NO_SIMD to force
+// the portable version.
+#if !defined(CETU_HASHMAP_NO_SIMD) && defined(__AVX2__)
+#define CETU_GROUP_AVX2
+#include <immintrin.h>
+#elif !defined(CETU_HASHMAP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CETU_GROUP_SSE2
+#include <emmintrin.h>
+#elif !defined(CETU_HASHMAP_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define CETU_GROUP_NEON
+#include <arm_neon.h>
+#endif
+
+namespace CeTuDetail {
+
+using ctrl_t = int8_t;
+
+// Control byte values. Full slots hold the 7-bit hash fragment (0..127).
+inline constexpr ctrl_t kEmpty = -128;
+inline constexpr ctrl_t kDeleted = -2;
+
+// Set of matching slots within a group. Every slot is represented by 2^Shift bits of
+// which at most one is set.
+template<typename T, int Width, int Shift>
+class BitMask {
+public:
+    explicit BitMask(T _mask) : mask(_mask) {}
+
+    explicit operator bool() const { return mask != 0; }
+
+    // Index of the lowest matching slot
+    int lowest() const { return std::countr_zero(mask) >> Shift; }
+    // Number of leading slots (from the end of the group) that do not match
+    int leadingZeros() const {
+        constexpr int extraBits = sizeof(T) * 8 - (Width << Shift);
+        return (std::countl_zero(static_cast<T>(mask << extraBits))) >> Shift;
+    }
+    // Number of trailing slots (from the start of the group) that do not match
+    int trailingZeros() const { return std::countr_zero(mask) >> Shift; }
+
+    // Range-for over the matching slot indices
+    BitMask begin() const { return *this; }
+    BitMask end() const { return BitMask(0); }
+    int operator*() const { return lowest(); }
+    BitMask& operator++() { mask &= mask - 1; return *this; }
+    bool operator!=(const BitMask& other) const { return mask != other.mask; }
+
+private:
+    T mask;
+};
+
+#if defined(CETU_GROUP_AVX2)
+
+struct Group {
+    static constexpr size_t kWidth = 32;
+    using Mask = BitMask<uint32_t, kWidth, 0>;
+
+    explicit Group(const ctrl_t* pos) : ctrl(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos))) {}
+
+    Mask match(ctrl_t h2) const {
+        return Mask(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(h2), ctrl))));
+    }
+    Mask maskEmpty() const { return match(kEmpty); }
+    // Full slots are non-negative, so the sign bits mark empty and deleted ones
+    Mask maskEmptyOrDeleted() const { return Mask(static_cast<uint32_t>(_mm256_movemask_epi8(ctrl))); }
+
+    __m256i ctrl;
+};
+
+#elif defined(CETU_GROUP_SSE2)
+
+struct Group {
+    static constexpr size_t kWidth = 16;
+    using Mask = BitMask<uint32_t, kWidth, 0>;
+
+    explicit Group(const ctrl_t* pos) : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+    Mask match(ctrl_t h2) const {
+        return Mask(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl))));
+    }
+    Mask maskEmpty() const { return match(kEmpty); }
+    // Full slots are non-negative, so the sign bits mark empty and deleted ones
+    Mask maskEmptyOrDeleted() const { return Mask(static_cast<uint32_t>(_mm_movemask_epi8(ctrl))); }
+
+    __m128i ctrl;
+};
+
+#elif defined(CETU_GROUP_NEON)
+
+struct Group {
+    static constexpr size_t kWidth = 16;
+    // vshrn packs every compared byte into a nibble; keep one bit per nibble
+    using Mask = BitMask<uint64_t, kWidth, 2>;
+
+    explicit Group(const ctrl_t* pos) : ctrl(vld1q_s8(pos)) {}
+
+    Mask match(ctrl_t h2) const { return toMask(vceqq_s8(vdupq_n_s8(h2), ctrl)); }
+    Mask maskEmpty() const { return match(kEmpty); }
+    // vcltzq_s8 is AArch64 only; comparing against zero also builds for 32-bit ARM
+    Mask maskEmptyOrDeleted() const { return toMask(vcltq_s8(ctrl, vdupq_n_s8(0))); }
+
+    static Mask toMask(uint8x16_t bytes) {
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(bytes), 4);
+        return Mask(vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ULL);
+    }
+
+    int8x16_t ctrl;
+};
+
+#else
+
+// Portable SWAR version: one 64-bit word holds 8 control bytes
+struct Group {
+    static constexpr size_t kWidth = 8;
+    using Mask = BitMask<uint64_t, kWidth, 3>;
+
+    static constexpr uint64_t kLsbs = 0x0101010101010101ULL;
+    static constexpr uint64_t kMsbs = 0x8080808080808080ULL;
+
+    explicit Group(const ctrl_t* pos) {
+        std::memcpy(&ctrl, pos, sizeof(ctrl));
+        if constexpr (std::endian::native == std::endian::big) {
+            ctrl = __builtin_bswap64(ctrl);
+        }
+    }
+
+    // May report false positives, which are harmless since keys are compared afterwards
+    Mask match(ctrl_t h2) const {
+        uint64_t x = ctrl ^ (kLsbs * static_cast<uint8_t>(h2));
+        return Mask((x - kLsbs) & ~x & kMsbs);
+    }
+    // kEmpty is the only control value with the high bit set and bit 1 clear
+    Mask maskEmpty() const { return Mask(ctrl & ~(ctrl << 6) & kMsbs); }
+    Mask maskEmptyOrDeleted() const { return Mask(ctrl & kMsbs); }
+
+    uint64_t ctrl;
+};
+
+#endif
+
+} // namespace CeTuDetail
+
+#endif // CETU_GROUP_H
@@ -1,80 +1,353 @@
 #ifndef CETU_HASHMAP_H
 #define CETU_HASHMAP_H
 
+#include "CeTuHashMapCommon.h"
+#include "CeTuCoroutine.h"
+#include "CeTuParallel.h"
+#include "CeTuSerialization.h"
+
 #include <optional>
-#include <concepts>
 #include <iostream>
+#include <memory>
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <new>
+#include <ranges>
+#include <set>
+#include <span>
+#include <stdexcept>
 
-template <typename K>
-concept Hashable = requires {
-    std::hash<K>{};
-};
+// Default thread hook of CeTuHashMap::build_from, which does nothing
+struct CeTuNoThreadInit {
+    struct Scope {};
 
-template <typename K>
-concept EqualityComparable = requires(K a, K b) {
-    { a == b } -> std::convertible_to<bool>;
+    Scope operator()(size_t) const noexcept { return {}; }
 };
 
-template <typename K, typename V>
-concept CopyAssignableAndConstructible =
-    std::is_copy_constructible_v<K> && std::is_copy_assignable_v<K> &&
-    std::is_copy_constructible_v<V> && std::is_copy_assignable_v<V>;
-
-template<typename K, typename V>
-concept HashMapRequirements = Hashable<K> && EqualityComparable<K> && CopyAssignableAndConstructible<K, V>;
-
+// Keys are hashed with Hash (std::hash<K> by default) and, unless it is an AvalanchingHash,
+// passed through CeTuDetail::mix together with a seed of the map's own (see
+// CeTuDetail::SeededHash). The capacity is always a power of two, so the bucket index is
+// the low bits of the mixed hash. Keys are compared with KeyEqual; lookup and erase also
+// accept any TransparentKey.
+// A chain never grows past maxChainLength nodes: further nodes go to an overflow tree shared
+// by all buckets, ordered by hash and, for totally ordered keys compared with std::equal_to,
+// by key. Keys whose Hash values collide thus still cost O(log n) rather than O(n).
+// Nodes are carved from slabs obtained through Allocator (see NodePool); erased nodes are
+// recycled, and all slabs are released at once when the map is destroyed.
+// When CeTuStoreHash<K> is set, every node also keeps its hash.
 // Attention: CeTuHashMap is not thread-safe.
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>,
+         typename Allocator = std::allocator<std::pair<const K, V>>>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
 class CeTuHashMap final {
+    template<bool Const>
+    class Iterator;
+
 public:
     CeTuHashMap();
+    explicit CeTuHashMap(const Allocator& allocator);
+    // Reserves room for expectedSize entries up front
+    explicit CeTuHashMap(size_t expectedSize, const Allocator& allocator = Allocator());
     ~CeTuHashMap() noexcept;
 
-    CeTuHashMap(const CeTuHashMap& other);
-    CeTuHashMap& operator=(const CeTuHashMap& other);
+    CeTuHashMap(const CeTuHashMap& other) requires CopyAssignableAndConstructible<K, V>;
+    CeTuHashMap& operator=(const CeTuHashMap& other) requires CopyAssignableAndConstructible<K, V>;
 
     CeTuHashMap(CeTuHashMap&& other) noexcept;
     CeTuHashMap& operator=(CeTuHashMap&& other) noexcept;
 
+    // Empty map with the allocator, seed, Hash and KeyEqual of other, so that merging it
+    // into other reuses its stored hashes
+    static CeTuHashMap empty_like(const CeTuHashMap& other);
+
+    // Builds a map from a random access range of key/value pairs on up to threads threads:
+    // the entries are partitioned by bucket range and every thread links its own range.
+    // Later duplicates overwrite earlier ones, as with insert. allocator is used from all
+    // threads at once. The thread linking range t zeroes its buckets right before and
+    // allocates their nodes, so with first-touch page placement both end up on the node it
+    // runs on. It first calls threadInit(t) and keeps the result until the range is linked,
+    // e.g. CeTuNumaSpread to pin it to a node; one range runs on the calling thread.
+    template<std::ranges::random_access_range Range, typename ThreadInit = CeTuNoThreadInit>
+    static CeTuHashMap build_from(const Range& entries, size_t threads, const Allocator& allocator = Allocator(),
+        ThreadInit threadInit = ThreadInit()) requires CopyAssignableAndConstructible<K, V>;
+
     void insert(K key, V value);
-    std::optional<V> lookup(K key);
-    void erase(K key);
+    std::optional<V> lookup(const K& key) const;
+    void erase(const K& key);
     size_t size() const { return currentSize; }
+    bool empty() const { return currentSize == 0; }
+    // Erases every entry but keeps the buckets; the nodes go back to the pool for reuse
+    void clear() noexcept;
+    Allocator get_allocator() const { return Allocator(pool.get_allocator()); }
+
+    // The bucket count is always a power of two
+    size_t bucket_count() const { return capacity; }
+    float load_factor() const { return capacity == 0 ? 0.0f : static_cast<float>(currentSize) / capacity; }
+    float max_load_factor() const { return maxLoadFactor; }
+    // Grows the buckets right away if size() already exceeds the new limit
+    void max_load_factor(float value);
+    // Makes room for n entries without any further rehash
+    void reserve(size_t n);
+    // Sets the bucket count to at least bucketCount and enough for size(); may shrink
+    void rehash(size_t bucketCount);
+    // Shrinks the buckets to fit size() and compacts the nodes into fresh slabs
+    void shrink_to_fit();
+
+    // Opt-in incremental rehashing: growth keeps the old buckets next to the new ones and
+    // every insert or erase migrates a few of them, so no single operation relinks all
+    // nodes. Disabling it finishes a pending migration.
+    void set_incremental_rehash(bool enabled);
+    bool incremental_rehash() const { return incrementalRehash; }
+    // True while old buckets are still being migrated
+    bool rehashing() const { return oldBuckets.count() != 0; }
+
+    // Threads used to relink large bucket arrays on growth, rehash(n) and shrink_to_fit
+    void set_rehash_threads(size_t threads) { rehashThreads = std::max<size_t>(threads, 1); }
+    size_t rehash_threads() const { return rehashThreads; }
+
+    // Constructs V from args only if key is absent. Returns the stored value and whether
+    // it was inserted.
+    template<typename... Args>
+    std::pair<V*, bool> try_emplace(const K& key, Args&&... args) { return tryEmplaceImpl(key, std::forward<Args>(args)...); }
+    template<typename... Args>
+    std::pair<V*, bool> try_emplace(K&& key, Args&&... args) { return tryEmplaceImpl(std::move(key), std::forward<Args>(args)...); }
+
+    // Like try_emplace, but builds the key from keyArg first
+    template<typename KeyArg, typename... Args>
+    std::pair<V*, bool> emplace(KeyArg&& keyArg, Args&&... args);
+
+    // Inserts value or assigns it over the existing one
+    template<typename M>
+    std::pair<V*, bool> insert_or_assign(const K& key, M&& value);
+    template<typename M>
+    std::pair<V*, bool> insert_or_assign(K&& key, M&& value);
+
+    // Read-modify-write with a single probe: stores value if key is absent, and otherwise
+    // replaces the stored value with combine(std::move(stored), std::move(value)). Returns
+    // the stored value and whether key was inserted.
+    template<typename F>
+    std::pair<V*, bool> upsert(K key, V value, F&& combine);
+
+    // Entry taken out of a map by extract. Nodes live in the slabs of their map, so unlike
+    // a C++17 node handle it carries the key and value themselves: extract moves them out
+    // and recycles the node, and insert(node_type&&) moves them into a node of the target,
+    // normally one from its free list.
+    class node_type {
+    public:
+        node_type() = default;
+
+        bool empty() const { return !entry.has_value(); }
+        explicit operator bool() const { return entry.has_value(); }
+        K& key() { return entry->first; }
+        const K& key() const { return entry->first; }
+        V& mapped() { return entry->second; }
+        const V& mapped() const { return entry->second; }
+
+    private:
+        friend class CeTuHashMap;
+
+        std::optional<std::pair<K, V>> entry;
+    };
+
+    struct insert_return_type {
+        V* position;
+        bool inserted;
+        // Handed back if the key was already present
+        node_type node;
+    };
+
+    // Takes the entry of key out of the map; the handle is empty if key is absent
+    node_type extract(const K& key);
+    // Inserts the entry of node unless its key is present; position points to the stored value
+    insert_return_type insert(node_type&& node);
+    // Moves every entry of other whose key is absent here into this map and drops the rest,
+    // leaving other empty. When the allocators compare equal the slabs of other are adopted
+    // and its nodes relinked without any allocation; when other also has the same seed, as
+    // copies of one map do, the stored hashes are reused instead of hashing every key again.
+    void merge(CeTuHashMap&& other) { mergeImpl(std::move(other), [](V&, V&) {}); }
+    // Same, but a key present in both maps keeps combine(std::move(mine), std::move(theirs))
+    template<typename F>
+    void merge(CeTuHashMap&& other, F&& combine) {
+        mergeImpl(std::move(other), [&combine](V& mine, V& theirs) { mine = combine(std::move(mine), std::move(theirs)); });
+    }
+
+    V& operator[](const K& key) requires std::is_default_constructible_v<V> { return *tryEmplaceImpl(key).first; }
+    V& operator[](K&& key) requires std::is_default_constructible_v<V> { return *tryEmplaceImpl(std::move(key)).first; }
+
+    // Pointer to the value stored for key, or nullptr. The pointer stays valid until the
+    // entry is erased or the map is rehashed.
+    V* find(const K& key) { return findImpl(key); }
+    const V* find(const K& key) const { return findImpl(key); }
+    bool contains(const K& key) const { return findImpl(key) != nullptr; }
+
+    // Heterogeneous overloads, see TransparentKey
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    std::optional<V> lookup(const Q& key) const { return lookupImpl(key); }
+
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    V* find(const Q& key) { return findImpl(key); }
+
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    const V* find(const Q& key) const { return findImpl(key); }
+
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    bool contains(const Q& key) const { return findImpl(key) != nullptr; }
+
+    template<typename Q>
+    requires TransparentKey<Q, K, Hash, KeyEqual>
+    void erase(const Q& key) { eraseImpl(key); }
+
+    // Batched operations. Keys are hashed and their buckets, then chain heads, prefetched a
+    // chunk at a time before any of them is resolved, so the cache misses overlap.
+    // results[i] receives find(keys[i]); the spans must have the same size.
+    void lookup_batch(std::span<const K> keys, std::span<V*> results);
+    void lookup_batch(std::span<const K> keys, std::span<const V*> results) const;
+    // Same as insert(keys[i], values[i]) for every i
+    void insert_batch(std::span<const K> keys, std::span<const V> values) requires CopyAssignableAndConstructible<K, V>;
+    void erase_batch(std::span<const K> keys);
+
+    // find(key) as a coroutine that suspends before each access likely to miss the cache,
+    // for interleaving many lookups with CeTuLookupScheduler. The task keeps its own copy of
+    // key; the map must not be modified while it is pending.
+    CeTuLookupTask<V*> lookup_async(K key) { return lookupAsyncImpl<V*>(std::move(key)); }
+    CeTuLookupTask<const V*> lookup_async(K key) const { return lookupAsyncImpl<const V*>(std::move(key)); }
+
+    // Forward iterators over all entries. Dereferencing yields a pair of references to the
+    // key and the value. Any insertion or erase invalidates them.
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(nullptr); }
+    const_iterator begin() const { return const_iterator(this); }
+    const_iterator end() const { return const_iterator(nullptr); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    // Calls visitor(key, value) for every entry, in no particular order. The map must not
+    // be modified meanwhile.
+    template<typename F>
+    void for_each(F&& visitor) const;
+
+    // Writes all entries to out in batches, see CeTuSerializer for the encoding
+    void serialize(std::ostream& out) const requires CeTuSerializable<K> && CeTuSerializable<V> { CeTuDetail::serializeMap<K, V>(*this, out); }
+    // Reads a map written by serialize, one batch at a time
+    static CeTuHashMap deserialize(std::istream& in, const Allocator& allocator = Allocator()) requires CeTuSerializable<K> && CeTuSerializable<V>;
+
+#ifdef CETU_HASHMAP_STATS
+    // Walks every chain, see CeTuHashMapStats
+    CeTuHashMapStats stats() const;
+#endif
 
 private:
+    static constexpr bool storeHash = CeTuStoreHash<K>::value;
+    // Whether the overflow tree can order keys with the same hash by operator<
+    static constexpr bool orderedOverflow = std::totally_ordered<K> && !std::is_floating_point_v<K> &&
+        (std::is_same_v<KeyEqual, std::equal_to<K>> || std::is_same_v<KeyEqual, std::equal_to<>>);
+
+    using Hasher = CeTuDetail::SeededHash<Hash>;
+
     // Node structure for the linked list
     struct Node {
         K key;
         V value;
         Node* next;
+        [[no_unique_address]] CeTuDetail::StoredHash<storeHash> storedHash;
+
+        // The value is constructed in place from args
+        template<typename KeyType, typename... Args>
+        Node(KeyType&& k, Args&&... args) : key(std::forward<KeyType>(k)), value(std::forward<Args>(args)...), next(nullptr) {}
+    };
+
+    // Slab allocator for nodes. Blocks are carved from chunks allocated through Allocator,
+    // erased nodes go to a free list for reuse, and chunks are only returned as a whole.
+    class NodePool {
+    public:
+        explicit NodePool(const Allocator& allocator) : allocator(allocator), freeList(nullptr),
+            chunks(nullptr), nextFree(nullptr), chunkEnd(nullptr), nextChunkBlocks(minChunkBlocks) {}
+        ~NodePool() { release(); }
+
+        // Disable copying
+        NodePool(const NodePool&) = delete;
+        NodePool& operator=(const NodePool&) = delete;
 
-        Node(const K& k, const V& v) : key(k), value(v), next(nullptr) {}
+        // Enable moving
+        NodePool(NodePool&& other) noexcept;
+        NodePool& operator=(NodePool&& other) noexcept;
+
+        template<typename... Args>
+        Node* create(Args&&... args);
+        // Guarantees that the next blocks creations do not allocate
+        void reserve(size_t blocks);
+        // Destroys the node and recycles its block
+        void destroy(Node* node) noexcept;
+        // Frees all chunks; every node must have been destroyed already
+        void release() noexcept;
+        // Takes over all chunks of other, so that its nodes now belong to this pool. Both
+        // allocators must compare equal.
+        void adopt(NodePool& other) noexcept;
+        // Bytes of all chunks, used or not
+        size_t allocatedBytes() const noexcept;
+
+        const auto& get_allocator() const { return allocator; }
+
+    private:
+        // A block holds either a node or, while free, the next free block
+        union Block {
+            Block* next;
+            alignas(Node) unsigned char storage[sizeof(Node)];
+        };
 
-        // This method is enabled only if KeyType and ValueType have move constructors.
-        template<typename KeyType, typename ValueType, typename = std::enable_if_t<std::is_move_constructible_v<K> && std::is_move_constructible_v<V>>>
-        Node(KeyType&& k, ValueType&& v) : key(std::forward<KeyType>(k)), value(std::forward<ValueType>(v)), next(nullptr) {}
+        // Stored in the first block of every chunk
+        struct ChunkHeader {
+            Block* nextChunk;
+            size_t blocks;
+        };
+        static_assert(sizeof(ChunkHeader) <= sizeof(Block));
+
+        using BlockAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Block>;
+        using BlockTraits = std::allocator_traits<BlockAllocator>;
+
+        static constexpr size_t minChunkBlocks = 16;
+        static constexpr size_t maxChunkBlocks = 4096;
+
+        [[no_unique_address]] BlockAllocator allocator;
+        Block* freeList;
+        Block* chunks;
+        // Not yet used part of the newest chunk
+        Block* nextFree;
+        Block* chunkEnd;
+        size_t nextChunkBlocks;
+
+        Block* allocateBlock();
     };
 
     // RAII wrapper for a single node
     class NodeHolder {
     public:
         template<typename... Args>
-        explicit NodeHolder(Args&&... args);
-        ~NodeHolder() { delete node; }
+        explicit NodeHolder(NodePool& _pool, Args&&... args);
+        ~NodeHolder() { if(node) pool.destroy(node); }
 
         Node* release();
         Node* get() { return node; }
 
     private:
+        NodePool& pool;
         Node* node;
     };
 
-    // RAII wrapper for the bucket array
+    // RAII wrapper for the bucket array. The nodes belong to the NodePool.
     class BucketsHolder {
     public:
-        BucketsHolder() : capacity(0), buckets(nullptr) {}
-        explicit BucketsHolder(size_t _capacity) : capacity(_capacity), buckets(new Node*[capacity]()) {}
+        explicit BucketsHolder(const Allocator& _allocator) : allocator(_allocator), capacity(0), buckets(nullptr) {}
+        // Without zeroed the buckets are left uninitialized, and every range has to be
+        // zeroed with zeroRange before the array is used or destroyed along with its map
+        BucketsHolder(size_t _capacity, const Allocator& _allocator, bool zeroed = true);
         ~BucketsHolder() { clear(); }
         
         // Disable copying
@@ -86,272 +359,1536 @@ private:
         BucketsHolder& operator=(BucketsHolder&& other) noexcept;
 
         Node** get() { return buckets; }
+        Node* const* get() const { return buckets; }
         Node*& operator[](size_t index) { return buckets[index]; }
         const Node* operator[](size_t index) const { return buckets[index]; }
+        size_t count() const { return capacity; }
+        // Zeroes range part of parts, the buckets i with i * parts / count() == part
+        void zeroRange(size_t part, size_t parts) noexcept;
 
-        void rehash(size_t newCapacity);
+        // Relinks every node into newCapacity buckets, spread over up to threads threads
+        void rehash(size_t newCapacity, const Hasher& hasher, size_t threads);
 
     private:
+        using BucketAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node*>;
+        using BucketTraits = std::allocator_traits<BucketAllocator>;
+
+        [[no_unique_address]] BucketAllocator allocator;
         size_t capacity;
         Node** buckets;
 
         void clear();
     };
 
+    // Probe for the overflow tree: a hash and a key of any type ordered against K
+    template<typename Q>
+    struct OverflowKey {
+        size_t hash;
+        const Q& key;
+    };
+
+    // Orders the overflow nodes by hash, then by key if orderedOverflow
+    struct OverflowOrder {
+        using is_transparent = void;
+
+        Hasher hasher;
+
+        bool operator()(const Node* a, const Node* b) const {
+            size_t aHash = nodeHash(a, hasher), bHash = nodeHash(b, hasher);
+            if constexpr (orderedOverflow) {
+                return aHash < bHash || (aHash == bHash && a->key < b->key);
+            } else {
+                return aHash < bHash;
+            }
+        }
+        bool operator()(const Node* a, size_t bHash) const { return nodeHash(a, hasher) < bHash; }
+        bool operator()(size_t aHash, const Node* b) const { return aHash < nodeHash(b, hasher); }
+        template<typename Q>
+        bool operator()(const Node* a, const OverflowKey<Q>& b) const {
+            size_t aHash = nodeHash(a, hasher);
+            return aHash < b.hash || (aHash == b.hash && a->key < b.key);
+        }
+        template<typename Q>
+        bool operator()(const OverflowKey<Q>& a, const Node* b) const {
+            size_t bHash = nodeHash(b, hasher);
+            return a.hash < bHash || (a.hash == bHash && a.key < b->key);
+        }
+    };
+
+    using OverflowAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node*>;
+    // Nodes of the overflow tree are not linked to any chain
+    using Overflow = std::multiset<Node*, OverflowOrder, OverflowAllocator>;
+
+    template<bool Const>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = std::pair<const K, V>;
+        using reference = std::pair<const K&, std::conditional_t<Const, const V&, V&>>;
+        // Keeps the pair of references alive for operator->
+        struct pointer {
+            reference ref;
+            const reference* operator->() const { return &ref; }
+        };
+
+        Iterator() = default;
+        // iterator converts to const_iterator
+        template<bool OtherConst>
+        requires (Const && !OtherConst)
+        Iterator(const Iterator<OtherConst>& other) : map(other.map), inOldBuckets(other.inOldBuckets), inOverflow(other.inOverflow),
+            bucket(other.bucket), node(other.node), overflowNode(other.overflowNode) {}
+
+        reference operator*() const { return {node->key, node->value}; }
+        pointer operator->() const { return pointer{**this}; }
+        Iterator& operator++() {
+            if(inOverflow) {
+                ++overflowNode;
+                node = overflowNode == map->overflow.end() ? nullptr : *overflowNode;
+            } else {
+                node = node->next;
+                settle();
+            }
+            return *this;
+        }
+        Iterator operator++(int) { Iterator old = *this; ++*this; return old; }
+        bool operator==(const Iterator& other) const { return node == other.node; }
+
+    private:
+        friend class CeTuHashMap;
+        template<bool> friend class Iterator;
+
+        const CeTuHashMap* map = nullptr;
+        bool inOldBuckets = false;
+        bool inOverflow = false;
+        size_t bucket = 0;
+        Node* node = nullptr;
+        typename Overflow::const_iterator overflowNode{};
+
+        // Starts before the first bucket, or at the end when _map is nullptr
+        explicit Iterator(const CeTuHashMap* _map) : map(_map), bucket(static_cast<size_t>(-1)) {
+            if(map) {
+                settle();
+            }
+        }
+
+        // Walks on to the next node, through the current buckets, the old ones and then the
+        // overflow tree
+        void settle() {
+            while(node == nullptr) {
+                const BucketsHolder& holder = inOldBuckets ? map->oldBuckets : map->buckets;
+                if(++bucket >= holder.count()) {
+                    if(inOldBuckets) {
+                        inOverflow = true;
+                        overflowNode = map->overflow.begin();
+                        node = overflowNode == map->overflow.end() ? nullptr : *overflowNode;
+                        return;
+                    }
+                    inOldBuckets = true;
+                    bucket = static_cast<size_t>(-1);
+                    continue;
+                }
+                node = holder.get()[bucket];
+            }
+        }
+    };
+
+    // Declared before the buckets so that it outlives them
+    NodePool pool;
     BucketsHolder buckets;
+    // Buckets of the previous capacity during an incremental rehash, empty otherwise
+    BucketsHolder oldBuckets;
     size_t currentSize;
     size_t capacity;
+    float maxLoadFactor;
+    // Old buckets below this index have been migrated
+    size_t migrateIndex;
+    bool incrementalRehash;
+    size_t rehashThreads;
+    Hasher hasher;
+    [[no_unique_address]] KeyEqual keyEqual;
+    // Declared after the hasher, which its order copies
+    Overflow overflow;
+#ifdef CETU_HASHMAP_STATS
+    CeTuDetail::RehashCounters rehashCounters;
+#endif
 
+    // Must be a power of two
     static const size_t defaultSize = 16;
-    static constexpr double loadFactor = 0.75;
+    static constexpr float defaultMaxLoadFactor = 0.75f;
+    // Old buckets migrated by every insert or erase during an incremental rehash
+    static const size_t migrateBucketsPerOperation = 16;
+    // Keys hashed and prefetched ahead by the batched operations
+    static constexpr size_t batchChunk = 32;
+    // Smaller bucket arrays are always relinked on the calling thread
+    static const size_t parallelRehashMinBuckets = 1 << 16;
+    // Nodes a chain holds before new ones go to the overflow tree
+    static const size_t maxChainLength = 8;
+
+    template<typename Q>
+    size_t hash(const Q& key) const { return CeTuDetail::hashKey(hasher, key); }
+    // Reuses the stored hash if there is one
+    static size_t nodeHash(const Node* node, const Hasher& hasher) {
+        if constexpr (storeHash) {
+            return node->storedHash.value;
+        } else {
+            return CeTuDetail::hashKey(hasher, node->key);
+        }
+    }
+
+    // The bucket owning keyHash: an old bucket that has not been migrated yet still holds
+    // its keys, every other key lives in the current buckets
+    Node** bucketFor(size_t keyHash);
+    Node* const* bucketSlot(size_t keyHash) const { return const_cast<CeTuHashMap*>(this)->bucketFor(keyHash); }
+    Node* bucketHead(size_t keyHash) const { return *bucketSlot(keyHash); }
 
-    size_t hash(const K& key) const { return std::hash<K>{}(key) % capacity; }
+    // Returns the node holding key (whose hash is keyHash) in the chain starting at head, or nullptr
+    template<typename Q>
+    Node* findNode(const Q& key, size_t keyHash, Node* head) const;
+    // Same for the nodes of an overflow tree, returning tree.end() if key is absent
+    template<typename Q>
+    typename Overflow::const_iterator findOverflow(const Overflow& tree, const Q& key, size_t keyHash) const;
+    // Looks in the chain of keyHash first and in the overflow tree second
+    template<typename Q>
+    Node* locate(const Q& key, size_t keyHash) const;
+    static bool chainFull(const Node* head);
+    Overflow makeOverflow() const { return Overflow(OverflowOrder{hasher}, OverflowAllocator(get_allocator())); }
+    template<typename KeyType, typename... Args>
+    std::pair<V*, bool> tryEmplaceImpl(KeyType&& key, Args&&... args) {
+        size_t keyHash = hash(key);
+        return tryEmplaceHashed(keyHash, std::forward<KeyType>(key), std::forward<Args>(args)...);
+    }
+    template<typename KeyType, typename... Args>
+    std::pair<V*, bool> tryEmplaceHashed(size_t keyHash, KeyType&& key, Args&&... args);
+    template<typename Q>
+    V* findImpl(const Q& key) const { return findImpl(key, hash(key)); }
+    template<typename Q>
+    V* findImpl(const Q& key, size_t keyHash) const;
+    template<typename Q>
+    std::optional<V> lookupImpl(const Q& key) const;
+    template<typename Q>
+    void eraseImpl(const Q& key) { eraseImpl(key, hash(key)); }
+    template<typename Q>
+    void eraseImpl(const Q& key, size_t keyHash);
+    // Takes the node of key out of its chain or the overflow tree, or returns nullptr
+    template<typename Q>
+    Node* unlink(const Q& key, size_t keyHash);
+    // Links the new node at the head of *bucket, or into the overflow tree if that chain is
+    // full. Only the tree insertion can throw, and it leaves the map as it was.
+    void link(Node* node, Node** bucket);
+    // Moves the nodes of other over, calling onDuplicate(mine, theirs) for keys present here
+    template<typename F>
+    void mergeImpl(CeTuHashMap&& other, F&& onDuplicate);
+    // Destroys every node through owner, which may differ from pool while merging
+    void releaseAll(NodePool& owner) noexcept;
+    // Hashes up to batchChunk keys from start into hashes and prefetches their buckets and
+    // chain heads; returns how many keys were taken
+    size_t prepareBatch(std::span<const K> keys, size_t start, size_t* hashes) const;
+    template<typename Result>
+    void lookupBatchImpl(std::span<const K> keys, std::span<Result> results) const;
+    // Walks the chain one node per suspension, then falls back to the overflow tree
+    template<typename Result>
+    // key is taken by value: the coroutine starts lazily and would outlive a referenced
+    // temporary
+    CeTuLookupTask<Result> lookupAsyncImpl(K key) const;
     void rehash();
+    void resize(size_t newCapacity);
+    // Moves up to count old buckets into the current ones
+    void migrateBuckets(size_t count);
+    void finishMigration() { migrateBuckets(oldBuckets.count()); }
+    // Moves every node into a fresh pool so that the free blocks are given back
+    void compactNodes();
     void copy(const CeTuHashMap& other);
+    // Destroys all nodes of holder, returning their blocks to the pool
+    void releaseNodes(BucketsHolder& holder) noexcept;
+    void releaseOverflow() noexcept;
+    // Moves the nodes past maxChainLength of every chain to the overflow tree, after
+    // shrinking has merged chains
+    void spillLongChains();
 };
 
 // Constructor
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>::CeTuHashMap() : buckets(defaultSize), currentSize(0), capacity(defaultSize) {}
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::CeTuHashMap() : CeTuHashMap(Allocator()) {}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::CeTuHashMap(const Allocator& allocator) : pool(allocator), buckets(defaultSize, allocator),
+    oldBuckets(allocator), currentSize(0), capacity(defaultSize), maxLoadFactor(defaultMaxLoadFactor), migrateIndex(0),
+    incrementalRehash(false), rehashThreads(1), overflow(makeOverflow()) {}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::CeTuHashMap(size_t expectedSize, const Allocator& allocator) : pool(allocator),
+    buckets(CeTuDetail::capacityFor(expectedSize, defaultMaxLoadFactor, defaultSize), allocator), oldBuckets(allocator),
+    currentSize(0), capacity(buckets.count()), maxLoadFactor(defaultMaxLoadFactor), migrateIndex(0), incrementalRehash(false),
+    rehashThreads(1), overflow(makeOverflow()) {}
 
 // Destructor
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>::~CeTuHashMap() noexcept {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::~CeTuHashMap() noexcept {
+    // The pool frees its slabs wholesale, so nodes only need visiting to run destructors
+    if constexpr (!std::is_trivially_destructible_v<Node>) {
+        releaseNodes(buckets);
+        releaseNodes(oldBuckets);
+        releaseOverflow();
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::clear() noexcept {
+    releaseNodes(buckets);
+    releaseOverflow();
+    if(oldBuckets.count() != 0) {
+        releaseNodes(oldBuckets);
+        oldBuckets = BucketsHolder(get_allocator());
+        migrateIndex = 0;
+    }
+    currentSize = 0;
 }
 
 // Copy constructor
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>::CeTuHashMap(const CeTuHashMap& other) : currentSize(other.currentSize), capacity(other.capacity) {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::CeTuHashMap(const CeTuHashMap& other) requires CopyAssignableAndConstructible<K, V> :
+    pool(std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator())),
+    buckets(get_allocator()), oldBuckets(get_allocator()), currentSize(other.currentSize), capacity(other.capacity),
+    maxLoadFactor(other.maxLoadFactor), migrateIndex(other.migrateIndex), incrementalRehash(other.incrementalRehash),
+    rehashThreads(other.rehashThreads), hasher(other.hasher), keyEqual(other.keyEqual), overflow(makeOverflow()) {
     copy(other);
 }
 
 // Copy assignment operator
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>& CeTuHashMap<K, V>::operator=(const CeTuHashMap& other) {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>& CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::operator=(const CeTuHashMap& other) requires CopyAssignableAndConstructible<K, V> {
     if(this == &other) {
         return *this;
     }
 
-    // Copy from other
-    capacity = other.capacity;
-    currentSize = other.currentSize;
-    copy(other);
+    // Copy first, so that a failure leaves this map as it was
+    CeTuHashMap copied(other);
+    *this = std::move(copied);
 
     return *this;
 }
 
 // Move constructor
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>::CeTuHashMap(CeTuHashMap&& other) noexcept : buckets(std::move(other.buckets)),
-    currentSize(other.currentSize), capacity(other.capacity) {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::CeTuHashMap(CeTuHashMap&& other) noexcept : pool(std::move(other.pool)), buckets(std::move(other.buckets)),
+    oldBuckets(std::move(other.oldBuckets)), currentSize(other.currentSize), capacity(other.capacity), maxLoadFactor(other.maxLoadFactor),
+    migrateIndex(other.migrateIndex), incrementalRehash(other.incrementalRehash), rehashThreads(other.rehashThreads), hasher(std::move(other.hasher)),
+    keyEqual(std::move(other.keyEqual)), overflow(std::move(other.overflow)) {
+    other.overflow.clear();
     other.currentSize = 0;
     other.capacity = 0;
+    other.migrateIndex = 0;
 }
 
 // Move assignment operator
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>& CeTuHashMap<K, V>::operator=(CeTuHashMap&& other) noexcept {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>& CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::operator=(CeTuHashMap&& other) noexcept {
     if(this == &other) {
         return *this;
     }
 
+    std::swap(pool, other.pool);
     std::swap(buckets, other.buckets);
+    std::swap(oldBuckets, other.oldBuckets);
     std::swap(currentSize, other.currentSize);
     std::swap(capacity, other.capacity);
+    std::swap(maxLoadFactor, other.maxLoadFactor);
+    std::swap(migrateIndex, other.migrateIndex);
+    std::swap(incrementalRehash, other.incrementalRehash);
+    std::swap(rehashThreads, other.rehashThreads);
+    std::swap(hasher, other.hasher);
+    std::swap(keyEqual, other.keyEqual);
+    std::swap(overflow, other.overflow);
 
     return *this;
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-void CeTuHashMap<K, V>::insert(K key, V value) {
-    if(currentSize > capacity * loadFactor) {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::empty_like(const CeTuHashMap& other) {
+    CeTuHashMap map(other.get_allocator());
+    map.hasher = other.hasher;
+    map.keyEqual = other.keyEqual;
+    // The overflow tree orders its nodes with a copy of the hasher
+    map.overflow = map.makeOverflow();
+    return map;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<std::ranges::random_access_range Range, typename ThreadInit>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::build_from(const Range& entries, size_t threads,
+    const Allocator& allocator, ThreadInit threadInit) requires CopyAssignableAndConstructible<K, V> {
+    const size_t count = std::ranges::size(entries);
+    const size_t capacity = CeTuDetail::capacityFor(count, defaultMaxLoadFactor, defaultSize);
+    threads = std::clamp<size_t>(threads, 1, capacity);
+    if(threads == 1) {
+        [[maybe_unused]] auto scope = threadInit(0);
+        CeTuHashMap map(count, allocator);
+        for(const auto& [key, value] : entries) {
+            map.insert(key, value);
+        }
+        return map;
+    }
+    // The map keeps its default buckets until the new ones are all zeroed by their linkers
+    CeTuHashMap map(allocator);
+    BucketsHolder buckets(capacity, allocator, false);
+
+    // Entries [sliceBegin(t), sliceBegin(t + 1)) are hashed by thread t, while the entries of
+    // bucket range t are linked by thread t
+    auto sliceBegin = [count, threads](size_t t) { return count / threads * t + std::min(t, count % threads); };
+    auto owner = [capacity, threads](size_t keyHash) { return (keyHash & (capacity - 1)) * threads / capacity; };
+
+    // Hash every slice and count its entries per bucket range
+    std::vector<size_t> hashes(count);
+    std::vector<size_t> counts(threads * threads, 0);
+    CeTuDetail::parallelFor(threads, [&](size_t t) {
+        for(size_t i = sliceBegin(t); i < sliceBegin(t + 1); ++i) {
+            const auto& [key, value] = entries[i];
+            hashes[i] = map.hash(key);
+            counts[t * threads + owner(hashes[i])]++;
+        }
+    });
+
+    // Group the entry indices by bucket range, keeping the input order within each range
+    std::vector<size_t> offsets(threads * threads);
+    std::vector<size_t> rangeBegin(threads + 1);
+    size_t offset = 0;
+    for(size_t range = 0; range < threads; ++range) {
+        rangeBegin[range] = offset;
+        for(size_t t = 0; t < threads; ++t) {
+            offsets[t * threads + range] = offset;
+            offset += counts[t * threads + range];
+        }
+    }
+    rangeBegin[threads] = offset;
+
+    std::vector<size_t> order(count);
+    CeTuDetail::parallelFor(threads, [&](size_t t) {
+        size_t* next = offsets.data() + t * threads;
+        for(size_t i = sliceBegin(t); i < sliceBegin(t + 1); ++i) {
+            order[next[owner(hashes[i])]++] = i;
+        }
+    });
+
+    // Link every bucket range with nodes from a pool of its own
+    std::vector<NodePool> pools;
+    pools.reserve(threads);
+    for(size_t t = 0; t < threads; ++t) {
+        pools.emplace_back(map.pool.get_allocator());
+    }
+    // Every bucket range also collects its overflowing nodes on its own
+    std::vector<Overflow> overflows;
+    overflows.reserve(threads);
+    for(size_t t = 0; t < threads; ++t) {
+        overflows.push_back(map.makeOverflow());
+    }
+    std::vector<size_t> inserted(threads, 0);
+    std::exception_ptr failure;
+    try {
+        CeTuDetail::parallelFor(threads, [&](size_t t) {
+            // Every range is zeroed even on failure, the map releases the nodes it links
+            [[maybe_unused]] auto scope = [&] {
+                try {
+                    return threadInit(t);
+                } catch(...) {
+                    buckets.zeroRange(t, threads);
+                    throw;
+                }
+            }();
+            buckets.zeroRange(t, threads);
+            for(size_t k = rangeBegin[t]; k < rangeBegin[t + 1]; ++k) {
+                const auto& [key, value] = entries[order[k]];
+                size_t keyHash = hashes[order[k]];
+                Node*& bucket = buckets[keyHash & (capacity - 1)];
+                Node* existing = map.findNode(key, keyHash, bucket);
+                if(existing == nullptr && !overflows[t].empty()) {
+                    auto it = map.findOverflow(overflows[t], key, keyHash);
+                    existing = it == overflows[t].end() ? nullptr : *it;
+                }
+                if(existing) {
+                    existing->value = value;
+                    continue;
+                }
+                NodeHolder node(pools[t], key, value);
+                node.get()->storedHash.set(keyHash);
+                if(chainFull(bucket)) {
+                    overflows[t].insert(node.get());
+                    node.release();
+                } else {
+                    node.get()->next = bucket;
+                    bucket = node.release();
+                }
+                inserted[t]++;
+            }
+        });
+    } catch(...) {
+        failure = std::current_exception();
+    }
+
+    // Linked nodes are released through map.pool, so it has to own them even on failure
+    map.buckets = std::move(buckets);
+    map.capacity = capacity;
+    for(size_t t = 0; t < threads; ++t) {
+        map.pool.adopt(pools[t]);
+        map.overflow.merge(overflows[t]);
+        map.currentSize += inserted[t];
+    }
+    if(failure) {
+        std::rethrow_exception(failure);
+    }
+    return map;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::deserialize(std::istream& in,
+    const Allocator& allocator) requires CeTuSerializable<K> && CeTuSerializable<V> {
+    CeTuHashMap map(allocator);
+    CeTuDetail::deserializeMap<K, V>(map, in);
+    return map;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::insert(K key, V value) {
+    auto [current, inserted] = tryEmplaceImpl(std::move(key), std::move(value));
+    if(!inserted) {
+        *current = std::move(value);  // Update existing value
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename KeyType, typename... Args>
+std::pair<V*, bool> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::tryEmplaceHashed(size_t keyHash, KeyType&& key, Args&&... args) {
+    migrateBuckets(migrateBucketsPerOperation);
+    if(capacity == 0 || currentSize > capacity * maxLoadFactor) {
         rehash();
     }
 
-    size_t index = hash(key);
-    
+    Node** bucket = bucketFor(keyHash);
+
     // Check if key already exists
-    Node* current = buckets[index];
-    while(current != nullptr) {
-        if(current->key == key) {
-            current->value = value;  // Update existing value
-            return;
+    if(Node* current = findNode(key, keyHash, *bucket)) {
+        return {&current->value, false};
+    }
+    if(!overflow.empty()) {
+        if(auto it = findOverflow(overflow, key, keyHash); it != overflow.end()) {
+            return {&(*it)->value, false};
         }
-        current = current->next;
     }
 
-    // Create new node and insert at the beginning of the list
-    NodeHolder newNode(std::move(key), std::move(value));
-    newNode.get()->next = buckets[index];
-    buckets[index] = newNode.release();
+    // Create new node and insert at the beginning of the list, or into the overflow tree
+    // once the list is full
+    NodeHolder newNode(pool, std::forward<KeyType>(key), std::forward<Args>(args)...);
+    newNode.get()->storedHash.set(keyHash);
+    link(newNode.get(), bucket);
     currentSize++;
+
+    return {&newNode.release()->value, true};
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-std::optional<V>  CeTuHashMap<K, V>::lookup(K key) {
-    if(currentSize == 0) {
-        return std::nullopt;
-    }
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+std::optional<V> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::lookup(const K& key) const {
+    return lookupImpl(key);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::erase(const K& key) {
+    eraseImpl(key);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::Node* CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::findNode(const Q& key, size_t keyHash, Node* head) const {
+    Node* current = head;
 
-    size_t index = hash(key);
-    Node* current = buckets[index];
-    
     while(current != nullptr) {
-        if(current->key == key) {
-            return std::make_optional(current->value);
+        if(current->storedHash.mayMatch(keyHash) && keyEqual(current->key, key)) {
+            return current;
         }
         current = current->next;
     }
-    
+
+    return nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::Overflow::const_iterator CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::findOverflow(
+    const Overflow& tree, const Q& key, size_t keyHash) const {
+    if constexpr (orderedOverflow && std::totally_ordered_with<K, Q>) {
+        auto it = tree.lower_bound(OverflowKey<Q>{keyHash, key});
+        if(it != tree.end() && nodeHash(*it, hasher) == keyHash && keyEqual((*it)->key, key)) {
+            return it;
+        }
+    } else {
+        // Without an order on the keys, nodes with the same hash are compared one by one
+        auto [it, last] = tree.equal_range(keyHash);
+        for(; it != last; ++it) {
+            if(keyEqual((*it)->key, key)) {
+                return it;
+            }
+        }
+    }
+    return tree.end();
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::Node* CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::locate(const Q& key, size_t keyHash) const {
+    Node* current = findNode(key, keyHash, bucketHead(keyHash));
+    if(current == nullptr && !overflow.empty()) {
+        auto it = findOverflow(overflow, key, keyHash);
+        current = it == overflow.end() ? nullptr : *it;
+    }
+    return current;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+bool CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::chainFull(const Node* head) {
+    size_t length = 0;
+    for(; head != nullptr && length < maxChainLength; head = head->next) {
+        ++length;
+    }
+    return length == maxChainLength;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename KeyArg, typename... Args>
+std::pair<V*, bool> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::emplace(KeyArg&& keyArg, Args&&... args) {
+    return tryEmplaceImpl(K(std::forward<KeyArg>(keyArg)), std::forward<Args>(args)...);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename M>
+std::pair<V*, bool> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::insert_or_assign(const K& key, M&& value) {
+    auto result = tryEmplaceImpl(key, std::forward<M>(value));
+    if(!result.second) {
+        *result.first = std::forward<M>(value);
+    }
+    return result;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename M>
+std::pair<V*, bool> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::insert_or_assign(K&& key, M&& value) {
+    auto result = tryEmplaceImpl(std::move(key), std::forward<M>(value));
+    if(!result.second) {
+        *result.first = std::forward<M>(value);
+    }
+    return result;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+std::pair<V*, bool> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::upsert(K key, V value, F&& combine) {
+    // value is only moved from when a new node is built
+    auto result = tryEmplaceImpl(std::move(key), std::move(value));
+    if(!result.second) {
+        *result.first = combine(std::move(*result.first), std::move(value));
+    }
+    return result;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+V* CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::findImpl(const Q& key, size_t keyHash) const {
+    if(currentSize == 0) {
+        return nullptr;
+    }
+
+    Node* current = locate(key, keyHash);
+    return current != nullptr ? &current->value : nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+std::optional<V> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::lookupImpl(const Q& key) const {
+    if(const V* value = findImpl(key)) {
+        return std::make_optional(*value);
+    }
+
     return std::nullopt;
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-void CeTuHashMap<K, V>::erase(K key) {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::eraseImpl(const Q& key, size_t keyHash) {
     if(currentSize == 0) {
         return;
     }
 
-    size_t index = hash(key);
-    Node* current = buckets[index];
-    Node* prev = nullptr;
+    if(Node* current = unlink(key, keyHash)) {
+        pool.destroy(current);
+    }
+}
 
-    while(current != nullptr) {
-        if(current->key == key) {
-            if(prev == nullptr) {
-                buckets[index] = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            delete current;
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Q>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::Node* CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::unlink(const Q& key, size_t keyHash) {
+    migrateBuckets(migrateBucketsPerOperation);
+
+    for(Node** link = bucketFor(keyHash); *link != nullptr; link = &(*link)->next) {
+        Node* current = *link;
+        if(current->storedHash.mayMatch(keyHash) && keyEqual(current->key, key)) {
+            *link = current->next;
             currentSize--;
+            return current;
+        }
+    }
+
+    if(!overflow.empty()) {
+        if(auto it = findOverflow(overflow, key, keyHash); it != overflow.end()) {
+            Node* current = *it;
+            overflow.erase(it);
+            currentSize--;
+            return current;
+        }
+    }
+    return nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::link(Node* node, Node** bucket) {
+    if(chainFull(*bucket)) {
+        overflow.insert(node);
+    } else {
+        node->next = *bucket;
+        *bucket = node;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::node_type CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::extract(const K& key) {
+    node_type handle;
+    if(currentSize == 0) {
+        return handle;
+    }
+    if(Node* current = unlink(key, hash(key))) {
+        try {
+            handle.entry.emplace(std::move(current->key), std::move(current->value));
+        } catch(...) {
+            pool.destroy(current);
+            throw;
+        }
+        pool.destroy(current);
+    }
+    return handle;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::insert_return_type CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::insert(node_type&& node) {
+    if(node.empty()) {
+        return {nullptr, false, node_type()};
+    }
+    // The key and value are only moved from if they are inserted
+    auto [current, inserted] = tryEmplaceImpl(std::move(node.entry->first), std::move(node.entry->second));
+    if(inserted) {
+        node.entry.reset();
+        return {current, true, node_type()};
+    }
+    return {current, false, std::move(node)};
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::mergeImpl(CeTuHashMap&& other, F&& onDuplicate) {
+    if(this == &other || other.currentSize == 0) {
+        return;
+    }
+
+    finishMigration();
+    other.finishMigration();
+    reserve(currentSize + other.currentSize);
+    const bool adopting = pool.get_allocator() == other.pool.get_allocator();
+    const bool sameSeed = hasher.seed == other.hasher.seed;
+    if(adopting) {
+        pool.adopt(other.pool);
+    }
+    NodePool& owner = adopting ? pool : other.pool;
+
+    // Every node is taken out of other before it is placed here, so after a failure each
+    // node is in exactly one of the maps
+    auto take = [&](Node* node) {
+        --other.currentSize;
+        node->next = nullptr;
+        size_t keyHash = sameSeed ? nodeHash(node, hasher) : hash(node->key);
+        Node** bucket = bucketFor(keyHash);
+        Node* existing = findNode(node->key, keyHash, *bucket);
+        if(existing == nullptr && !overflow.empty()) {
+            auto it = findOverflow(overflow, node->key, keyHash);
+            existing = it == overflow.end() ? nullptr : *it;
+        }
+        if(existing) {
+            try {
+                onDuplicate(existing->value, node->value);
+            } catch(...) {
+                owner.destroy(node);
+                throw;
+            }
+            owner.destroy(node);
             return;
         }
-        prev = current;
-        current = current->next;
+        try {
+            if(adopting) {
+                node->storedHash.set(keyHash);
+                link(node, bucket);
+                node = nullptr;
+            } else {
+                NodeHolder fresh(pool, std::move(node->key), std::move(node->value));
+                fresh.get()->storedHash.set(keyHash);
+                link(fresh.get(), bucket);
+                fresh.release();
+            }
+        } catch(...) {
+            owner.destroy(node);
+            throw;
+        }
+        if(node) {
+            owner.destroy(node);
+        }
+        currentSize++;
+    };
+    try {
+        for(size_t i = 0; i < other.capacity; ++i) {
+            while(Node* node = other.buckets[i]) {
+                other.buckets[i] = node->next;
+                take(node);
+            }
+        }
+        while(!other.overflow.empty()) {
+            take(other.overflow.extract(other.overflow.begin()).value());
+        }
+    } catch(...) {
+        other.releaseAll(owner);
+        throw;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::lookup_batch(std::span<const K> keys, std::span<V*> results) {
+    lookupBatchImpl(keys, results);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::lookup_batch(std::span<const K> keys, std::span<const V*> results) const {
+    lookupBatchImpl(keys, results);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::insert_batch(std::span<const K> keys, std::span<const V> values) requires CopyAssignableAndConstructible<K, V> {
+    if(keys.size() != values.size()) {
+        throw std::invalid_argument("CeTuHashMap: insert_batch needs as many values as keys");
+    }
+
+    // Grow once up front so that the prefetched buckets stay put, unless growth is meant
+    // to be spread over the operations
+    if(!incrementalRehash) {
+        reserve(currentSize + keys.size());
+    }
+    size_t hashes[batchChunk];
+    for(size_t start = 0; start < keys.size(); start += batchChunk) {
+        size_t count = prepareBatch(keys, start, hashes);
+        for(size_t i = 0; i < count; ++i) {
+            auto [current, inserted] = tryEmplaceHashed(hashes[i], keys[start + i], values[start + i]);
+            if(!inserted) {
+                *current = values[start + i];
+            }
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::erase_batch(std::span<const K> keys) {
+    size_t hashes[batchChunk];
+    for(size_t start = 0; start < keys.size(); start += batchChunk) {
+        size_t count = prepareBatch(keys, start, hashes);
+        for(size_t i = 0; i < count; ++i) {
+            eraseImpl(keys[start + i], hashes[i]);
+        }
+    }
+}
+
+#ifdef CETU_HASHMAP_STATS
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMapStats CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::stats() const {
+    CeTuHashMapStats result;
+    result.size = currentSize;
+    result.bucketCount = capacity;
+    result.loadFactor = load_factor();
+    for(const BucketsHolder* holder : {&buckets, &oldBuckets}) {
+        for(size_t i = 0; i < holder->count(); ++i) {
+            size_t length = 0;
+            for(const Node* node = holder->get()[i]; node != nullptr; node = node->next) {
+                CeTuDetail::addProbe(result, ++length);
+            }
+        }
+    }
+    result.overflowEntries = overflow.size();
+    result.rehashCount = rehashCounters.count;
+    result.rehashTime = rehashCounters.time;
+    result.bucketBytes = (buckets.count() + oldBuckets.count()) * sizeof(Node*);
+    result.entryBytes = pool.allocatedBytes();
+    return result;
+}
+#endif
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::for_each(F&& visitor) const {
+    for(const BucketsHolder* holder : {&buckets, &oldBuckets}) {
+        for(size_t i = 0; i < holder->count(); ++i) {
+            for(const Node* current = (*holder)[i]; current != nullptr; current = current->next) {
+                visitor(current->key, current->value);
+            }
+        }
+    }
+    for(const Node* current : overflow) {
+        visitor(current->key, current->value);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Result>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::lookupBatchImpl(std::span<const K> keys, std::span<Result> results) const {
+    if(keys.size() != results.size()) {
+        throw std::invalid_argument("CeTuHashMap: lookup_batch needs as many results as keys");
+    }
+
+    size_t hashes[batchChunk];
+    for(size_t start = 0; start < keys.size(); start += batchChunk) {
+        size_t count = prepareBatch(keys, start, hashes);
+        for(size_t i = 0; i < count; ++i) {
+            results[start + i] = findImpl(keys[start + i], hashes[i]);
+        }
     }
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-void CeTuHashMap<K, V>::rehash() {
-    size_t newCapacity = capacity * 2;
-    buckets.rehash(newCapacity);
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename Result>
+CeTuLookupTask<Result> CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::lookupAsyncImpl(K key) const {
+    if(currentSize == 0) {
+        co_return nullptr;
+    }
+
+    size_t keyHash = hash(key);
+    Node* const* bucket = bucketSlot(keyHash);
+    co_await CeTuDetail::PrefetchAwaiter{bucket};
+    for(Node* current = *bucket; current != nullptr; current = current->next) {
+        co_await CeTuDetail::PrefetchAwaiter{current};
+        if(current->storedHash.mayMatch(keyHash) && keyEqual(current->key, key)) {
+            co_return &current->value;
+        }
+    }
+    if(!overflow.empty()) {
+        auto it = findOverflow(overflow, key, keyHash);
+        if(it != overflow.end()) {
+            co_return &(*it)->value;
+        }
+    }
+    co_return nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+size_t CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::prepareBatch(std::span<const K> keys, size_t start, size_t* hashes) const {
+    size_t count = std::min(batchChunk, keys.size() - start);
+    for(size_t i = 0; i < count; ++i) {
+        hashes[i] = hash(keys[start + i]);
+    }
+    if(capacity == 0) {
+        return count;
+    }
+
+    // The chain heads can only be prefetched once their buckets have arrived
+    for(size_t i = 0; i < count; ++i) {
+        CeTuDetail::prefetch(bucketSlot(hashes[i]));
+    }
+    for(size_t i = 0; i < count; ++i) {
+        if(const Node* head = bucketHead(hashes[i])) {
+            CeTuDetail::prefetch(head);
+        }
+    }
+    return count;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::max_load_factor(float value) {
+    if(!(value > 0.0f)) {
+        throw std::invalid_argument("CeTuHashMap: max_load_factor must be positive");
+    }
+
+    maxLoadFactor = value;
+    reserve(currentSize);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::reserve(size_t n) {
+    size_t newCapacity = CeTuDetail::capacityFor(n, maxLoadFactor, defaultSize);
+    if(newCapacity > capacity) {
+        resize(newCapacity);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::rehash(size_t bucketCount) {
+    finishMigration();
+    size_t newCapacity = std::max(std::bit_ceil(bucketCount), CeTuDetail::capacityFor(currentSize, maxLoadFactor, defaultSize));
+    if(newCapacity != capacity) {
+        resize(newCapacity);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::shrink_to_fit() {
+    rehash(0);
+    compactNodes();
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::set_incremental_rehash(bool enabled) {
+    incrementalRehash = enabled;
+    if(!enabled) {
+        finishMigration();
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::rehash() {
+    if(!incrementalRehash || capacity == 0) {
+        resize(capacity == 0 ? defaultSize : capacity * 2);
+        return;
+    }
+
+    // A tiny max_load_factor can outpace the migration
+    finishMigration();
+    CETU_HASHMAP_REHASH_TIMER(rehashCounters, true);
+    BucketsHolder grown(capacity * 2, get_allocator());
+    oldBuckets = std::move(buckets);
+    buckets = std::move(grown);
+    capacity *= 2;
+    migrateIndex = 0;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::resize(size_t newCapacity) {
+    finishMigration();
+    CETU_HASHMAP_REHASH_TIMER(rehashCounters, true);
+    size_t threads = std::max(capacity, newCapacity) >= parallelRehashMinBuckets ? rehashThreads : 1;
+    const bool shrinking = newCapacity < capacity;
+    buckets.rehash(newCapacity, hasher, threads);
     capacity = newCapacity;
+    if(shrinking) {
+        spillLongChains();
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::migrateBuckets(size_t count) {
+    if(oldBuckets.count() == 0) {
+        return;
+    }
+
+    CETU_HASHMAP_REHASH_TIMER(rehashCounters, false);
+    size_t end = std::min(migrateIndex + count, oldBuckets.count());
+    for(; migrateIndex < end; ++migrateIndex) {
+        Node* current = oldBuckets[migrateIndex];
+        while(current) {
+            Node* next = current->next;
+            size_t newIndex = nodeHash(current, hasher) & (capacity - 1);
+            current->next = buckets[newIndex];
+            buckets[newIndex] = current;
+            current = next;
+        }
+        oldBuckets[migrateIndex] = nullptr;
+    }
+
+    if(migrateIndex == oldBuckets.count()) {
+        oldBuckets = BucketsHolder(get_allocator());
+        migrateIndex = 0;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::Node** CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::bucketFor(size_t keyHash) {
+    if(oldBuckets.count() != 0) {
+        size_t oldIndex = keyHash & (oldBuckets.count() - 1);
+        if(oldIndex >= migrateIndex) {
+            return &oldBuckets[oldIndex];
+        }
+    }
+    return &buckets[keyHash & (capacity - 1)];
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::compactNodes() {
+    // Moving a node must not fail halfway, or it would belong to neither pool
+    if constexpr (std::is_nothrow_move_constructible_v<K> && std::is_nothrow_move_constructible_v<V>) {
+        NodePool compacted(pool.get_allocator());
+        compacted.reserve(currentSize);
+        for(size_t i = 0; i < capacity; ++i) {
+            for(Node** link = &buckets[i]; *link != nullptr; link = &(*link)->next) {
+                Node* old = *link;
+                Node* fresh = compacted.create(std::move(old->key), std::move(old->value));
+                fresh->storedHash = old->storedHash;
+                fresh->next = old->next;
+                *link = fresh;
+                pool.destroy(old);
+            }
+        }
+        // Tree nodes are swapped through node handles, which keeps their position and does
+        // not allocate
+        for(auto it = overflow.begin(); it != overflow.end();) {
+            auto handle = overflow.extract(it++);
+            Node* old = handle.value();
+            Node* fresh = compacted.create(std::move(old->key), std::move(old->value));
+            fresh->storedHash = old->storedHash;
+            handle.value() = fresh;
+            pool.destroy(old);
+            overflow.insert(it, std::move(handle));
+        }
+        // The old chunks end up in compacted and are freed with it
+        pool = std::move(compacted);
+    }
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-void CeTuHashMap<K, V>::copy(const CeTuHashMap& other) {
-    BucketsHolder tempBuckets(capacity);
-    for(size_t i = 0; i < capacity; i++) {
-        if(other.buckets[i] != nullptr) {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::copy(const CeTuHashMap& other) {
+    // A pending migration is copied as is, old buckets included
+    BucketsHolder tempBuckets(capacity, get_allocator());
+    BucketsHolder tempOldBuckets = other.rehashing() ? BucketsHolder(other.oldBuckets.count(), get_allocator()) : BucketsHolder(get_allocator());
+    auto copyChains = [this](const BucketsHolder& from, BucketsHolder& to) {
+        for(size_t i = 0; i < from.count(); i++) {
             // Copy the linked list at this bucket
-            Node* otherCurrent = const_cast<Node*>(other.buckets[i]);
             Node* prev = nullptr;
-            while(otherCurrent != nullptr) {
-                NodeHolder newNode(otherCurrent->key, otherCurrent->value);
-                Node* current = newNode.release();
+            for(const Node* otherCurrent = from[i]; otherCurrent != nullptr; otherCurrent = otherCurrent->next) {
+                Node* current = pool.create(otherCurrent->key, otherCurrent->value);
+                current->storedHash = otherCurrent->storedHash;
                 if(prev == nullptr) {
-                    tempBuckets[i] = current;
+                    to[i] = current;
                 } else {
                     prev->next = current;
                 }
                 prev = current;
-                otherCurrent = otherCurrent->next;
             }
         }
+    };
+    Overflow tempOverflow = makeOverflow();
+    try {
+        copyChains(other.buckets, tempBuckets);
+        copyChains(other.oldBuckets, tempOldBuckets);
+        for(const Node* otherCurrent : other.overflow) {
+            NodeHolder current(pool, otherCurrent->key, otherCurrent->value);
+            current.get()->storedHash = otherCurrent->storedHash;
+            tempOverflow.insert(tempOverflow.end(), current.get());
+            current.release();
+        }
+    } catch(...) {
+        releaseNodes(tempBuckets);
+        releaseNodes(tempOldBuckets);
+        for(Node* current : tempOverflow) {
+            pool.destroy(current);
+        }
+        throw;
     }
+    releaseNodes(buckets);
+    releaseNodes(oldBuckets);
+    releaseOverflow();
     buckets = std::move(tempBuckets);
+    oldBuckets = std::move(tempOldBuckets);
+    overflow = std::move(tempOverflow);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::releaseNodes(BucketsHolder& holder) noexcept {
+    for(size_t i = 0; i < holder.count(); ++i) {
+        Node* current = holder[i];
+        while(current) {
+            Node* next = current->next;
+            pool.destroy(current);
+            current = next;
+        }
+        holder[i] = nullptr;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::releaseOverflow() noexcept {
+    for(Node* current : overflow) {
+        pool.destroy(current);
+    }
+    overflow.clear();
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::releaseAll(NodePool& owner) noexcept {
+    for(BucketsHolder* holder : {&buckets, &oldBuckets}) {
+        for(size_t i = 0; i < holder->count(); ++i) {
+            for(Node* current = (*holder)[i]; current != nullptr;) {
+                Node* next = current->next;
+                owner.destroy(current);
+                current = next;
+            }
+            (*holder)[i] = nullptr;
+        }
+    }
+    for(Node* current : overflow) {
+        owner.destroy(current);
+    }
+    overflow.clear();
+    currentSize = 0;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::spillLongChains() {
+    for(size_t i = 0; i < capacity; ++i) {
+        Node* last = buckets[i];
+        for(size_t length = 1; last != nullptr && length < maxChainLength; ++length) {
+            last = last->next;
+        }
+        // A node is only unlinked once it is in the tree, so a failed insertion leaves it
+        // in its chain
+        while(last != nullptr && last->next != nullptr) {
+            Node* current = last->next;
+            overflow.insert(current);
+            last->next = current->next;
+            current->next = nullptr;
+        }
+    }
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
 template<typename... Args>
-CeTuHashMap<K, V>::NodeHolder::NodeHolder(Args&&... args) :
-    node(new Node(std::forward<Args>(args)...)) {}
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodeHolder::NodeHolder(NodePool& _pool, Args&&... args) :
+    pool(_pool), node(pool.create(std::forward<Args>(args)...)) {}
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>::Node* CeTuHashMap<K, V>::NodeHolder::release() {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::Node* CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodeHolder::release() {
     Node* tmp = node;
     node = nullptr;
     return tmp;
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>::BucketsHolder::BucketsHolder(BucketsHolder&& other) noexcept :
-    capacity(other.capacity), buckets(other.buckets)
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::BucketsHolder::BucketsHolder(size_t _capacity, const Allocator& _allocator, bool zeroed) :
+    allocator(_allocator), capacity(_capacity), buckets(BucketTraits::allocate(allocator, capacity))
+{
+    if(zeroed) {
+        zeroRange(0, 1);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::BucketsHolder::zeroRange(size_t part, size_t parts) noexcept {
+    size_t begin = (capacity * part + parts - 1) / parts;
+    size_t end = (capacity * (part + 1) + parts - 1) / parts;
+    std::uninitialized_fill(buckets + begin, buckets + end, nullptr);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::BucketsHolder::BucketsHolder(BucketsHolder&& other) noexcept :
+    allocator(std::move(other.allocator)), capacity(other.capacity), buckets(other.buckets)
 {
     other.capacity = 0;
     other.buckets = nullptr;
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-CeTuHashMap<K, V>::BucketsHolder& CeTuHashMap<K, V>::BucketsHolder::operator=(BucketsHolder&& other) noexcept {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::BucketsHolder& CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::BucketsHolder::operator=(BucketsHolder&& other) noexcept {
     if(this == &other) {
         return *this;
     }
 
+    std::swap(allocator, other.allocator);
     std::swap(capacity, other.capacity);
     std::swap(buckets, other.buckets);
 
     return *this;
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-void CeTuHashMap<K, V>::BucketsHolder::rehash(size_t newCapacity) {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::BucketsHolder::rehash(size_t newCapacity, const Hasher& hasher, size_t threads) {
     // Create new array of buckets
-    Node** newBuckets = new Node*[newCapacity]();
+    Node** newBuckets = BucketTraits::allocate(allocator, newCapacity);
+    std::uninitialized_fill_n(newBuckets, newCapacity, nullptr);
 
-    // Move all nodes to new buckets
-    for(size_t i = 0; i < capacity; ++i) {
-        Node* current = buckets[i];
-        while(current) {
-            Node* next = current->next;
-            // Calculate new index based on new capacity
-            size_t newIndex = std::hash<K>{}(current->key) % newCapacity;
-            // Insert at beginning of new bucket
-            current->next = newBuckets[newIndex];
-            newBuckets[newIndex] = current;
-            current = next;
+    const size_t smaller = std::min(capacity, newCapacity);
+    threads = std::min(threads, smaller);
+    if(threads > 1) {
+        // Old bucket i only feeds new buckets congruent to i modulo the smaller capacity, so
+        // threads owning disjoint residue ranges never touch the same bucket
+        CeTuDetail::parallelFor(threads, [&](size_t t) {
+            for(size_t residue = smaller * t / threads; residue < smaller * (t + 1) / threads; ++residue) {
+                for(size_t i = residue; i < capacity; i += smaller) {
+                    Node* current = buckets[i];
+                    while(current) {
+                        Node* next = current->next;
+                        size_t newIndex = nodeHash(current, hasher) & (newCapacity - 1);
+                        current->next = newBuckets[newIndex];
+                        newBuckets[newIndex] = current;
+                        current = next;
+                    }
+                }
+            }
+        });
+    } else {
+        // Move all nodes to new buckets
+        for(size_t i = 0; i < capacity; ++i) {
+            Node* current = buckets[i];
+            while(current) {
+                Node* next = current->next;
+                // Calculate new index based on new capacity
+                size_t newIndex = nodeHash(current, hasher) & (newCapacity - 1);
+                // Insert at beginning of new bucket
+                current->next = newBuckets[newIndex];
+                newBuckets[newIndex] = current;
+                current = next;
+            }
         }
     }
 
-    delete[] buckets;
+    if(buckets) {
+        BucketTraits::deallocate(allocator, buckets, capacity);
+    }
 
     // Update capacity and buckets pointer
     capacity = newCapacity;
     buckets = newBuckets;
 }
 
-template<typename K, typename V>
-requires HashMapRequirements<K, V>
-void CeTuHashMap<K, V>::BucketsHolder::clear() {
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::BucketsHolder::clear() {
     if(buckets) {
-        for (size_t i = 0; i < capacity; ++i) {
-            Node* current = buckets[i];
-            while(current) {
-                Node* next = current->next;
-                delete current;
-                current = next;
-            }
-        }
-        delete[] buckets;
+        BucketTraits::deallocate(allocator, buckets, capacity);
         buckets = nullptr;
     }
 }
 
-#endif // CETU_HASHMAP_H
\ No newline at end of file
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::NodePool(NodePool&& other) noexcept :
+    allocator(std::move(other.allocator)), freeList(other.freeList), chunks(other.chunks),
+    nextFree(other.nextFree), chunkEnd(other.chunkEnd), nextChunkBlocks(other.nextChunkBlocks)
+{
+    other.freeList = nullptr;
+    other.chunks = nullptr;
+    other.nextFree = nullptr;
+    other.chunkEnd = nullptr;
+    other.nextChunkBlocks = minChunkBlocks;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool& CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::operator=(NodePool&& other) noexcept {
+    if(this == &other) {
+        return *this;
+    }
+
+    std::swap(allocator, other.allocator);
+    std::swap(freeList, other.freeList);
+    std::swap(chunks, other.chunks);
+    std::swap(nextFree, other.nextFree);
+    std::swap(chunkEnd, other.chunkEnd);
+    std::swap(nextChunkBlocks, other.nextChunkBlocks);
+
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename... Args>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::Node* CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::create(Args&&... args) {
+    Block* block = allocateBlock();
+    Node* node = reinterpret_cast<Node*>(block->storage);
+    try {
+        BlockTraits::construct(allocator, node, std::forward<Args>(args)...);
+    } catch(...) {
+        block->next = freeList;
+        freeList = block;
+        throw;
+    }
+    return node;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::reserve(size_t blocks) {
+    size_t available = static_cast<size_t>(chunkEnd - nextFree);
+    for(Block* block = freeList; block != nullptr && available < blocks; block = block->next) {
+        available++;
+    }
+    if(available >= blocks) {
+        return;
+    }
+
+    // One chunk for everything that is missing, plus its header block
+    size_t chunkBlocks = blocks - available + 1;
+    Block* chunk = BlockTraits::allocate(allocator, chunkBlocks);
+    ::new(static_cast<void*>(chunk)) ChunkHeader{chunks, chunkBlocks};
+    chunks = chunk;
+
+    // Keep the remainder of the previous chunk usable through the free list
+    while(nextFree != chunkEnd) {
+        Block* block = nextFree++;
+        block->next = freeList;
+        freeList = block;
+    }
+    nextFree = chunk + 1;
+    chunkEnd = chunk + chunkBlocks;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::destroy(Node* node) noexcept {
+    BlockTraits::destroy(allocator, node);
+    Block* block = reinterpret_cast<Block*>(node);
+    block->next = freeList;
+    freeList = block;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::release() noexcept {
+    while(chunks) {
+        ChunkHeader* header = std::launder(reinterpret_cast<ChunkHeader*>(chunks));
+        Block* next = header->nextChunk;
+        BlockTraits::deallocate(allocator, chunks, header->blocks);
+        chunks = next;
+    }
+    freeList = nullptr;
+    nextFree = nullptr;
+    chunkEnd = nullptr;
+    nextChunkBlocks = minChunkBlocks;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::adopt(NodePool& other) noexcept {
+    if(this == &other || other.chunks == nullptr) {
+        return;
+    }
+
+    // The unused rest of other's newest chunk stays available through the free list
+    while(other.nextFree != other.chunkEnd) {
+        Block* block = other.nextFree++;
+        block->next = other.freeList;
+        other.freeList = block;
+    }
+    if(other.freeList) {
+        Block* lastFree = other.freeList;
+        while(lastFree->next) {
+            lastFree = lastFree->next;
+        }
+        lastFree->next = freeList;
+        freeList = other.freeList;
+    }
+
+    ChunkHeader* lastChunk = std::launder(reinterpret_cast<ChunkHeader*>(other.chunks));
+    while(lastChunk->nextChunk) {
+        lastChunk = std::launder(reinterpret_cast<ChunkHeader*>(lastChunk->nextChunk));
+    }
+    lastChunk->nextChunk = chunks;
+    chunks = other.chunks;
+
+    other.freeList = nullptr;
+    other.chunks = nullptr;
+    other.nextFree = nullptr;
+    other.chunkEnd = nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+size_t CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::allocatedBytes() const noexcept {
+    size_t blocks = 0;
+    for(Block* chunk = chunks; chunk != nullptr;) {
+        const ChunkHeader* header = std::launder(reinterpret_cast<const ChunkHeader*>(chunk));
+        blocks += header->blocks;
+        chunk = header->nextChunk;
+    }
+    return blocks * sizeof(Block);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::Block* CeTuHashMap<K, V, Hash, KeyEqual, Allocator>::NodePool::allocateBlock() {
+    if(freeList) {
+        Block* block = freeList;
+        freeList = block->next;
+        return block;
+    }
+
+    if(nextFree == chunkEnd) {
+        // Chunks grow geometrically; the first block of each one is its header
+        Block* chunk = BlockTraits::allocate(allocator, nextChunkBlocks);
+        ::new(static_cast<void*>(chunk)) ChunkHeader{chunks, nextChunkBlocks};
+        chunks = chunk;
+        nextFree = chunk + 1;
+        chunkEnd = chunk + nextChunkBlocks;
+        nextChunkBlocks = std::min(nextChunkBlocks * 2, maxChunkBlocks);
+    }
+
+    return nextFree++;
+}
+
+#endif // CETU_HASHMAP_H
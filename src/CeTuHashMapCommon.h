@@ -0,0 +1,248 @@
+#ifndef CETU_HASHMAP_COMMON_H
+#define CETU_HASHMAP_COMMON_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+template <typename K, typename Hash = std::hash<K>>
+concept Hashable = std::is_default_constructible_v<Hash> && requires(const Hash& hash, const K& key) {
+    { hash(key) } -> std::convertible_to<size_t>;
+};
+
+template <typename K, typename KeyEqual = std::equal_to<K>>
+concept EqualityComparable = std::is_default_constructible_v<KeyEqual> && requires(const KeyEqual& equal, const K& a, const K& b) {
+    { equal(a, b) } -> std::convertible_to<bool>;
+};
+
+template <typename K, typename V>
+concept CopyAssignableAndConstructible =
+    std::is_copy_constructible_v<K> && std::is_copy_assignable_v<K> &&
+    std::is_copy_constructible_v<V> && std::is_copy_assignable_v<V>;
+
+// Move-only keys and values (e.g. std::unique_ptr) are allowed; copying a map additionally
+// requires CopyAssignableAndConstructible.
+template <typename K, typename V>
+concept MoveAssignableAndConstructible =
+    std::is_move_constructible_v<K> && std::is_move_assignable_v<K> &&
+    std::is_move_constructible_v<V> && std::is_move_assignable_v<V>;
+
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+concept HashMapRequirements = Hashable<K, Hash> && EqualityComparable<K, KeyEqual> && MoveAssignableAndConstructible<K, V>;
+
+// Keys and values that can be relocated with memcpy and need no destructor call, which the
+// dense engine (CeTuDenseHashMap) relies on
+template <typename K, typename V>
+concept TriviallyCopyableKeyValue = std::is_trivially_copyable_v<K> && std::is_trivially_destructible_v<K> &&
+    std::is_trivially_copyable_v<V> && std::is_trivially_destructible_v<V>;
+
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+concept DenseHashMapRequirements = HashMapRequirements<K, V, Hash, KeyEqual> && TriviallyCopyableKeyValue<K, V>;
+
+// When both Hash and KeyEqual declare `using is_transparent = void;`, lookups accept any Q
+// they can hash and compare against K, e.g. std::string_view or const char* for std::string
+// keys, without constructing a temporary K. Hash must return the same value for Q and K.
+template<typename Q, typename K, typename Hash, typename KeyEqual>
+concept TransparentKey = requires(const Hash& hash, const KeyEqual& equal, const Q& query, const K& key) {
+    typename Hash::is_transparent;
+    typename KeyEqual::is_transparent;
+    { hash(query) } -> std::convertible_to<size_t>;
+    { equal(key, query) } -> std::convertible_to<bool>;
+};
+
+// Transparent hash for std::string keys; use together with std::equal_to<>
+struct CeTuStringHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+};
+
+// A hash function declaring `using is_avalanching = void;` promises that every output bit
+// depends on every input bit, so the maps use its result as is. Any other hash (such as
+// the identity std::hash<int> of libstdc++) is passed through CeTuDetail::mix first.
+template <typename Hash>
+concept AvalanchingHash = requires {
+    typename Hash::is_avalanching;
+};
+
+// Whether the maps keep every entry's hash next to it, so that growing never calls Hash
+// again and keys are only compared once their hashes match. On by default for keys that
+// are not trivially copyable, such as std::string; specialize to override.
+template<typename K>
+struct CeTuStoreHash : std::bool_constant<!std::is_trivially_copyable_v<K>> {};
+
+namespace CeTuDetail {
+
+// Alignment that keeps independently written data on separate cache lines. Fixed rather
+// than std::hardware_destructive_interference_size, whose value may differ between builds.
+inline constexpr size_t cacheLineSize = 64;
+
+// wyhash-style finalizer: 64x64->128 bit multiply folded back to 64 bits
+inline uint64_t mix(uint64_t h) {
+    const uint64_t a = h ^ 0xa0761d6478bd642fULL;
+    const uint64_t b = 0xe7037ed1a0b428dbULL;
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+    const uint64_t aLo = a & 0xffffffffULL, aHi = a >> 32;
+    const uint64_t bLo = b & 0xffffffffULL, bHi = b >> 32;
+    const uint64_t lolo = aLo * bLo, lohi = aLo * bHi, hilo = aHi * bLo, hihi = aHi * bHi;
+    const uint64_t cross = (lolo >> 32) + (lohi & 0xffffffffULL) + hilo;
+    const uint64_t lo = (cross << 32) | (lolo & 0xffffffffULL);
+    const uint64_t hi = hihi + (lohi >> 32) + (cross >> 32);
+    return lo ^ hi;
+#endif
+}
+
+// Smallest power-of-two capacity, not below minCapacity, that keeps elements entries
+// within loadFactor
+inline size_t capacityFor(size_t elements, double loadFactor, size_t minCapacity) {
+    size_t needed = static_cast<size_t>(std::ceil(static_cast<double>(elements) / loadFactor));
+    return std::bit_ceil(std::max(needed, minCapacity));
+}
+
+// Hints that address is about to be read
+inline void prefetch(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 3);
+#else
+    (void)address;
+#endif
+}
+
+template<typename Hash, typename Key>
+uint64_t hashKey(const Hash& hasher, const Key& key) {
+    if constexpr (AvalanchingHash<Hash>) {
+        return static_cast<uint64_t>(hasher(key));
+    } else {
+        return mix(static_cast<uint64_t>(hasher(key)));
+    }
+}
+
+// Seed for a new map. Only the first call reads std::random_device; the following ones
+// step a global counter, so constructing a map stays cheap.
+inline uint64_t randomSeed() {
+    static const uint64_t base = (static_cast<uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}();
+    static std::atomic<uint64_t> counter{0};
+    return mix(base + counter.fetch_add(1, std::memory_order_relaxed) * 0x9E3779B97F4A7C15ULL);
+}
+
+// Hash with a seed of its own, drawn when it is constructed and kept by copies, that is
+// xor-ed into the result of Hash before mix. Keys sent to one bucket on purpose therefore
+// only collide if their Hash values are equal. An AvalanchingHash is trusted to be keyed
+// already and used as is, without a seed.
+template<typename Hash>
+struct SeededHash {
+    using is_avalanching = void;
+
+    [[no_unique_address]] Hash hash;
+    uint64_t seed = AvalanchingHash<Hash> ? 0 : randomSeed();
+
+    template<typename Q>
+    uint64_t operator()(const Q& key) const {
+        if constexpr (AvalanchingHash<Hash>) {
+            return static_cast<uint64_t>(hash(key));
+        } else {
+            return mix(static_cast<uint64_t>(hash(key)) ^ seed);
+        }
+    }
+};
+
+// Hash stored in an entry when CeTuStoreHash is set; otherwise empty and every hash matches
+template<bool Enabled>
+struct StoredHash {
+    void set(size_t) {}
+    bool mayMatch(size_t) const { return true; }
+};
+
+template<>
+struct StoredHash<true> {
+    size_t value = 0;
+
+    void set(size_t hash) { value = hash; }
+    bool mayMatch(size_t hash) const { return value == hash; }
+};
+
+} // namespace CeTuDetail
+
+// Returned by stats() of CeTuHashMap and CeTuFlatHashMap, which only exists when
+// CETU_HASHMAP_STATS is defined. Only the rehash counters are kept up to date by the
+// maps; everything else is gathered by walking the table when stats() is called.
+struct CeTuHashMapStats {
+    size_t size = 0;
+    size_t bucketCount = 0;
+    float loadFactor = 0.0f;
+    // probeLengths[i] entries are reached on the (i + 1)-th node of their chain, or in the
+    // (i + 1)-th group probed for the flat engine. A bad hash shows up as a long tail.
+    std::vector<size_t> probeLengths;
+    size_t longestProbe = 0;
+    // Largest distance in slots between an entry and its home slot, for the open
+    // addressing engines
+    size_t maxDisplacement = 0;
+    size_t rehashCount = 0;
+    // Time spent relinking or moving entries on growth, rehash and incremental migration
+    std::chrono::nanoseconds rehashTime{0};
+    // Bucket arrays or control bytes
+    size_t bucketBytes = 0;
+    // Node slabs or slot array
+    size_t entryBytes = 0;
+    // Erased slots not reclaimed yet; always 0 for the chained engine
+    size_t tombstones = 0;
+    // Entries moved out of overlong chains into the overflow tree of the chained engine;
+    // they are not part of probeLengths. Always 0 for the flat engine.
+    size_t overflowEntries = 0;
+};
+
+#ifdef CETU_HASHMAP_STATS
+namespace CeTuDetail {
+
+struct RehashCounters {
+    size_t count = 0;
+    std::chrono::nanoseconds time{0};
+};
+
+// Adds the time until its destruction to counters, counting one rehash if countRehash
+class RehashTimer {
+public:
+    RehashTimer(RehashCounters& _counters, bool countRehash) : counters(_counters), start(std::chrono::steady_clock::now()) {
+        if(countRehash) {
+            ++counters.count;
+        }
+    }
+    ~RehashTimer() { counters.time += std::chrono::steady_clock::now() - start; }
+
+    RehashTimer(const RehashTimer&) = delete;
+    RehashTimer& operator=(const RehashTimer&) = delete;
+
+private:
+    RehashCounters& counters;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Records entries reached after length probes
+inline void addProbe(CeTuHashMapStats& stats, size_t length) {
+    if(stats.probeLengths.size() < length) {
+        stats.probeLengths.resize(length);
+    }
+    ++stats.probeLengths[length - 1];
+    stats.longestProbe = std::max(stats.longestProbe, length);
+}
+
+} // namespace CeTuDetail
+
+#define CETU_HASHMAP_REHASH_TIMER(counters, countRehash) CeTuDetail::RehashTimer rehashTimer(counters, countRehash)
+#else
+#define CETU_HASHMAP_REHASH_TIMER(counters, countRehash)
+#endif
+
+#endif // CETU_HASHMAP_COMMON_H
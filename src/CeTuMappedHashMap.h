@@ -0,0 +1,412 @@
+#ifndef CETU_MAPPED_HASHMAP_H
+#define CETU_MAPPED_HASHMAP_H
+
+#include "CeTuGroup.h"
+#include "CeTuHashMapCommon.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <typeinfo>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Identifies Hash in snapshot headers, so that a file is never probed with another hash
+// function. The default is derived from the type name and thus only stable within one
+// toolchain; specialize it with a fixed value to share snapshots between builds.
+template<typename Hash>
+struct CeTuSnapshotHashId {
+    static uint64_t value() {
+        // FNV-1a
+        uint64_t id = 0xcbf29ce484222325ULL;
+        for(const char* c = typeid(Hash).name(); *c; ++c) {
+            id = (id ^ static_cast<unsigned char>(*c)) * 0x100000001b3ULL;
+        }
+        return id;
+    }
+};
+
+namespace CeTuDetail {
+
+// How a key or value type is laid out in a snapshot. Stored is written into the slot as
+// is, View is what lookups hand out.
+template<typename T>
+struct SnapshotField;
+
+template<typename T>
+requires std::is_trivially_copyable_v<T>
+struct SnapshotField<T> {
+    using Stored = T;
+    using View = T;
+    static constexpr uint32_t kind = 1;
+
+    static Stored store(const T& value, std::vector<char>&) { return value; }
+    static View load(const Stored& stored, const char*, size_t) { return stored; }
+};
+
+// Strings live in one area after the slots and are referenced by offset and length
+template<>
+struct SnapshotField<std::string> {
+    struct Stored {
+        uint64_t offset;
+        uint64_t length;
+    };
+    using View = std::string_view;
+    static constexpr uint32_t kind = 2;
+
+    static Stored store(const std::string& value, std::vector<char>& strings) {
+        Stored stored{strings.size(), value.size()};
+        strings.insert(strings.end(), value.begin(), value.end());
+        return stored;
+    }
+    static View load(const Stored& stored, const char* strings, size_t stringsSize) {
+        if(stored.offset > stringsSize || stored.length > stringsSize - stored.offset) {
+            throw std::runtime_error("CeTuMappedHashMap: string outside of the snapshot");
+        }
+        return View(strings + stored.offset, stored.length);
+    }
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    // Written as 0x01020304; reads back differently on a machine of the other byte order
+    uint32_t byteOrder;
+    uint64_t hashId;
+    uint32_t keyKind;
+    uint32_t valueKind;
+    uint64_t keySize;
+    uint64_t valueSize;
+    uint64_t recordSize;
+    uint64_t capacity;
+    uint64_t size;
+    uint64_t controlOffset;
+    uint64_t slotsOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+} // namespace CeTuDetail
+
+template<typename T>
+concept Snapshottable = requires { typename CeTuDetail::SnapshotField<T>::Stored; };
+
+// Read-only view of a snapshot file written by save(). open() maps the file and lookups
+// probe the mapped pages directly, so nothing is deserialized and untouched pages are never
+// read. Keys and values must be trivially copyable or std::string; string values are
+// returned as std::string_view into the mapping and stay valid while the view exists.
+// The file holds a header (format version, hash id, layout and capacity), the control
+// bytes, the slot records and the string area. Slots are filled by linear probing one slot
+// at a time, so the file reads the same whatever group width the reader was built with.
+// Only POSIX systems are supported.
+template<typename K, typename V, typename Hash = std::hash<K>>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+class CeTuMappedHashMap final {
+    using KeyField = CeTuDetail::SnapshotField<K>;
+    using ValueField = CeTuDetail::SnapshotField<V>;
+
+public:
+    using ValueView = typename ValueField::View;
+
+    static constexpr uint32_t formatVersion = 1;
+
+    // Writes every entry of map, which must provide size() and for_each(), to path. The
+    // file is written next to path first and renamed over it once complete.
+    template<typename Map>
+    static void save(const Map& map, const std::filesystem::path& path);
+    static CeTuMappedHashMap open(const std::filesystem::path& path);
+
+    ~CeTuMappedHashMap() noexcept;
+
+    // Disable copying
+    CeTuMappedHashMap(const CeTuMappedHashMap&) = delete;
+    CeTuMappedHashMap& operator=(const CeTuMappedHashMap&) = delete;
+
+    // Enable moving
+    CeTuMappedHashMap(CeTuMappedHashMap&& other) noexcept;
+    CeTuMappedHashMap& operator=(CeTuMappedHashMap&& other) noexcept;
+
+    std::optional<ValueView> lookup(const K& key) const;
+    bool contains(const K& key) const { return findRecord(key).has_value(); }
+    size_t size() const { return header.size; }
+    size_t bucket_count() const { return header.capacity; }
+
+private:
+    using ctrl_t = CeTuDetail::ctrl_t;
+    using Group = CeTuDetail::Group;
+
+    struct Record {
+        typename KeyField::Stored key;
+        typename ValueField::Stored value;
+    };
+    static_assert(std::is_trivially_copyable_v<Record>);
+
+    static constexpr char magic[8] = {'C', 'E', 'T', 'U', 'S', 'N', 'A', 'P'};
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+    // Control bytes are padded by the widest group, so that every build can load a group
+    // at any slot
+    static constexpr size_t controlPadding = 32;
+    static_assert(Group::kWidth <= controlPadding);
+    static constexpr size_t minCapacity = 32;
+    static constexpr float maxLoadFactor = 0.75f;
+    static constexpr size_t sectionAlignment = 64;
+
+    const char* base;
+    size_t length;
+    CeTuDetail::SnapshotHeader header;
+    [[no_unique_address]] Hash hasher;
+
+    CeTuMappedHashMap(const char* _base, size_t _length, const CeTuDetail::SnapshotHeader& _header) :
+        base(_base), length(_length), header(_header) {}
+
+    static size_t h1(size_t hash) { return hash >> 7; }
+    static ctrl_t h2(size_t hash) { return static_cast<ctrl_t>(hash & 0x7F); }
+    static uint64_t alignUp(uint64_t offset) { return (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment; }
+    // Throws unless header describes a file of this type that fits into fileLength bytes
+    static void validate(const CeTuDetail::SnapshotHeader& header, size_t fileLength);
+
+    const ctrl_t* control() const { return reinterpret_cast<const ctrl_t*>(base + header.controlOffset); }
+    const char* strings() const { return base + header.stringsOffset; }
+    Record record(size_t index) const;
+    std::optional<Record> findRecord(const K& key) const;
+};
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+template<typename Map>
+void CeTuMappedHashMap<K, V, Hash>::save(const Map& map, const std::filesystem::path& path) {
+    const size_t capacity = CeTuDetail::capacityFor(map.size(), maxLoadFactor, minCapacity);
+    const size_t mask = capacity - 1;
+    const Hash hasher;
+
+    std::vector<ctrl_t> ctrl(capacity + controlPadding, CeTuDetail::kEmpty);
+    std::vector<Record> records(capacity);
+    std::vector<char> stringArea;
+    size_t size = 0;
+    map.for_each([&](const K& key, const V& value) {
+        size_t keyHash = CeTuDetail::hashKey(hasher, key);
+        size_t index = h1(keyHash) & mask;
+        while(ctrl[index] != CeTuDetail::kEmpty) {
+            index = (index + 1) & mask;
+        }
+        ctrl[index] = h2(keyHash);
+        // Assigned member by member so that the zeroed padding is written as is
+        records[index].key = KeyField::store(key, stringArea);
+        records[index].value = ValueField::store(value, stringArea);
+        size++;
+    });
+    // Mirror the first control bytes after the last one
+    for(size_t i = 0; i < controlPadding; ++i) {
+        ctrl[capacity + i] = ctrl[i & mask];
+    }
+
+    CeTuDetail::SnapshotHeader header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = formatVersion;
+    header.byteOrder = byteOrderMark;
+    header.hashId = CeTuSnapshotHashId<Hash>::value();
+    header.keyKind = KeyField::kind;
+    header.valueKind = ValueField::kind;
+    header.keySize = sizeof(typename KeyField::Stored);
+    header.valueSize = sizeof(typename ValueField::Stored);
+    header.recordSize = sizeof(Record);
+    header.capacity = capacity;
+    header.size = size;
+    header.controlOffset = alignUp(sizeof(header));
+    header.slotsOffset = alignUp(header.controlOffset + ctrl.size());
+    header.stringsOffset = header.slotsOffset + capacity * sizeof(Record);
+    header.stringsSize = stringArea.size();
+
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        auto writeAt = [&out](uint64_t offset, const void* data, size_t bytes) {
+            static const char zeros[sectionAlignment] = {};
+            while(static_cast<uint64_t>(out.tellp()) < offset) {
+                out.write(zeros, std::min<uint64_t>(sizeof(zeros), offset - static_cast<uint64_t>(out.tellp())));
+            }
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+        };
+        writeAt(0, &header, sizeof(header));
+        writeAt(header.controlOffset, ctrl.data(), ctrl.size());
+        writeAt(header.slotsOffset, records.data(), records.size() * sizeof(Record));
+        writeAt(header.stringsOffset, stringArea.data(), stringArea.size());
+        out.flush();
+        if(!out) {
+            throw std::runtime_error("CeTuMappedHashMap: cannot write " + temporary.string());
+        }
+    }
+    std::filesystem::rename(temporary, path);
+}
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+CeTuMappedHashMap<K, V, Hash> CeTuMappedHashMap<K, V, Hash>::open(const std::filesystem::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "CeTuMappedHashMap: cannot open " + path.string());
+    }
+
+    struct stat info;
+    if(::fstat(fd, &info) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "CeTuMappedHashMap: cannot stat " + path.string());
+    }
+    const size_t fileLength = static_cast<size_t>(info.st_size);
+    if(fileLength < sizeof(CeTuDetail::SnapshotHeader)) {
+        ::close(fd);
+        throw std::runtime_error("CeTuMappedHashMap: " + path.string() + " is not a snapshot");
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    void* mapped = ::mmap(nullptr, fileLength, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if(mapped == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(), "CeTuMappedHashMap: cannot map " + path.string());
+    }
+
+    CeTuDetail::SnapshotHeader header;
+    std::memcpy(&header, mapped, sizeof(header));
+    try {
+        validate(header, fileLength);
+    } catch(...) {
+        ::munmap(mapped, fileLength);
+        throw;
+    }
+    return CeTuMappedHashMap(static_cast<const char*>(mapped), fileLength, header);
+}
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+void CeTuMappedHashMap<K, V, Hash>::validate(const CeTuDetail::SnapshotHeader& header, size_t fileLength) {
+    auto fail = [](const char* reason) {
+        throw std::runtime_error(std::string("CeTuMappedHashMap: ") + reason);
+    };
+
+    if(std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        fail("not a snapshot");
+    }
+    if(header.byteOrder != byteOrderMark) {
+        fail("snapshot written with another byte order");
+    }
+    if(header.version != formatVersion) {
+        fail("unsupported snapshot version");
+    }
+    if(header.hashId != CeTuSnapshotHashId<Hash>::value()) {
+        fail("snapshot written with another hash function");
+    }
+    if(header.keyKind != KeyField::kind || header.valueKind != ValueField::kind ||
+       header.keySize != sizeof(typename KeyField::Stored) || header.valueSize != sizeof(typename ValueField::Stored) ||
+       header.recordSize != sizeof(Record)) {
+        fail("snapshot written for other key or value types");
+    }
+    if(header.capacity < minCapacity || !std::has_single_bit(header.capacity) || header.size >= header.capacity ||
+       header.capacity > fileLength / sizeof(Record)) {
+        fail("corrupt snapshot capacity");
+    }
+    if(header.controlOffset > fileLength || header.slotsOffset > fileLength || header.stringsOffset > fileLength) {
+        fail("truncated or corrupt snapshot");
+    }
+    if(header.controlOffset < sizeof(header) || header.slotsOffset < header.controlOffset + header.capacity + controlPadding ||
+       header.stringsOffset < header.slotsOffset + header.capacity * sizeof(Record) ||
+       header.stringsSize > fileLength - header.stringsOffset || header.slotsOffset % alignof(Record) != 0) {
+        fail("truncated or corrupt snapshot");
+    }
+}
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+CeTuMappedHashMap<K, V, Hash>::~CeTuMappedHashMap() noexcept {
+    if(base) {
+        ::munmap(const_cast<char*>(base), length);
+    }
+}
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+CeTuMappedHashMap<K, V, Hash>::CeTuMappedHashMap(CeTuMappedHashMap&& other) noexcept :
+    base(other.base), length(other.length), header(other.header), hasher(std::move(other.hasher)) {
+    other.base = nullptr;
+    other.length = 0;
+}
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+CeTuMappedHashMap<K, V, Hash>& CeTuMappedHashMap<K, V, Hash>::operator=(CeTuMappedHashMap&& other) noexcept {
+    if(this == &other) {
+        return *this;
+    }
+
+    std::swap(base, other.base);
+    std::swap(length, other.length);
+    std::swap(header, other.header);
+    std::swap(hasher, other.hasher);
+
+    return *this;
+}
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+std::optional<typename CeTuMappedHashMap<K, V, Hash>::ValueView> CeTuMappedHashMap<K, V, Hash>::lookup(const K& key) const {
+    if(std::optional<Record> found = findRecord(key)) {
+        return ValueField::load(found->value, strings(), header.stringsSize);
+    }
+
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+CeTuMappedHashMap<K, V, Hash>::Record CeTuMappedHashMap<K, V, Hash>::record(size_t index) const {
+    // Copied out rather than cast in place, the mapping holds no Record objects
+    Record result;
+    std::memcpy(&result, base + header.slotsOffset + index * sizeof(Record), sizeof(Record));
+    return result;
+}
+
+template<typename K, typename V, typename Hash>
+requires Snapshottable<K> && Snapshottable<V> && Hashable<K, Hash>
+std::optional<typename CeTuMappedHashMap<K, V, Hash>::Record> CeTuMappedHashMap<K, V, Hash>::findRecord(const K& key) const {
+    const size_t keyHash = CeTuDetail::hashKey(hasher, key);
+    const size_t mask = header.capacity - 1;
+    const ctrl_t fragment = h2(keyHash);
+    const typename KeyField::View wanted(key);
+
+    // A key sits before the first empty slot after its home slot, so only matches ahead of
+    // that empty slot count
+    size_t pos = h1(keyHash) & mask;
+    for(size_t probed = 0; probed < header.capacity; probed += Group::kWidth) {
+        Group group(control() + pos);
+        auto empty = group.maskEmpty();
+        const int limit = empty ? empty.lowest() : static_cast<int>(Group::kWidth);
+        for(int i : group.match(fragment)) {
+            if(i >= limit) {
+                break;
+            }
+            Record candidate = record((pos + i) & mask);
+            if(KeyField::load(candidate.key, strings(), header.stringsSize) == wanted) {
+                return candidate;
+            }
+        }
+        if(empty) {
+            break;
+        }
+        pos = (pos + Group::kWidth) & mask;
+    }
+
+    return std::nullopt;
+}
+
+#endif // CETU_MAPPED_HASHMAP_H
@@ -0,0 +1,242 @@
+#ifndef CETU_NUMA_H
+#define CETU_NUMA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Where CeTuNumaAllocator places the pages of its large allocations
+enum class CeTuNumaPolicy {
+    // On the node of the thread that first writes them, the kernel default. Pairs with
+    // CeTuHashMap::build_from, whose threads initialize the buckets and nodes they fill;
+    // pass it CeTuNumaSpread to pin those threads to the nodes.
+    FirstTouch,
+    // Spread page by page over all nodes, so that every node sees the same average latency
+    // and the map is not limited by the memory bandwidth of one node
+    Interleave,
+    // On one given node, falling back to others once it is full
+    OnNode
+};
+
+namespace CeTuDetail {
+
+// Parses a sysfs node or CPU list such as "0-3,6"
+inline std::vector<size_t> parseNodeList(const std::string& list) {
+    std::vector<size_t> nodes;
+    size_t pos = 0;
+    while(pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if(end == std::string::npos) {
+            end = list.size();
+        }
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        try {
+            size_t first = std::stoul(range.substr(0, dash));
+            size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for(size_t node = first; node <= last; ++node) {
+                nodes.push_back(node);
+            }
+        } catch(const std::exception&) {
+            return {};
+        }
+        pos = end + 1;
+    }
+    return nodes;
+}
+
+// Ids of the online NUMA nodes, {0} when the system does not report any
+inline const std::vector<size_t>& numaNodes() {
+    static const std::vector<size_t> nodes = [] {
+        std::ifstream in("/sys/devices/system/node/online");
+        std::string list;
+        std::getline(in, list);
+        std::vector<size_t> parsed = parseNodeList(list);
+        return parsed.empty() ? std::vector<size_t>{0} : parsed;
+    }();
+    return nodes;
+}
+
+// Node of the CPU the calling thread runs on; the thread may migrate right after
+inline size_t currentNumaNode() {
+#ifdef __linux__
+    unsigned cpu = 0;
+    unsigned node = 0;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+    // Answered by the vDSO, without entering the kernel
+    if(getcpu(&cpu, &node) == 0) {
+        return node;
+    }
+#else
+    if(syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return node;
+    }
+#endif
+#endif
+    return 0;
+}
+
+// Applies policy to the pages of [address, address + bytes). Placement is only a hint:
+// where the kernel refuses it, the pages keep the default policy. On a single node every
+// policy ends up on that node, but it is still applied so that it can be checked.
+inline void placePages(void* address, size_t bytes, CeTuNumaPolicy policy, size_t node) {
+#ifdef __linux__
+    // Values of MPOL_PREFERRED and MPOL_INTERLEAVE in <linux/mempolicy.h>
+    constexpr int preferred = 1;
+    constexpr int interleave = 3;
+    constexpr size_t maskBits = 1024;
+    constexpr size_t wordBits = 8 * sizeof(unsigned long);
+    if(policy == CeTuNumaPolicy::FirstTouch) {
+        return;
+    }
+
+    unsigned long mask[maskBits / wordBits] = {};
+    if(policy == CeTuNumaPolicy::Interleave) {
+        for(size_t id : numaNodes()) {
+            if(id < maskBits) {
+                mask[id / wordBits] |= 1ul << (id % wordBits);
+            }
+        }
+    } else if(node < maskBits) {
+        mask[node / wordBits] |= 1ul << (node % wordBits);
+    }
+    syscall(SYS_mbind, address, bytes, policy == CeTuNumaPolicy::Interleave ? interleave : preferred, mask, maskBits + 1, 0);
+#else
+    (void)address;
+    (void)bytes;
+    (void)policy;
+    (void)node;
+#endif
+}
+
+// Restricts the calling thread to the CPUs of node; returns false where that is not possible
+inline bool pinToNode(size_t node) {
+#ifdef __linux__
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    std::getline(in, list);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    bool any = false;
+    for(size_t cpu : parseNodeList(list)) {
+        if(cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpus);
+            any = true;
+        }
+    }
+    return any && sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+} // namespace CeTuDetail
+
+// Thread hook for CeTuHashMap::build_from: pins builder thread t to the (t mod N)-th of
+// the N online nodes while it links its bucket range, then restores the affinity it had,
+// which matters for the range run on the calling thread
+struct CeTuNumaSpread {
+    class Pin {
+    public:
+        explicit Pin(size_t node) {
+#ifdef __linux__
+            saved = sched_getaffinity(0, sizeof(previous), &previous) == 0;
+#endif
+            CeTuDetail::pinToNode(node);
+        }
+        ~Pin() {
+#ifdef __linux__
+            if(saved) {
+                sched_setaffinity(0, sizeof(previous), &previous);
+            }
+#endif
+        }
+
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+
+    private:
+#ifdef __linux__
+        cpu_set_t previous;
+        bool saved = false;
+#endif
+    };
+
+    Pin operator()(size_t thread) const {
+        const std::vector<size_t>& nodes = CeTuDetail::numaNodes();
+        return Pin(nodes[thread % nodes.size()]);
+    }
+};
+
+// Allocator placing large blocks (bucket arrays, node slabs) according to a CeTuNumaPolicy.
+// Blocks of at least mapThreshold bytes, a page, are mapped from the kernel with their own
+// memory policy; smaller ones come from operator new and land wherever the thread
+// allocating them runs. Allocators with the same policy and node compare equal, so maps
+// using them can adopt each other's nodes.
+template<typename T>
+class CeTuNumaAllocator {
+public:
+    using value_type = T;
+
+    static constexpr size_t mapThreshold = 4096;
+
+    // node is only used by CeTuNumaPolicy::OnNode
+    CeTuNumaAllocator(CeTuNumaPolicy _policy = CeTuNumaPolicy::Interleave, size_t _node = 0) noexcept : policyValue(_policy), nodeValue(_node) {}
+    template<typename U>
+    CeTuNumaAllocator(const CeTuNumaAllocator<U>& other) noexcept : policyValue(other.policy()), nodeValue(other.node()) {}
+
+    T* allocate(size_t n);
+    void deallocate(T* p, size_t n) noexcept;
+
+    CeTuNumaPolicy policy() const { return policyValue; }
+    size_t node() const { return nodeValue; }
+
+    template<typename U>
+    bool operator==(const CeTuNumaAllocator<U>& other) const { return policyValue == other.policy() && nodeValue == other.node(); }
+
+private:
+    CeTuNumaPolicy policyValue;
+    size_t nodeValue;
+};
+
+template<typename T>
+T* CeTuNumaAllocator<T>::allocate(size_t n) {
+    if(n > SIZE_MAX / sizeof(T)) {
+        throw std::bad_array_new_length();
+    }
+    size_t bytes = n * sizeof(T);
+    if(bytes < mapThreshold) {
+        return static_cast<T*>(::operator new(bytes, std::align_val_t(alignof(T))));
+    }
+
+    // Mapped pages are not backed until first written, so the policy decides their node
+    void* address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(address == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    CeTuDetail::placePages(address, bytes, policyValue, nodeValue);
+    return static_cast<T*>(address);
+}
+
+template<typename T>
+void CeTuNumaAllocator<T>::deallocate(T* p, size_t n) noexcept {
+    size_t bytes = n * sizeof(T);
+    if(bytes < mapThreshold) {
+        ::operator delete(p, std::align_val_t(alignof(T)));
+    } else {
+        munmap(p, bytes);
+    }
+}
+
+#endif // CETU_NUMA_H
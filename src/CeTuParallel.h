@@ -0,0 +1,48 @@
+#ifndef CETU_PARALLEL_H
+#define CETU_PARALLEL_H
+
+#include <exception>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace CeTuDetail {
+
+// Runs body(0) .. body(threads - 1) concurrently, the last one on the calling thread. A
+// part whose thread cannot be started runs on the calling thread instead. Once every part
+// has finished, the first exception thrown by body is rethrown.
+template<typename F>
+void parallelFor(size_t threads, F&& body) {
+    std::vector<std::exception_ptr> failures(threads);
+    auto run = [&body, &failures](size_t part) {
+        try {
+            body(part);
+        } catch(...) {
+            failures[part] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for(size_t part = 0; part + 1 < threads; ++part) {
+        try {
+            workers.emplace_back(run, part);
+        } catch(const std::system_error&) {
+            run(part);
+        }
+    }
+    run(threads - 1);
+
+    for(std::thread& worker : workers) {
+        worker.join();
+    }
+    for(const std::exception_ptr& failure : failures) {
+        if(failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+}
+
+} // namespace CeTuDetail
+
+#endif // CETU_PARALLEL_H
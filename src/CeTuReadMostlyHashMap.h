@@ -0,0 +1,288 @@
+#ifndef CETU_READ_MOSTLY_HASHMAP_H
+#define CETU_READ_MOSTLY_HASHMAP_H
+
+#include "CeTuHashMapCommon.h"
+
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+// Thread-safe map for read-mostly data such as configuration or routing tables.
+// Readers never lock: lookup announces itself on a striped reader counter and walks the
+// chains through atomic pointers, so it finishes in a bounded number of steps whatever the
+// writers do. Writers are serialized by a mutex. Published nodes are never modified: an
+// update or erase swaps in a replacement (or unlinks the node), and a resize copies the
+// nodes into a new bucket array that replaces the old one with a single store. Unlinked
+// nodes and old arrays are freed after a grace period, once every reader that could
+// still see them has left (see synchronize()).
+// Every write waits for that grace period, so writes should be rare.
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+class CeTuReadMostlyHashMap final {
+public:
+    CeTuReadMostlyHashMap() : CeTuReadMostlyHashMap(0) {}
+    // Reserves room for expectedSize entries up front
+    explicit CeTuReadMostlyHashMap(size_t expectedSize);
+    // No reader or writer may be active anymore
+    ~CeTuReadMostlyHashMap() noexcept;
+
+    // Disable copying and moving, other threads may hold references to the map
+    CeTuReadMostlyHashMap(const CeTuReadMostlyHashMap&) = delete;
+    CeTuReadMostlyHashMap& operator=(const CeTuReadMostlyHashMap&) = delete;
+
+    void insert(K key, V value);
+    void erase(const K& key);
+    // Wait-free
+    std::optional<V> lookup(const K& key) const;
+    bool contains(const K& key) const { return visit(key, [](const V&) {}); }
+    // Calls visitor on the stored value without copying it. Wait-free unless visitor blocks;
+    // writers wait for it to return, so it should be short.
+    template<typename F>
+    bool visit(const K& key, F&& visitor) const;
+    size_t size() const { return currentSize.load(std::memory_order_relaxed); }
+
+private:
+    // Published nodes are immutable apart from the link to the next one
+    struct Node {
+        K key;
+        V value;
+        size_t hash;
+        std::atomic<Node*> next;
+
+        Node(const K& k, const V& v, size_t h, Node* n) : key(k), value(v), hash(h), next(n) {}
+        Node(K&& k, V&& v, size_t h, Node* n) : key(std::move(k)), value(std::move(v)), hash(h), next(n) {}
+    };
+
+    struct Table {
+        size_t capacity;
+        std::unique_ptr<std::atomic<Node*>[]> buckets;
+
+        explicit Table(size_t _capacity);
+        // Deletes the table and every node it links
+        static void destroy(Table* table) noexcept;
+    };
+
+    // Readers running in the even and in the odd epoch. Each stripe has a cache line of its
+    // own; its two counters share it, since a thread only ever touches its own stripe.
+    struct alignas(CeTuDetail::cacheLineSize) ReaderStripe {
+        std::atomic<size_t> readers[2] = {0, 0};
+    };
+
+    // Marks the calling thread as a reader for its lifetime
+    class ReadGuard {
+    public:
+        explicit ReadGuard(const CeTuReadMostlyHashMap& map);
+        ~ReadGuard() { counter.fetch_sub(1, std::memory_order_release); }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+    private:
+        std::atomic<size_t>& counter;
+    };
+
+    // Must be a power of two
+    static const size_t defaultSize = 16;
+    static const size_t stripesCount = 64;
+    static constexpr float maxLoadFactor = 0.75f;
+
+    std::atomic<Table*> table;
+    std::atomic<size_t> currentSize;
+    mutable std::atomic<size_t> epoch;
+    mutable ReaderStripe stripes[stripesCount];
+    std::mutex writeMutex;
+    CeTuDetail::SeededHash<Hash> hasher;
+    [[no_unique_address]] KeyEqual keyEqual;
+
+    static size_t stripeIndex();
+    size_t hash(const K& key) const { return CeTuDetail::hashKey(hasher, key); }
+    // Returns the node holding key together with the link pointing to it, or nullptrs
+    std::pair<Node*, std::atomic<Node*>*> findLocked(const Table* current, const K& key, size_t keyHash);
+    // Publishes a copy of every node in a table of newCapacity buckets
+    void resize(size_t newCapacity);
+    // Waits until no reader can still see what was unlinked before the call
+    void synchronize() const;
+};
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::CeTuReadMostlyHashMap(size_t expectedSize) :
+    table(new Table(CeTuDetail::capacityFor(expectedSize, maxLoadFactor, defaultSize))), currentSize(0), epoch(0) {}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::~CeTuReadMostlyHashMap() noexcept {
+    Table::destroy(table.load(std::memory_order_relaxed));
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::insert(K key, V value) {
+    std::lock_guard lock(writeMutex);
+
+    Table* current = table.load(std::memory_order_relaxed);
+    size_t keyHash = hash(key);
+    auto [old, link] = findLocked(current, key, keyHash);
+    if(old != nullptr) {
+        // Readers see either the old node or its complete replacement
+        link->store(new Node(std::move(key), std::move(value), keyHash, old->next.load(std::memory_order_relaxed)));
+        synchronize();
+        delete old;
+        return;
+    }
+
+    if(currentSize.load(std::memory_order_relaxed) + 1 > current->capacity * maxLoadFactor) {
+        resize(current->capacity * 2);
+        current = table.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<Node*>& bucket = current->buckets[keyHash & (current->capacity - 1)];
+    bucket.store(new Node(std::move(key), std::move(value), keyHash, bucket.load(std::memory_order_relaxed)));
+    currentSize.fetch_add(1, std::memory_order_relaxed);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::erase(const K& key) {
+    std::lock_guard lock(writeMutex);
+
+    auto [old, link] = findLocked(table.load(std::memory_order_relaxed), key, hash(key));
+    if(old == nullptr) {
+        return;
+    }
+
+    // Readers already standing on old can still follow its next link
+    link->store(old->next.load(std::memory_order_relaxed));
+    currentSize.fetch_sub(1, std::memory_order_relaxed);
+    synchronize();
+    delete old;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+std::optional<V> CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::lookup(const K& key) const {
+    std::optional<V> result;
+    visit(key, [&result](const V& value) { result.emplace(value); });
+    return result;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+template<typename F>
+bool CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::visit(const K& key, F&& visitor) const {
+    size_t keyHash = hash(key);
+    ReadGuard guard(*this);
+
+    // Sequentially consistent loads pair with the stores in synchronize(): whatever a
+    // writer unlinked before its grace period started is either seen as unlinked here or
+    // waited for by the writer. They cost the same as acquire loads on x86 and ARMv8.
+    const Table* current = table.load();
+    for(const Node* node = current->buckets[keyHash & (current->capacity - 1)].load(); node != nullptr; node = node->next.load()) {
+        if(node->hash == keyHash && keyEqual(node->key, key)) {
+            std::forward<F>(visitor)(node->value);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+size_t CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::stripeIndex() {
+    // Threads are spread over the stripes in the order they first read
+    static std::atomic<size_t> nextIndex{0};
+    thread_local size_t index = nextIndex.fetch_add(1, std::memory_order_relaxed) & (stripesCount - 1);
+    return index;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+std::pair<typename CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::Node*, std::atomic<typename CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::Node*>*>
+CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::findLocked(const Table* current, const K& key, size_t keyHash) {
+    // Only writers change the links, and they hold writeMutex
+    std::atomic<Node*>* link = &current->buckets[keyHash & (current->capacity - 1)];
+    for(Node* node = link->load(std::memory_order_relaxed); node != nullptr; node = link->load(std::memory_order_relaxed)) {
+        if(node->hash == keyHash && keyEqual(node->key, key)) {
+            return {node, link};
+        }
+        link = &node->next;
+    }
+
+    return {nullptr, nullptr};
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::resize(size_t newCapacity) {
+    Table* old = table.load(std::memory_order_relaxed);
+    std::unique_ptr<Table> grown = std::make_unique<Table>(newCapacity);
+
+    // Readers may be walking the old chains, so nodes are copied rather than relinked
+    try {
+        for(size_t i = 0; i < old->capacity; ++i) {
+            for(Node* node = old->buckets[i].load(std::memory_order_relaxed); node != nullptr; node = node->next.load(std::memory_order_relaxed)) {
+                std::atomic<Node*>& bucket = grown->buckets[node->hash & (newCapacity - 1)];
+                bucket.store(new Node(node->key, node->value, node->hash, bucket.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+            }
+        }
+    } catch(...) {
+        Table::destroy(grown.release());
+        throw;
+    }
+
+    table.store(grown.release());
+    synchronize();
+    Table::destroy(old);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::synchronize() const {
+    // New readers join the current epoch. Flipping it and waiting for the previous one to
+    // drain, twice, covers readers of both epochs without waiting for ones that started
+    // after the flip.
+    for(int round = 0; round < 2; ++round) {
+        size_t drained = epoch.fetch_add(1) & 1;
+        for(ReaderStripe& stripe : stripes) {
+            while(stripe.readers[drained].load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::ReadGuard::ReadGuard(const CeTuReadMostlyHashMap& map) :
+    counter(map.stripes[stripeIndex()].readers[map.epoch.load(std::memory_order_relaxed) & 1]) {
+    counter.fetch_add(1);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::Table::Table(size_t _capacity) :
+    capacity(_capacity), buckets(std::make_unique<std::atomic<Node*>[]>(capacity)) {
+    for(size_t i = 0; i < capacity; ++i) {
+        buckets[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuReadMostlyHashMap<K, V, Hash, KeyEqual>::Table::destroy(Table* table) noexcept {
+    for(size_t i = 0; i < table->capacity; ++i) {
+        Node* node = table->buckets[i].load(std::memory_order_relaxed);
+        while(node) {
+            Node* next = node->next.load(std::memory_order_relaxed);
+            delete node;
+            node = next;
+        }
+    }
+    delete table;
+}
+
+#endif // CETU_READ_MOSTLY_HASHMAP_H
@@ -0,0 +1,131 @@
+#ifndef CETU_REPLICATED_HASHMAP_H
+#define CETU_REPLICATED_HASHMAP_H
+
+#include "CeTuConcurrentHashMap.h"
+#include "CeTuNuma.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Thread-safe map for read-heavy data on NUMA machines. Every online node holds a full
+// replica, a CeTuConcurrentHashMap whose shards, buckets and node slabs are placed on that
+// node (CeTuNumaPolicy::OnNode), and lookups read the replica of the node the calling
+// thread runs on, so they never cross the interconnect. Writers are serialized and apply
+// each change to every replica in turn: a write costs one update per node, and until it
+// returns, readers on different nodes may disagree about the key it changes. A write that
+// fails on one replica is undone on those it already changed before the exception
+// propagates; only if undoing a failed erase, which allocates again, fails as well may the
+// replicas still disagree.
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+class CeTuReplicatedHashMap final {
+public:
+    using Allocator = CeTuNumaAllocator<std::pair<const K, V>>;
+    using Replica = CeTuConcurrentHashMap<K, V, Hash, KeyEqual, Allocator>;
+
+    // One replica per online node, each split into shardCount shards
+    explicit CeTuReplicatedHashMap(size_t shardCount = defaultShardCount);
+
+    // Disable copying and moving, other threads may hold references to the map
+    CeTuReplicatedHashMap(const CeTuReplicatedHashMap&) = delete;
+    CeTuReplicatedHashMap& operator=(const CeTuReplicatedHashMap&) = delete;
+
+    void insert(const K& key, const V& value);
+    void erase(const K& key);
+    std::optional<V> lookup(const K& key) const { return local().lookup(key); }
+    bool contains(const K& key) const { return local().contains(key); }
+    size_t size() const { return replicas.front()->size(); }
+    // Makes room for n entries in every replica
+    void reserve(size_t n);
+
+    size_t replica_count() const { return replicas.size(); }
+    // Replica of the index-th online node
+    const Replica& replica(size_t index) const { return *replicas[index]; }
+
+private:
+    static constexpr size_t defaultShardCount = 16;
+
+    std::vector<std::unique_ptr<Replica>> replicas;
+    // Replica index by node id
+    std::vector<size_t> replicaOfNode;
+    std::mutex writeMutex;
+
+    const Replica& local() const;
+    // Calls update(replica) on every replica. If one throws, the replicas updated before it
+    // get key's previous entry back.
+    template<typename Update>
+    void updateAll(const K& key, const std::optional<V>& previous, Update update);
+};
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+CeTuReplicatedHashMap<K, V, Hash, KeyEqual>::CeTuReplicatedHashMap(size_t shardCount) {
+    const std::vector<size_t>& nodes = CeTuDetail::numaNodes();
+    replicaOfNode.assign(*std::max_element(nodes.begin(), nodes.end()) + 1, 0);
+    for(size_t node : nodes) {
+        replicaOfNode[node] = replicas.size();
+        replicas.push_back(std::make_unique<Replica>(shardCount, Allocator(CeTuNumaPolicy::OnNode, node)));
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuReplicatedHashMap<K, V, Hash, KeyEqual>::insert(const K& key, const V& value) {
+    // Writers apply their changes in the same order everywhere, so the replicas agree again
+    // once no write is in progress
+    std::lock_guard lock(writeMutex);
+    updateAll(key, replicas.front()->lookup(key), [&](Replica& replica) { replica.insert(key, value); });
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuReplicatedHashMap<K, V, Hash, KeyEqual>::erase(const K& key) {
+    std::lock_guard lock(writeMutex);
+    std::optional<V> previous = replicas.front()->lookup(key);
+    if(previous) {
+        updateAll(key, previous, [&](Replica& replica) { replica.erase(key); });
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuReplicatedHashMap<K, V, Hash, KeyEqual>::reserve(size_t n) {
+    std::lock_guard lock(writeMutex);
+    for(const auto& replica : replicas) {
+        replica->reserve(n);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+const typename CeTuReplicatedHashMap<K, V, Hash, KeyEqual>::Replica& CeTuReplicatedHashMap<K, V, Hash, KeyEqual>::local() const {
+    size_t node = CeTuDetail::currentNumaNode();
+    return *replicas[node < replicaOfNode.size() ? replicaOfNode[node] : 0];
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+template<typename Update>
+void CeTuReplicatedHashMap<K, V, Hash, KeyEqual>::updateAll(const K& key, const std::optional<V>& previous, Update update) {
+    size_t updated = 0;
+    try {
+        for(; updated < replicas.size(); ++updated) {
+            update(*replicas[updated]);
+        }
+    } catch(...) {
+        // The failed replica is left as it was by its own map
+        for(size_t i = 0; i < updated; ++i) {
+            if(previous) {
+                replicas[i]->insert(key, *previous);
+            } else {
+                replicas[i]->erase(key);
+            }
+        }
+        throw;
+    }
+}
+
+#endif // CETU_REPLICATED_HASHMAP_H
@@ -0,0 +1,520 @@
+#ifndef CETU_ROBIN_HOOD_HASHMAP_H
+#define CETU_ROBIN_HOOD_HASHMAP_H
+
+#include "CeTuHashMapCommon.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+// Open addressing engine using Robin Hood hashing for workloads with heavy churn at a
+// steady size. Keys and values are stored inline in one slot array next to an array of
+// 16-bit displacements (distance from the home slot plus one, 0 for an empty slot).
+// Inserting takes the slot of the first entry closer to its home than the new one and
+// shifts the rest of the run back by one, which keeps the displacements short and even,
+// and lets lookups stop as soon as they pass the displacement of the key they look for.
+// Erase shifts the following entries of the run forward into the hole, so there are no
+// tombstones and probes never get longer with churn.
+// Hashing follows CeTuHashMap: Hash plus CeTuDetail::mix unless it is an AvalanchingHash.
+// When CeTuStoreHash<K> is set, every slot also keeps the full hash.
+// Attention: CeTuRobinHoodHashMap is not thread-safe.
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+class CeTuRobinHoodHashMap final {
+public:
+    CeTuRobinHoodHashMap() : CeTuRobinHoodHashMap(0) {}
+    // Reserves room for expectedSize entries up front
+    explicit CeTuRobinHoodHashMap(size_t expectedSize);
+    ~CeTuRobinHoodHashMap() noexcept = default;
+
+    CeTuRobinHoodHashMap(const CeTuRobinHoodHashMap& other) requires CopyAssignableAndConstructible<K, V>;
+    CeTuRobinHoodHashMap& operator=(const CeTuRobinHoodHashMap& other) requires CopyAssignableAndConstructible<K, V>;
+
+    CeTuRobinHoodHashMap(CeTuRobinHoodHashMap&& other) noexcept;
+    CeTuRobinHoodHashMap& operator=(CeTuRobinHoodHashMap&& other) noexcept;
+
+    // Throws std::length_error if the keys collide so badly that a displacement would
+    // not fit its counter even in a sparse table
+    void insert(K key, V value);
+    std::optional<V> lookup(const K& key) const;
+    V* find(const K& key) { return findImpl(key); }
+    const V* find(const K& key) const { return findImpl(key); }
+    bool contains(const K& key) const { return findImpl(key) != nullptr; }
+    void erase(const K& key);
+    size_t size() const { return currentSize; }
+    bool empty() const { return currentSize == 0; }
+    // Erases every entry but keeps the slots
+    void clear() noexcept { slots.destroyAll(); currentSize = 0; }
+
+    // Constructs V from args only if key is absent. Returns the stored value and whether
+    // it was inserted.
+    template<typename... Args>
+    std::pair<V*, bool> try_emplace(const K& key, Args&&... args) { return tryEmplaceImpl(key, std::forward<Args>(args)...); }
+    template<typename... Args>
+    std::pair<V*, bool> try_emplace(K&& key, Args&&... args) { return tryEmplaceImpl(std::move(key), std::forward<Args>(args)...); }
+
+    V& operator[](const K& key) requires std::is_default_constructible_v<V> { return *tryEmplaceImpl(key).first; }
+    V& operator[](K&& key) requires std::is_default_constructible_v<V> { return *tryEmplaceImpl(std::move(key)).first; }
+
+    // The slot count is always a power of two
+    size_t bucket_count() const { return capacity; }
+    float load_factor() const { return capacity == 0 ? 0.0f : static_cast<float>(currentSize) / capacity; }
+    // Makes room for n entries without any further rehash
+    void reserve(size_t n);
+
+    // Calls visitor(key, value) for every entry, in no particular order. The map must not
+    // be modified meanwhile.
+    template<typename F>
+    void for_each(F&& visitor) const;
+
+#ifdef CETU_HASHMAP_STATS
+    // Walks every slot, see CeTuHashMapStats
+    CeTuHashMapStats stats() const;
+#endif
+
+private:
+    static constexpr bool storeHash = CeTuStoreHash<K>::value;
+
+    using distance_t = uint16_t;
+
+    struct Slot {
+        K key;
+        V value;
+        [[no_unique_address]] CeTuDetail::StoredHash<storeHash> storedHash;
+
+        // The value is constructed in place from args
+        template<typename KeyType, typename... Args>
+        Slot(KeyType&& k, Args&&... args) : key(std::forward<KeyType>(k)), value(std::forward<Args>(args)...) {}
+    };
+
+    // RAII wrapper for the displacements and the slot array
+    class SlotsHolder {
+    public:
+        SlotsHolder() : capacity(0), distances(nullptr), slots(nullptr) {}
+        explicit SlotsHolder(size_t _capacity);
+        ~SlotsHolder() { clear(); }
+
+        // Disable copying
+        SlotsHolder(const SlotsHolder&) = delete;
+        SlotsHolder& operator=(const SlotsHolder&) = delete;
+
+        // Enable moving
+        SlotsHolder(SlotsHolder&& other) noexcept;
+        SlotsHolder& operator=(SlotsHolder&& other) noexcept;
+
+        distance_t* distance() { return distances; }
+        const distance_t* distance() const { return distances; }
+        Slot* get() { return slots; }
+        const Slot* get() const { return slots; }
+
+        // Destroys every entry and marks all slots empty, keeping both arrays
+        void destroyAll() noexcept;
+
+    private:
+        size_t capacity;
+        distance_t* distances;
+        Slot* slots;
+
+        void clear();
+    };
+
+    SlotsHolder slots;
+    size_t currentSize;
+    size_t capacity;
+    CeTuDetail::SeededHash<Hash> hasher;
+    [[no_unique_address]] KeyEqual keyEqual;
+#ifdef CETU_HASHMAP_STATS
+    CeTuDetail::RehashCounters rehashCounters;
+#endif
+
+    static constexpr size_t defaultSize = 16;
+    static constexpr float maxLoadFactor = 0.875f;
+    // Inserts keep displacements below this, which leaves headroom in distance_t for the
+    // entries moved by the growth that follows
+    static constexpr size_t maxDisplacement = 1 << 14;
+    // A table this sparse is not grown any further to shorten a run
+    static constexpr float minLoadFactorToGrow = 0.125f;
+
+    size_t hash(const K& key) const { return CeTuDetail::hashKey(hasher, key); }
+    // Reuses the stored hash if there is one
+    size_t slotHash(const Slot& slot) const {
+        if constexpr (storeHash) {
+            return slot.storedHash.value;
+        } else {
+            return hash(slot.key);
+        }
+    }
+
+    // Returns the slot index holding key, or capacity if there is none
+    size_t findIndex(const K& key, size_t keyHash) const;
+    V* findImpl(const K& key) const;
+    template<typename KeyType, typename... Args>
+    std::pair<V*, bool> tryEmplaceImpl(KeyType&& key, Args&&... args);
+    // Places slot, whose key is absent, into table and returns its index, or tableCapacity
+    // if some displacement would reach limit; the table is left untouched in that case
+    static size_t place(SlotsHolder& table, size_t tableCapacity, Slot&& slot, size_t keyHash, size_t limit);
+    void resize(size_t newCapacity);
+    void copy(const CeTuRobinHoodHashMap& other);
+};
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::CeTuRobinHoodHashMap(size_t expectedSize) :
+    slots(CeTuDetail::capacityFor(expectedSize, maxLoadFactor, defaultSize)), currentSize(0),
+    capacity(CeTuDetail::capacityFor(expectedSize, maxLoadFactor, defaultSize)) {}
+
+// Copy constructor
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::CeTuRobinHoodHashMap(const CeTuRobinHoodHashMap& other) requires CopyAssignableAndConstructible<K, V> :
+    currentSize(0), capacity(0), hasher(other.hasher), keyEqual(other.keyEqual) {
+    copy(other);
+}
+
+// Copy assignment operator
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>& CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::operator=(const CeTuRobinHoodHashMap& other)
+    requires CopyAssignableAndConstructible<K, V> {
+    if(this != &other) {
+        CeTuRobinHoodHashMap copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+// Move constructor
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::CeTuRobinHoodHashMap(CeTuRobinHoodHashMap&& other) noexcept : slots(std::move(other.slots)),
+    currentSize(other.currentSize), capacity(other.capacity), hasher(std::move(other.hasher)), keyEqual(std::move(other.keyEqual)) {
+    other.currentSize = 0;
+    other.capacity = 0;
+}
+
+// Move assignment operator
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>& CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::operator=(CeTuRobinHoodHashMap&& other) noexcept {
+    if(this == &other) {
+        return *this;
+    }
+
+    std::swap(slots, other.slots);
+    std::swap(currentSize, other.currentSize);
+    std::swap(capacity, other.capacity);
+    std::swap(hasher, other.hasher);
+    std::swap(keyEqual, other.keyEqual);
+
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::insert(K key, V value) {
+    auto [current, inserted] = tryEmplaceImpl(std::move(key), std::move(value));
+    if(!inserted) {
+        *current = std::move(value);  // Update existing value
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+std::optional<V> CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::lookup(const K& key) const {
+    if(const V* value = findImpl(key)) {
+        return *value;
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::erase(const K& key) {
+    size_t hole = findIndex(key, hash(key));
+    if(hole == capacity) {
+        return;
+    }
+
+    // Entries displaced past the hole move one slot closer to home, up to the first one
+    // already at home or an empty slot
+    distance_t* distances = slots.distance();
+    Slot* array = slots.get();
+    const size_t mask = capacity - 1;
+    for(size_t next = (hole + 1) & mask; distances[next] > 1; next = (next + 1) & mask) {
+        array[hole].key = std::move(array[next].key);
+        array[hole].value = std::move(array[next].value);
+        array[hole].storedHash = array[next].storedHash;
+        distances[hole] = static_cast<distance_t>(distances[next] - 1);
+        hole = next;
+    }
+    std::destroy_at(array + hole);
+    distances[hole] = 0;
+    --currentSize;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::reserve(size_t n) {
+    size_t needed = CeTuDetail::capacityFor(n, maxLoadFactor, defaultSize);
+    if(needed > capacity) {
+        resize(needed);
+    }
+}
+
+#ifdef CETU_HASHMAP_STATS
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuHashMapStats CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::stats() const {
+    CeTuHashMapStats result;
+    result.size = currentSize;
+    result.bucketCount = capacity;
+    result.loadFactor = load_factor();
+    const distance_t* distances = slots.distance();
+    for(size_t i = 0; i < capacity; ++i) {
+        if(distances[i] != 0) {
+            CeTuDetail::addProbe(result, distances[i]);
+            result.maxDisplacement = std::max<size_t>(result.maxDisplacement, distances[i] - 1);
+        }
+    }
+    result.rehashCount = rehashCounters.count;
+    result.rehashTime = rehashCounters.time;
+    result.bucketBytes = capacity * sizeof(distance_t);
+    result.entryBytes = capacity * sizeof(Slot);
+    return result;
+}
+#endif
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename F>
+void CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::for_each(F&& visitor) const {
+    const distance_t* distances = slots.distance();
+    for(size_t i = 0; i < capacity; ++i) {
+        if(distances[i] != 0) {
+            const Slot& slot = slots.get()[i];
+            visitor(slot.key, slot.value);
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+size_t CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::findIndex(const K& key, size_t keyHash) const {
+    if(currentSize == 0) {
+        return capacity;
+    }
+    const distance_t* distances = slots.distance();
+    const Slot* array = slots.get();
+    const size_t mask = capacity - 1;
+    size_t index = keyHash & mask;
+    // An entry closer to its home than key would be means key is not in the run
+    for(size_t distance = 1; distances[index] >= distance; ++distance) {
+        if(array[index].storedHash.mayMatch(keyHash) && keyEqual(array[index].key, key)) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+    return capacity;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+V* CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::findImpl(const K& key) const {
+    size_t index = findIndex(key, hash(key));
+    return index == capacity ? nullptr : const_cast<V*>(&slots.get()[index].value);
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+template<typename KeyType, typename... Args>
+std::pair<V*, bool> CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::tryEmplaceImpl(KeyType&& key, Args&&... args) {
+    const size_t keyHash = hash(key);
+    size_t index = findIndex(key, keyHash);
+    if(index != capacity) {
+        return {&slots.get()[index].value, false};
+    }
+
+    if(currentSize + 1 > capacity * maxLoadFactor) {
+        resize(capacity == 0 ? defaultSize : capacity * 2);
+    }
+    Slot slot(std::forward<KeyType>(key), std::forward<Args>(args)...);
+    slot.storedHash.set(keyHash);
+    // A run too long to place the key in is split by growing, unless the table is already
+    // sparse and the keys simply collide
+    while((index = place(slots, capacity, std::move(slot), keyHash, maxDisplacement)) == capacity) {
+        if(load_factor() < minLoadFactorToGrow) {
+            throw std::length_error("CeTuRobinHoodHashMap: too many colliding keys");
+        }
+        resize(capacity * 2);
+    }
+    ++currentSize;
+    return {&slots.get()[index].value, true};
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+size_t CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::place(SlotsHolder& table, size_t tableCapacity, Slot&& slot, size_t keyHash, size_t limit) {
+    distance_t* distances = table.distance();
+    Slot* array = table.get();
+    const size_t mask = tableCapacity - 1;
+
+    // The new entry goes to the first slot whose entry is closer to home than it would be
+    size_t target = keyHash & mask;
+    size_t distance = 1;
+    for(; distances[target] >= distance; ++distance) {
+        target = (target + 1) & mask;
+    }
+    if(distance >= limit) {
+        return tableCapacity;
+    }
+    // Every entry from there to the end of the run moves one slot further
+    size_t end = target;
+    for(; distances[end] != 0; end = (end + 1) & mask) {
+        if(distances[end] >= limit) {
+            return tableCapacity;
+        }
+    }
+
+    if(end == target) {
+        std::construct_at(array + target, std::move(slot));
+    } else {
+        size_t previous = (end - 1) & mask;
+        std::construct_at(array + end, std::move(array[previous]));
+        distances[end] = static_cast<distance_t>(distances[previous] + 1);
+        for(size_t i = previous; i != target; i = previous) {
+            previous = (i - 1) & mask;
+            array[i].key = std::move(array[previous].key);
+            array[i].value = std::move(array[previous].value);
+            array[i].storedHash = array[previous].storedHash;
+            distances[i] = static_cast<distance_t>(distances[previous] + 1);
+        }
+        array[target].key = std::move(slot.key);
+        array[target].value = std::move(slot.value);
+        array[target].storedHash = slot.storedHash;
+    }
+    distances[target] = static_cast<distance_t>(distance);
+    return target;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::resize(size_t newCapacity) {
+    CETU_HASHMAP_REHASH_TIMER(rehashCounters, true);
+    // The new table is only swapped in once it is complete. Entries are copied when moving
+    // them could throw, so that a failure leaves the map as it was.
+    constexpr bool moveEntries = !(std::is_copy_constructible_v<K> && std::is_copy_constructible_v<V>) ||
+        (std::is_nothrow_move_constructible_v<Slot> && std::is_nothrow_move_assignable_v<K> &&
+         std::is_nothrow_move_assignable_v<V>);
+    SlotsHolder grown(newCapacity);
+
+    // An entry is preceded in its new run only by entries that preceded it in the old one,
+    // so growth never lengthens a displacement and placing cannot fail here
+    const distance_t* distances = slots.distance();
+    for(size_t i = 0; i < capacity; ++i) {
+        if(distances[i] != 0) {
+            Slot& slot = slots.get()[i];
+            if constexpr (moveEntries) {
+                place(grown, newCapacity, std::move(slot), slotHash(slot), UINT16_MAX);
+            } else {
+                Slot copied(std::as_const(slot));
+                place(grown, newCapacity, std::move(copied), slotHash(slot), UINT16_MAX);
+            }
+        }
+    }
+    std::swap(slots, grown);
+    capacity = newCapacity;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::copy(const CeTuRobinHoodHashMap& other) {
+    // The same hasher puts every entry into the same slot, so the layout is copied as is
+    SlotsHolder copied(other.capacity);
+    const distance_t* distances = other.slots.distance();
+    size_t constructed = 0;
+    try {
+        for(; constructed < other.capacity; ++constructed) {
+            if(distances[constructed] != 0) {
+                std::construct_at(copied.get() + constructed, other.slots.get()[constructed]);
+                copied.distance()[constructed] = distances[constructed];
+            }
+        }
+    } catch(...) {
+        copied.destroyAll();
+        throw;
+    }
+    slots = std::move(copied);
+    currentSize = other.currentSize;
+    capacity = other.capacity;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::SlotsHolder::SlotsHolder(size_t _capacity) :
+    capacity(_capacity), distances(new distance_t[capacity]()), slots(nullptr)
+{
+    try {
+        slots = std::allocator<Slot>().allocate(capacity);
+    } catch(...) {
+        delete[] distances;
+        throw;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::SlotsHolder::SlotsHolder(SlotsHolder&& other) noexcept :
+    capacity(other.capacity), distances(other.distances), slots(other.slots)
+{
+    other.capacity = 0;
+    other.distances = nullptr;
+    other.slots = nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::SlotsHolder& CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::SlotsHolder::operator=(SlotsHolder&& other) noexcept {
+    if(this == &other) {
+        return *this;
+    }
+
+    std::swap(capacity, other.capacity);
+    std::swap(distances, other.distances);
+    std::swap(slots, other.slots);
+
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::SlotsHolder::destroyAll() noexcept {
+    if(!distances) {
+        return;
+    }
+    // Trivially destructible slots only need their displacements reset
+    if constexpr (!std::is_trivially_destructible_v<Slot>) {
+        for(size_t i = 0; i < capacity; ++i) {
+            if(distances[i] != 0) {
+                std::destroy_at(slots + i);
+            }
+        }
+    }
+    std::memset(distances, 0, capacity * sizeof(distance_t));
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual>
+void CeTuRobinHoodHashMap<K, V, Hash, KeyEqual>::SlotsHolder::clear() {
+    if(distances) {
+        destroyAll();
+        std::allocator<Slot>().deallocate(slots, capacity);
+        delete[] distances;
+        distances = nullptr;
+        slots = nullptr;
+    }
+}
+
+#endif // CETU_ROBIN_HOOD_HASHMAP_H
@@ -0,0 +1,166 @@
+#ifndef CETU_SERIALIZATION_H
+#define CETU_SERIALIZATION_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Encodes keys and values for CeTuHashMap::serialize and friends. write appends the
+// encoding of value to buffer, read decodes the next value from in. Trivially copyable
+// types are written as their bytes and std::string as a 64-bit length followed by the
+// characters; specialize the trait for other types.
+template<typename T>
+struct CeTuSerializer;
+
+namespace CeTuDetail {
+
+inline void readBytes(std::istream& in, void* data, size_t bytes) {
+    if(!in.read(static_cast<char*>(data), static_cast<std::streamsize>(bytes))) {
+        throw std::runtime_error("CeTuSerializer: truncated stream");
+    }
+}
+
+inline void appendBytes(std::vector<char>& buffer, const void* data, size_t bytes) {
+    const char* begin = static_cast<const char*>(data);
+    buffer.insert(buffer.end(), begin, begin + bytes);
+}
+
+} // namespace CeTuDetail
+
+template<typename T>
+requires std::is_trivially_copyable_v<T>
+struct CeTuSerializer<T> {
+    static void write(std::vector<char>& buffer, const T& value) { CeTuDetail::appendBytes(buffer, &value, sizeof(T)); }
+    static T read(std::istream& in) {
+        std::array<unsigned char, sizeof(T)> bytes;
+        CeTuDetail::readBytes(in, bytes.data(), bytes.size());
+        return std::bit_cast<T>(bytes);
+    }
+};
+
+template<>
+struct CeTuSerializer<std::string> {
+    static void write(std::vector<char>& buffer, const std::string& value) {
+        uint64_t length = value.size();
+        CeTuDetail::appendBytes(buffer, &length, sizeof(length));
+        CeTuDetail::appendBytes(buffer, value.data(), value.size());
+    }
+    static std::string read(std::istream& in) {
+        uint64_t length = CeTuSerializer<uint64_t>::read(in);
+        std::string value;
+        // Grown chunk by chunk, so that a corrupt length fails on the missing data instead
+        // of allocating it all up front
+        constexpr size_t chunk = 1 << 16;
+        while(value.size() < length) {
+            size_t offset = value.size();
+            size_t bytes = static_cast<size_t>(std::min<uint64_t>(chunk, length - offset));
+            value.resize(offset + bytes);
+            CeTuDetail::readBytes(in, value.data() + offset, bytes);
+        }
+        return value;
+    }
+};
+
+template<typename T>
+concept CeTuSerializable = requires(std::vector<char>& buffer, const T& value, std::istream& in) {
+    CeTuSerializer<T>::write(buffer, value);
+    { CeTuSerializer<T>::read(in) } -> std::same_as<T>;
+};
+
+namespace CeTuDetail {
+
+// Stream layout: magic, version, entry count, then batches of at most
+// serializationBatchEntries entries, each prefixed with its entry count and the last one
+// followed by an empty batch
+inline constexpr char serializationMagic[8] = {'C', 'E', 'T', 'U', 'S', 'T', 'R', 'M'};
+inline constexpr uint32_t serializationVersion = 1;
+inline constexpr uint32_t serializationBatchEntries = 4096;
+// A batch is also flushed once its encoding reaches this size
+inline constexpr size_t serializationBatchBytes = 1 << 20;
+// The entry count in the header is only trusted up to this many entries for the initial
+// reserve; larger maps grow as their batches arrive
+inline constexpr uint64_t serializationReserveEntries = 1 << 20;
+
+// Writes every entry of map (through map.for_each) in batches, so at most one batch is
+// buffered at a time
+template<typename K, typename V, typename Map>
+void serializeMap(const Map& map, std::ostream& out) {
+    std::vector<char> buffer;
+    appendBytes(buffer, serializationMagic, sizeof(serializationMagic));
+    appendBytes(buffer, &serializationVersion, sizeof(serializationVersion));
+    uint64_t count = map.size();
+    appendBytes(buffer, &count, sizeof(count));
+
+    uint32_t batchEntries = 0;
+    size_t batchStart = buffer.size();
+    auto flush = [&](bool last) {
+        std::memcpy(buffer.data() + batchStart, &batchEntries, sizeof(batchEntries));
+        if(last && batchEntries != 0) {
+            uint32_t end = 0;
+            appendBytes(buffer, &end, sizeof(end));
+        }
+        if(!out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()))) {
+            throw std::runtime_error("CeTuSerializer: cannot write to the stream");
+        }
+        buffer.clear();
+        batchEntries = 0;
+        batchStart = 0;
+    };
+
+    buffer.resize(buffer.size() + sizeof(batchEntries));
+    map.for_each([&](const K& key, const V& value) {
+        CeTuSerializer<K>::write(buffer, key);
+        CeTuSerializer<V>::write(buffer, value);
+        if(++batchEntries == serializationBatchEntries || buffer.size() >= serializationBatchBytes) {
+            flush(false);
+            buffer.resize(sizeof(batchEntries));
+        }
+    });
+    flush(true);
+}
+
+// Inserts the entries written by serializeMap into map, one batch at a time
+template<typename K, typename V, typename Map>
+void deserializeMap(Map& map, std::istream& in) {
+    char magic[sizeof(serializationMagic)];
+    readBytes(in, magic, sizeof(magic));
+    if(std::memcmp(magic, serializationMagic, sizeof(magic)) != 0) {
+        throw std::runtime_error("CeTuSerializer: not a serialized map");
+    }
+    if(CeTuSerializer<uint32_t>::read(in) != serializationVersion) {
+        throw std::runtime_error("CeTuSerializer: unsupported version");
+    }
+    const uint64_t count = CeTuSerializer<uint64_t>::read(in);
+
+    uint64_t read = 0;
+    while(uint32_t batchEntries = CeTuSerializer<uint32_t>::read(in)) {
+        if(batchEntries > serializationBatchEntries || batchEntries > count - read) {
+            throw std::runtime_error("CeTuSerializer: corrupt batch");
+        }
+        if(read == 0) {
+            map.reserve(static_cast<size_t>(std::min(count, serializationReserveEntries)));
+        }
+        for(uint32_t i = 0; i < batchEntries; ++i) {
+            K key = CeTuSerializer<K>::read(in);
+            V value = CeTuSerializer<V>::read(in);
+            map.insert(std::move(key), std::move(value));
+        }
+        read += batchEntries;
+    }
+    if(read != count || map.size() != count) {
+        throw std::runtime_error("CeTuSerializer: entry count mismatch");
+    }
+}
+
+} // namespace CeTuDetail
+
+#endif // CETU_SERIALIZATION_H
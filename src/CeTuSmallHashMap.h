@@ -0,0 +1,247 @@
+#ifndef CETU_SMALL_HASHMAP_H
+#define CETU_SMALL_HASHMAP_H
+
+#include "CeTuHashMap.h"
+
+#include <memory>
+#include <optional>
+#include <utility>
+
+// Map for the many tiny maps case. Up to N entries are stored inside the object and found
+// by linear search with KeyEqual, without hashing; an empty map allocates nothing. The
+// insert that would exceed N copies the entries into a heap allocated CeTuHashMap, which
+// is used from then on, also after clear() or erasing back below N.
+// Attention: CeTuSmallHashMap is not thread-safe.
+template<typename K, typename V, size_t N = 8, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+class CeTuSmallHashMap final {
+public:
+    using Map = CeTuHashMap<K, V, Hash, KeyEqual>;
+
+    CeTuSmallHashMap() : inlineSize(0) {}
+    ~CeTuSmallHashMap() noexcept { destroyInline(); }
+
+    CeTuSmallHashMap(const CeTuSmallHashMap& other) requires CopyAssignableAndConstructible<K, V>;
+    CeTuSmallHashMap& operator=(const CeTuSmallHashMap& other) requires CopyAssignableAndConstructible<K, V>;
+
+    CeTuSmallHashMap(CeTuSmallHashMap&& other) noexcept(std::is_nothrow_move_constructible_v<K> && std::is_nothrow_move_constructible_v<V>);
+    CeTuSmallHashMap& operator=(CeTuSmallHashMap&& other) noexcept(std::is_nothrow_move_constructible_v<K> && std::is_nothrow_move_constructible_v<V>);
+
+    void insert(K key, V value);
+    std::optional<V> lookup(const K& key) const;
+    V* find(const K& key);
+    const V* find(const K& key) const { return const_cast<CeTuSmallHashMap*>(this)->find(key); }
+    bool contains(const K& key) const { return find(key) != nullptr; }
+    void erase(const K& key);
+    size_t size() const { return spilled ? spilled->size() : inlineSize; }
+    bool empty() const { return size() == 0; }
+    // Erases every entry; a spilled map keeps its buckets
+    void clear() noexcept;
+
+    // Whether the entries are still stored inside the object
+    bool is_inline() const { return !spilled; }
+    static constexpr size_t inline_capacity() { return N; }
+
+    // Calls visitor(key, value) for every entry, in no particular order
+    template<typename F>
+    void for_each(F&& visitor) const;
+
+private:
+    struct Entry {
+        K key;
+        V value;
+    };
+
+    size_t inlineSize;
+    std::unique_ptr<Map> spilled;
+    // The first inlineSize entries are constructed, and none once spilled
+    union {
+        Entry entries[N];
+    };
+    [[no_unique_address]] KeyEqual keyEqual;
+
+    // Index of key among the inline entries, or inlineSize
+    size_t inlineIndex(const K& key) const;
+    // Copies the inline entries into a new CeTuHashMap
+    void spill();
+    void destroyInline() noexcept;
+    // Takes the contents of other, which must be empty of inline entries afterwards
+    void moveFrom(CeTuSmallHashMap& other);
+};
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::CeTuSmallHashMap(const CeTuSmallHashMap& other) requires CopyAssignableAndConstructible<K, V> :
+    inlineSize(0), keyEqual(other.keyEqual) {
+    if(other.spilled) {
+        spilled = std::make_unique<Map>(*other.spilled);
+        return;
+    }
+    try {
+        for(; inlineSize < other.inlineSize; ++inlineSize) {
+            std::construct_at(&entries[inlineSize], other.entries[inlineSize]);
+        }
+    } catch(...) {
+        destroyInline();
+        throw;
+    }
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+CeTuSmallHashMap<K, V, N, Hash, KeyEqual>& CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::operator=(const CeTuSmallHashMap& other) requires CopyAssignableAndConstructible<K, V> {
+    if(this != &other) {
+        CeTuSmallHashMap copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::CeTuSmallHashMap(CeTuSmallHashMap&& other)
+    noexcept(std::is_nothrow_move_constructible_v<K> && std::is_nothrow_move_constructible_v<V>) : inlineSize(0) {
+    moveFrom(other);
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+CeTuSmallHashMap<K, V, N, Hash, KeyEqual>& CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::operator=(CeTuSmallHashMap&& other)
+    noexcept(std::is_nothrow_move_constructible_v<K> && std::is_nothrow_move_constructible_v<V>) {
+    if(this != &other) {
+        destroyInline();
+        spilled.reset();
+        moveFrom(other);
+    }
+    return *this;
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+void CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::insert(K key, V value) {
+    if(!spilled) {
+        size_t index = inlineIndex(key);
+        if(index != inlineSize) {
+            entries[index].value = std::move(value);
+            return;
+        }
+        if(inlineSize < N) {
+            std::construct_at(&entries[inlineSize], Entry{std::move(key), std::move(value)});
+            ++inlineSize;
+            return;
+        }
+        spill();
+    }
+    spilled->insert(std::move(key), std::move(value));
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+std::optional<V> CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::lookup(const K& key) const {
+    if(const V* value = find(key)) {
+        return *value;
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+V* CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::find(const K& key) {
+    if(spilled) {
+        return spilled->find(key);
+    }
+    size_t index = inlineIndex(key);
+    return index == inlineSize ? nullptr : &entries[index].value;
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+void CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::erase(const K& key) {
+    if(spilled) {
+        spilled->erase(key);
+        return;
+    }
+    size_t index = inlineIndex(key);
+    if(index == inlineSize) {
+        return;
+    }
+    // The last entry fills the hole
+    --inlineSize;
+    if(index != inlineSize) {
+        entries[index].key = std::move(entries[inlineSize].key);
+        entries[index].value = std::move(entries[inlineSize].value);
+    }
+    std::destroy_at(&entries[inlineSize]);
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+void CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::clear() noexcept {
+    if(spilled) {
+        spilled->clear();
+    } else {
+        destroyInline();
+    }
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+template<typename F>
+void CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::for_each(F&& visitor) const {
+    if(spilled) {
+        spilled->for_each(visitor);
+        return;
+    }
+    for(size_t i = 0; i < inlineSize; ++i) {
+        visitor(entries[i].key, entries[i].value);
+    }
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+size_t CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::inlineIndex(const K& key) const {
+    size_t index = 0;
+    while(index < inlineSize && !keyEqual(entries[index].key, key)) {
+        ++index;
+    }
+    return index;
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+void CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::spill() {
+    // The entries are copied unless they can only be moved, and the inline ones destroyed
+    // once the new map is complete, so that a failure leaves them all in place
+    auto map = std::make_unique<Map>(2 * N);
+    for(size_t i = 0; i < inlineSize; ++i) {
+        if constexpr (std::is_copy_constructible_v<K> && std::is_copy_constructible_v<V>) {
+            map->try_emplace(std::as_const(entries[i].key), std::as_const(entries[i].value));
+        } else {
+            map->try_emplace(std::move(entries[i].key), std::move(entries[i].value));
+        }
+    }
+    destroyInline();
+    spilled = std::move(map);
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+void CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::destroyInline() noexcept {
+    for(size_t i = 0; i < inlineSize; ++i) {
+        std::destroy_at(&entries[i]);
+    }
+    inlineSize = 0;
+}
+
+template<typename K, typename V, size_t N, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && (N > 0)
+void CeTuSmallHashMap<K, V, N, Hash, KeyEqual>::moveFrom(CeTuSmallHashMap& other) {
+    keyEqual = std::move(other.keyEqual);
+    spilled = std::move(other.spilled);
+    for(; inlineSize < other.inlineSize; ++inlineSize) {
+        std::construct_at(&entries[inlineSize], std::move(other.entries[inlineSize]));
+    }
+    other.destroyInline();
+}
+
+#endif // CETU_SMALL_HASHMAP_H
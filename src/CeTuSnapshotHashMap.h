@@ -0,0 +1,380 @@
+#ifndef CETU_SNAPSHOT_HASHMAP_H
+#define CETU_SNAPSHOT_HASHMAP_H
+
+#include "CeTuHashMapCommon.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace CeTuDetail {
+
+// Base of the structures shared between CeTuSnapshotHashMap copies. A clone starts with
+// its own count.
+struct RefCounted {
+    std::atomic<size_t> refs{1};
+
+    RefCounted() = default;
+    RefCounted(const RefCounted&) : refs(1) {}
+    RefCounted& operator=(const RefCounted&) = delete;
+};
+
+// Intrusive pointer to a RefCounted T, shared by every copy until one of them calls mutate()
+template<typename T>
+class SharedRef {
+public:
+    SharedRef() = default;
+    // Takes over the single reference of a newly created object
+    explicit SharedRef(T* _ptr) : ptr(_ptr) {}
+    ~SharedRef() { release(); }
+
+    SharedRef(const SharedRef& other) : ptr(other.ptr) {
+        if(ptr) {
+            ptr->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    SharedRef& operator=(const SharedRef& other) {
+        SharedRef copy(other);
+        std::swap(ptr, copy.ptr);
+        return *this;
+    }
+    SharedRef(SharedRef&& other) noexcept : ptr(std::exchange(other.ptr, nullptr)) {}
+    SharedRef& operator=(SharedRef&& other) noexcept {
+        std::swap(ptr, other.ptr);
+        return *this;
+    }
+
+    const T* get() const { return ptr; }
+    const T* operator->() const { return ptr; }
+    explicit operator bool() const { return ptr != nullptr; }
+
+    // Returns the pointee for writing, cloning it first if another copy shares it.
+    // The acquire load orders the writes after the reads of the copies released meanwhile.
+    T& mutate() {
+        if(ptr->refs.load(std::memory_order_acquire) != 1) {
+            *this = SharedRef(new T(*ptr));
+        }
+        return *ptr;
+    }
+    // Returns the pointee if no other copy shares it, else nullptr
+    T* exclusive() { return ptr && ptr->refs.load(std::memory_order_acquire) == 1 ? ptr : nullptr; }
+
+private:
+    T* ptr = nullptr;
+
+    void release() {
+        if(ptr && ptr->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete ptr;
+        }
+    }
+};
+
+} // namespace CeTuDetail
+
+// Map whose copies share structure, for handing consistent views to other threads.
+// Entries are kept in small chunks, found through a tree of nodes indexed by successive
+// 4-bit digits of the hash. Within a node, neighbouring slots share one chunk until it
+// overflows, and only that chunk is split then, by the next bit of the hash (extendible
+// hashing); a chunk that has a slot to itself moves one level down into a node of its own.
+// Copying a map only bumps the root's reference count; a write afterwards clones the
+// nodes on the path to its chunk (16 slots each, O(log n) in all) and the chunk itself if
+// a copy still holds them. Nothing is ever rebuilt as a whole.
+// A single map object is not thread-safe, but copies may be used by different threads
+// concurrently, so snapshot() on the writer thread and hand the copy over.
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+class CeTuSnapshotHashMap final {
+public:
+    CeTuSnapshotHashMap() : currentSize(0), chunkCount(0) {}
+
+    // Copies are O(1) and share every chunk with other
+    CeTuSnapshotHashMap(const CeTuSnapshotHashMap&) = default;
+    CeTuSnapshotHashMap& operator=(const CeTuSnapshotHashMap&) = default;
+    CeTuSnapshotHashMap(CeTuSnapshotHashMap&& other) noexcept;
+    CeTuSnapshotHashMap& operator=(CeTuSnapshotHashMap&& other) noexcept;
+
+    // Same as copying, spelled out at call sites
+    CeTuSnapshotHashMap snapshot() const { return *this; }
+
+    void insert(K key, V value);
+    std::optional<V> lookup(const K& key) const;
+    // Read-only: writing through the pointer would bypass copy-on-write
+    const V* find(const K& key) const;
+    bool contains(const K& key) const { return find(key) != nullptr; }
+    void erase(const K& key);
+    size_t size() const { return currentSize; }
+    bool empty() const { return currentSize == 0; }
+    size_t chunk_count() const { return chunkCount; }
+
+    // Calls visitor(key, value) for every entry, in no particular order
+    template<typename F>
+    void for_each(F&& visitor) const;
+
+private:
+    struct Entry {
+        size_t hash;
+        K key;
+        V value;
+    };
+
+    struct Chunk : CeTuDetail::RefCounted {
+        std::vector<Entry> entries;
+    };
+
+    static constexpr int digitBits = 4;
+    static constexpr size_t fanout = size_t(1) << digitBits;
+    // A chunk is split before it would take more entries, unless the hash has no bits left
+    static constexpr size_t maxChunkEntries = 16;
+
+    // A slot holds either a child node or a share of a chunk. A chunk split on the first d
+    // bits of the slot index covers 2^(digitBits - d) slots and is only stored in the first
+    // of them; null chunks are empty.
+    struct Node : CeTuDetail::RefCounted {
+        std::array<CeTuDetail::SharedRef<Chunk>, fanout> chunks;
+        std::array<CeTuDetail::SharedRef<Node>, fanout> children;
+        // d for the chunk of every slot, digitBits for children
+        std::array<uint8_t, fanout> depths{};
+    };
+
+    // Where the chunk of a hash is stored; shift is the position of the node's digit
+    struct Position {
+        Node* node;
+        size_t slot;
+        int shift;
+    };
+
+    CeTuDetail::SharedRef<Node> root;
+    size_t currentSize;
+    size_t chunkCount;
+    CeTuDetail::SeededHash<Hash> hasher;
+    [[no_unique_address]] KeyEqual keyEqual;
+
+    size_t hash(const K& key) const { return CeTuDetail::hashKey(hasher, key); }
+    static size_t digit(size_t keyHash, int shift) { return (keyHash >> shift) & (fanout - 1); }
+    // First slot of the range sharing the chunk of slot
+    static size_t chunkSlot(const Node& node, size_t slot) { return slot & ~((fanout >> node.depths[slot]) - 1); }
+    const Chunk* chunkFor(size_t keyHash) const;
+    // Finds the chunk of keyHash, unsharing the nodes on the way but not the chunk
+    Position writablePosition(size_t keyHash);
+    // Splits the full chunk at position in two, or moves it into a new child node if it has
+    // its slot to itself. Returns false if the hash has no bits left to split on. Nothing
+    // changes if it throws.
+    bool split(const Position& position);
+    template<typename F>
+    static void visit(const Node& node, F& visitor);
+};
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::CeTuSnapshotHashMap(CeTuSnapshotHashMap&& other) noexcept :
+    root(std::move(other.root)),
+    currentSize(std::exchange(other.currentSize, 0)),
+    chunkCount(std::exchange(other.chunkCount, 0)),
+    hasher(std::move(other.hasher)),
+    keyEqual(std::move(other.keyEqual)) {}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+CeTuSnapshotHashMap<K, V, Hash, KeyEqual>& CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::operator=(CeTuSnapshotHashMap&& other) noexcept {
+    if(this != &other) {
+        root = std::move(other.root);
+        other.root = CeTuDetail::SharedRef<Node>();
+        currentSize = std::exchange(other.currentSize, 0);
+        chunkCount = std::exchange(other.chunkCount, 0);
+        hasher = std::move(other.hasher);
+        keyEqual = std::move(other.keyEqual);
+    }
+    return *this;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::insert(K key, V value) {
+    size_t keyHash = hash(key);
+    // Full chunks are split before the entry goes in, so a failed split leaves no trace
+    for(;;) {
+        Position position = writablePosition(keyHash);
+        CeTuDetail::SharedRef<Chunk>& ref = position.node->chunks[position.slot];
+        if(ref) {
+            for(const Entry& entry : ref->entries) {
+                if(entry.hash == keyHash && keyEqual(entry.key, key)) {
+                    for(Entry& writable : ref.mutate().entries) {
+                        if(writable.hash == keyHash && keyEqual(writable.key, key)) {
+                            writable.value = std::move(value);
+                            return;
+                        }
+                    }
+                }
+            }
+            if(ref->entries.size() >= maxChunkEntries && split(position)) {
+                continue;
+            }
+        } else {
+            ref = CeTuDetail::SharedRef<Chunk>(new Chunk());
+            ++chunkCount;
+        }
+        ref.mutate().entries.push_back(Entry{keyHash, std::move(key), std::move(value)});
+        ++currentSize;
+        return;
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+std::optional<V> CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::lookup(const K& key) const {
+    if(const V* value = find(key)) {
+        return *value;
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+const V* CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::find(const K& key) const {
+    size_t keyHash = hash(key);
+    if(const Chunk* chunk = chunkFor(keyHash)) {
+        for(const Entry& entry : chunk->entries) {
+            if(entry.hash == keyHash && keyEqual(entry.key, key)) {
+                return &entry.value;
+            }
+        }
+    }
+    return nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+void CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::erase(const K& key) {
+    // Absent keys must not unshare anything
+    if(!contains(key)) {
+        return;
+    }
+
+    size_t keyHash = hash(key);
+    Position position = writablePosition(keyHash);
+    std::vector<Entry>& entries = position.node->chunks[position.slot].mutate().entries;
+    for(size_t i = 0; i < entries.size(); ++i) {
+        if(entries[i].hash == keyHash && keyEqual(entries[i].key, key)) {
+            if(i + 1 != entries.size()) {
+                entries[i] = std::move(entries.back());
+            }
+            entries.pop_back();
+            --currentSize;
+            return;
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+template<typename F>
+void CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::for_each(F&& visitor) const {
+    if(root) {
+        visit(*root.get(), visitor);
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+template<typename F>
+void CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::visit(const Node& node, F& visitor) {
+    for(size_t slot = 0; slot < fanout; ++slot) {
+        if(node.children[slot]) {
+            visit(*node.children[slot].get(), visitor);
+        } else if(node.chunks[slot]) {
+            for(const Entry& entry : node.chunks[slot]->entries) {
+                visitor(entry.key, entry.value);
+            }
+        }
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+const typename CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::Chunk* CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::chunkFor(size_t keyHash) const {
+    const Node* node = root.get();
+    for(int shift = 64 - digitBits; node != nullptr; shift -= digitBits) {
+        size_t slot = digit(keyHash, shift);
+        if(const Node* child = node->children[slot].get()) {
+            node = child;
+            continue;
+        }
+        return node->chunks[chunkSlot(*node, slot)].get();
+    }
+    return nullptr;
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+typename CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::Position CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::writablePosition(size_t keyHash) {
+    if(!root) {
+        root = CeTuDetail::SharedRef<Node>(new Node());
+    }
+    Node* node = &root.mutate();
+    for(int shift = 64 - digitBits;; shift -= digitBits) {
+        size_t slot = digit(keyHash, shift);
+        if(node->children[slot]) {
+            node = &node->children[slot].mutate();
+            continue;
+        }
+        return {node, chunkSlot(*node, slot), shift};
+    }
+}
+
+template<typename K, typename V, typename Hash, typename KeyEqual>
+requires HashMapRequirements<K, V, Hash, KeyEqual> && CopyAssignableAndConstructible<K, V>
+bool CeTuSnapshotHashMap<K, V, Hash, KeyEqual>::split(const Position& position) {
+    Node& node = *position.node;
+    const int depth = node.depths[position.slot];
+    if(depth == digitBits) {
+        if(position.shift == 0) {
+            return false;
+        }
+        // The chunk covers every slot of the new node, which the caller splits next
+        CeTuDetail::SharedRef<Node> child(new Node());
+        child.mutate().chunks[0] = std::move(node.chunks[position.slot]);
+        node.children[position.slot] = std::move(child);
+        return true;
+    }
+
+    // The halves are allocated up front and the entries only moved when that cannot throw,
+    // otherwise copied, so a failure leaves the chunk as it was
+    CeTuDetail::SharedRef<Chunk>& ref = node.chunks[position.slot];
+    const int bit = position.shift + digitBits - 1 - depth;
+    size_t upperCount = 0;
+    for(const Entry& entry : ref->entries) {
+        upperCount += (entry.hash >> bit) & 1;
+    }
+    const size_t lowerCount = ref->entries.size() - upperCount;
+    CeTuDetail::SharedRef<Chunk> lower(lowerCount == 0 ? nullptr : new Chunk());
+    CeTuDetail::SharedRef<Chunk> upper(upperCount == 0 ? nullptr : new Chunk());
+    std::vector<Entry>* halves[2] = {lower ? &lower.mutate().entries : nullptr, upper ? &upper.mutate().entries : nullptr};
+    for(std::vector<Entry>* half : halves) {
+        if(half) {
+            half->reserve(half == halves[0] ? lowerCount : upperCount);
+        }
+    }
+    if(Chunk* owned = ref.exclusive()) {
+        for(Entry& entry : owned->entries) {
+            halves[(entry.hash >> bit) & 1]->push_back(std::move_if_noexcept(entry));
+        }
+    } else {
+        for(const Entry& entry : ref->entries) {
+            halves[(entry.hash >> bit) & 1]->push_back(entry);
+        }
+    }
+
+    const size_t span = fanout >> depth;
+    ref = std::move(lower);
+    node.chunks[position.slot + span / 2] = std::move(upper);
+    for(size_t slot = position.slot; slot < position.slot + span; ++slot) {
+        node.depths[slot] = static_cast<uint8_t>(depth + 1);
+    }
+    chunkCount = chunkCount - 1 + (lowerCount != 0) + (upperCount != 0);
+    return true;
+}
+
+#endif // CETU_SNAPSHOT_HASHMAP_H
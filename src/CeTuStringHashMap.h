@@ -0,0 +1,582 @@
+#ifndef CETU_STRING_HASHMAP_H
+#define CETU_STRING_HASHMAP_H
+
+#include "CeTuHashMapCommon.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Map from strings to V for large string-keyed tables such as URL maps. Instead of one
+// std::string per entry, key bytes are copied into an append-only arena of large chunks,
+// and each slot keeps a 24 byte reference: the full hash, the length, the first 4 bytes,
+// and either the remaining bytes inline (keys of up to 12 bytes need no arena at all) or a
+// pointer to the whole key in the arena. Keys are compared on the hash, then the length and prefix, and
+// only then on the arena bytes, so misses almost never leave the slot array. References
+// and values live in two separate arrays, so probing only touches references. Collisions
+// are resolved by linear probing; erase shifts the following entries back.
+// The bytes of erased keys stay in the arena until compact(), which growth also runs
+// once they make up half of it.
+// Keys are passed as std::string_view, so std::string and string literals work as is.
+// Hash is seeded per map like in the other containers.
+// Attention: CeTuStringHashMap is not thread-safe.
+template<typename V, typename Hash = std::hash<std::string_view>>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+class CeTuStringHashMap final {
+public:
+    CeTuStringHashMap() : CeTuStringHashMap(0) {}
+    // Reserves room for expectedSize entries up front
+    explicit CeTuStringHashMap(size_t expectedSize);
+
+    CeTuStringHashMap(const CeTuStringHashMap& other) requires std::is_copy_constructible_v<V>;
+    CeTuStringHashMap& operator=(const CeTuStringHashMap& other) requires std::is_copy_constructible_v<V>;
+
+    CeTuStringHashMap(CeTuStringHashMap&& other) noexcept;
+    CeTuStringHashMap& operator=(CeTuStringHashMap&& other) noexcept;
+
+    // Keys may not be longer than 2^32 - 2 bytes
+    void insert(std::string_view key, V value);
+    std::optional<V> lookup(std::string_view key) const requires std::is_copy_constructible_v<V>;
+    V* find(std::string_view key) { return findImpl(key); }
+    const V* find(std::string_view key) const { return findImpl(key); }
+    bool contains(std::string_view key) const { return findImpl(key) != nullptr; }
+    void erase(std::string_view key);
+    size_t size() const { return currentSize; }
+    bool empty() const { return currentSize == 0; }
+    // Erases every entry and frees the arena, keeping the slot arrays
+    void clear() noexcept;
+
+    // The slot count is always a power of two
+    size_t bucket_count() const { return capacity; }
+    float load_factor() const { return capacity == 0 ? 0.0f : static_cast<float>(currentSize) / capacity; }
+    // Makes room for n entries without any further rehash
+    void reserve(size_t n);
+
+    // Bytes held by the arena, and the part of them left behind by erased keys
+    size_t arena_bytes() const { return arena.allocatedBytes(); }
+    size_t garbage_bytes() const { return garbageBytes; }
+    // Copies the live keys into a fresh arena, dropping the bytes of erased ones
+    void compact();
+
+    // Calls visitor(key, value) for every entry, key being a std::string_view that is
+    // valid only during the call
+    template<typename F>
+    void for_each(F&& visitor) const;
+
+private:
+    static constexpr size_t prefixSize = 4;
+    static constexpr size_t inlineSize = prefixSize + sizeof(const char*);
+    static constexpr uint32_t emptyLength = std::numeric_limits<uint32_t>::max();
+
+    struct KeyRef {
+        size_t hash;
+        // emptyLength for a free slot
+        uint32_t length;
+        char prefix[prefixSize];
+        // The bytes after the prefix for keys of up to inlineSize bytes, otherwise the whole
+        // key, prefix included, in the arena
+        union {
+            const char* rest;
+            char inlineRest[sizeof(const char*)];
+        };
+
+        bool isEmpty() const { return length == emptyLength; }
+        bool isInline() const { return length <= inlineSize; }
+        std::string_view restView() const {
+            if(isInline()) {
+                return {inlineRest, length > prefixSize ? length - prefixSize : 0};
+            }
+            return {rest + prefixSize, length - prefixSize};
+        }
+        std::string_view arenaKey() const { return {rest, length}; }
+    };
+
+    // Append-only storage for the key bytes that do not fit inline. Chunks never move.
+    class Arena {
+    public:
+        Arena() = default;
+        Arena(Arena&&) noexcept = default;
+        Arena& operator=(Arena&&) noexcept = default;
+
+        // Returns the copy of bytes
+        const char* append(std::string_view bytes);
+        void clear() noexcept;
+        size_t allocatedBytes() const { return allocated; }
+
+    private:
+        static constexpr size_t minChunkSize = 4096;
+        static constexpr size_t maxChunkSize = 1 << 20;
+
+        std::vector<std::unique_ptr<char[]>> chunks;
+        char* cursor = nullptr;
+        size_t remaining = 0;
+        size_t nextChunkSize = minChunkSize;
+        size_t allocated = 0;
+    };
+
+    // RAII wrapper for the reference and value arrays. Every reference is constructed,
+    // values only next to a used one.
+    class ArraysHolder {
+    public:
+        ArraysHolder() : capacity(0), keys(nullptr), values(nullptr) {}
+        explicit ArraysHolder(size_t _capacity);
+        ~ArraysHolder() { clear(); }
+
+        // Disable copying
+        ArraysHolder(const ArraysHolder&) = delete;
+        ArraysHolder& operator=(const ArraysHolder&) = delete;
+
+        // Enable moving
+        ArraysHolder(ArraysHolder&& other) noexcept;
+        ArraysHolder& operator=(ArraysHolder&& other) noexcept;
+
+        KeyRef* getKeys() { return keys; }
+        const KeyRef* getKeys() const { return keys; }
+        V* getValues() { return values; }
+        const V* getValues() const { return values; }
+
+        // Destroys every value and marks all slots empty, keeping both arrays
+        void destroyAll() noexcept;
+
+    private:
+        size_t capacity;
+        KeyRef* keys;
+        V* values;
+
+        void clear() noexcept;
+    };
+
+    static constexpr size_t defaultSize = 16;
+    static constexpr float maxLoadFactor = 0.7f;
+
+    ArraysHolder arrays;
+    Arena arena;
+    size_t currentSize;
+    size_t capacity;
+    // Arena bytes of erased keys
+    size_t garbageBytes;
+    CeTuDetail::SeededHash<Hash> hasher;
+
+    size_t hash(std::string_view key) const { return CeTuDetail::hashKey(hasher, key); }
+    // Copies the bytes of key past the prefix into the reference, or the whole key into arena
+    static KeyRef makeKey(std::string_view key, size_t keyHash, Arena& arena);
+    static bool matches(const KeyRef& ref, std::string_view key, size_t keyHash);
+    // Returns the slot holding key, or capacity if there is none
+    size_t findIndex(std::string_view key, size_t keyHash) const;
+    V* findImpl(std::string_view key) const;
+    void resize(size_t newCapacity);
+    // Points every reference not stored inline into a fresh arena
+    void rebuildArena();
+};
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+CeTuStringHashMap<V, Hash>::CeTuStringHashMap(size_t expectedSize) : currentSize(0), capacity(0), garbageBytes(0) {
+    if(expectedSize != 0) {
+        reserve(expectedSize);
+    }
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+CeTuStringHashMap<V, Hash>::CeTuStringHashMap(const CeTuStringHashMap& other) requires std::is_copy_constructible_v<V> :
+    arrays(other.capacity), currentSize(0), capacity(other.capacity), garbageBytes(0), hasher(other.hasher) {
+    // Same capacity and hashes, so every entry keeps its slot; the arena comes out compacted
+    const KeyRef* otherKeys = other.arrays.getKeys();
+    KeyRef* keys = arrays.getKeys();
+    for(size_t i = 0; i < capacity; ++i) {
+        if(otherKeys[i].isEmpty()) {
+            continue;
+        }
+        KeyRef copy = otherKeys[i];
+        if(!copy.isInline()) {
+            copy.rest = arena.append(copy.arenaKey());
+        }
+        std::construct_at(arrays.getValues() + i, other.arrays.getValues()[i]);
+        keys[i] = copy;
+        ++currentSize;
+    }
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+CeTuStringHashMap<V, Hash>& CeTuStringHashMap<V, Hash>::operator=(const CeTuStringHashMap& other) requires std::is_copy_constructible_v<V> {
+    if(this != &other) {
+        CeTuStringHashMap copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+CeTuStringHashMap<V, Hash>::CeTuStringHashMap(CeTuStringHashMap&& other) noexcept : arrays(std::move(other.arrays)),
+    arena(std::move(other.arena)), currentSize(other.currentSize), capacity(other.capacity), garbageBytes(other.garbageBytes),
+    hasher(other.hasher) {
+    other.currentSize = 0;
+    other.capacity = 0;
+    other.garbageBytes = 0;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+CeTuStringHashMap<V, Hash>& CeTuStringHashMap<V, Hash>::operator=(CeTuStringHashMap&& other) noexcept {
+    if(this != &other) {
+        std::swap(arrays, other.arrays);
+        std::swap(arena, other.arena);
+        std::swap(currentSize, other.currentSize);
+        std::swap(capacity, other.capacity);
+        std::swap(garbageBytes, other.garbageBytes);
+        std::swap(hasher, other.hasher);
+    }
+    return *this;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::insert(std::string_view key, V value) {
+    if(key.size() >= emptyLength) {
+        throw std::invalid_argument("CeTuStringHashMap: key is too long");
+    }
+    size_t keyHash = hash(key);
+    if(currentSize != 0) {
+        size_t current = findIndex(key, keyHash);
+        if(current != capacity) {
+            arrays.getValues()[current] = std::move(value);
+            return;
+        }
+    }
+    if(currentSize + 1 > capacity * maxLoadFactor) {
+        resize(capacity == 0 ? defaultSize : capacity * 2);
+    }
+
+    KeyRef* keys = arrays.getKeys();
+    size_t mask = capacity - 1;
+    size_t index = keyHash & mask;
+    while(!keys[index].isEmpty()) {
+        index = (index + 1) & mask;
+    }
+    KeyRef ref = makeKey(key, keyHash, arena);
+    try {
+        std::construct_at(arrays.getValues() + index, std::move(value));
+    } catch(...) {
+        garbageBytes += ref.isInline() ? 0 : ref.length;
+        throw;
+    }
+    keys[index] = ref;
+    ++currentSize;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+std::optional<V> CeTuStringHashMap<V, Hash>::lookup(std::string_view key) const requires std::is_copy_constructible_v<V> {
+    if(const V* value = findImpl(key)) {
+        return *value;
+    }
+    return std::nullopt;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::erase(std::string_view key) {
+    if(currentSize == 0) {
+        return;
+    }
+    size_t hole = findIndex(key, hash(key));
+    if(hole == capacity) {
+        return;
+    }
+
+    KeyRef* keys = arrays.getKeys();
+    V* values = arrays.getValues();
+    garbageBytes += keys[hole].isInline() ? 0 : keys[hole].length;
+    std::destroy_at(values + hole);
+    // Shifts back every following entry of the run that may use the hole, i.e. whose home
+    // slot is not between the hole and its own slot
+    size_t mask = capacity - 1;
+    for(size_t index = (hole + 1) & mask; !keys[index].isEmpty(); index = (index + 1) & mask) {
+        size_t home = keys[index].hash & mask;
+        if(((index - home) & mask) >= ((index - hole) & mask)) {
+            keys[hole] = keys[index];
+            std::construct_at(values + hole, std::move(values[index]));
+            std::destroy_at(values + index);
+            hole = index;
+        }
+    }
+    keys[hole].length = emptyLength;
+    --currentSize;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::clear() noexcept {
+    arrays.destroyAll();
+    arena.clear();
+    currentSize = 0;
+    garbageBytes = 0;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::reserve(size_t n) {
+    size_t needed = CeTuDetail::capacityFor(n, maxLoadFactor, defaultSize);
+    if(needed > capacity) {
+        resize(needed);
+    }
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::compact() {
+    if(garbageBytes != 0) {
+        rebuildArena();
+    }
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+template<typename F>
+void CeTuStringHashMap<V, Hash>::for_each(F&& visitor) const {
+    const KeyRef* keys = arrays.getKeys();
+    for(size_t i = 0; i < capacity; ++i) {
+        if(keys[i].isEmpty()) {
+            continue;
+        }
+        if(!keys[i].isInline()) {
+            visitor(keys[i].arenaKey(), arrays.getValues()[i]);
+            continue;
+        }
+        // Inline keys are split between prefix and rest, so they are joined in buffer
+        char buffer[inlineSize];
+        std::string_view rest = keys[i].restView();
+        std::memcpy(buffer, keys[i].prefix, std::min<size_t>(keys[i].length, prefixSize));
+        std::memcpy(buffer + prefixSize, rest.data(), rest.size());
+        visitor(std::string_view(buffer, keys[i].length), arrays.getValues()[i]);
+    }
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+typename CeTuStringHashMap<V, Hash>::KeyRef CeTuStringHashMap<V, Hash>::makeKey(std::string_view key, size_t keyHash, Arena& arena) {
+    KeyRef ref;
+    ref.hash = keyHash;
+    ref.length = static_cast<uint32_t>(key.size());
+    std::memset(ref.prefix, 0, prefixSize);
+    // The data of an empty view may be null, which memcpy does not accept even for 0 bytes
+    if(!key.empty()) {
+        std::memcpy(ref.prefix, key.data(), std::min(key.size(), prefixSize));
+    }
+    if(ref.isInline()) {
+        std::memset(ref.inlineRest, 0, sizeof(ref.inlineRest));
+        if(key.size() > prefixSize) {
+            std::memcpy(ref.inlineRest, key.data() + prefixSize, key.size() - prefixSize);
+        }
+    } else {
+        ref.rest = arena.append(key);
+    }
+    return ref;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+bool CeTuStringHashMap<V, Hash>::matches(const KeyRef& ref, std::string_view key, size_t keyHash) {
+    if(ref.hash != keyHash || ref.length != key.size()) {
+        return false;
+    }
+    if(key.empty()) {
+        return true;
+    }
+    if(std::memcmp(ref.prefix, key.data(), std::min(key.size(), prefixSize)) != 0) {
+        return false;
+    }
+    if(key.size() <= prefixSize) {
+        return true;
+    }
+    std::string_view rest = ref.restView();
+    return std::memcmp(rest.data(), key.data() + prefixSize, rest.size()) == 0;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+size_t CeTuStringHashMap<V, Hash>::findIndex(std::string_view key, size_t keyHash) const {
+    const KeyRef* keys = arrays.getKeys();
+    size_t mask = capacity - 1;
+    for(size_t index = keyHash & mask; !keys[index].isEmpty(); index = (index + 1) & mask) {
+        if(matches(keys[index], key, keyHash)) {
+            return index;
+        }
+    }
+    return capacity;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+V* CeTuStringHashMap<V, Hash>::findImpl(std::string_view key) const {
+    if(currentSize == 0) {
+        return nullptr;
+    }
+    size_t index = findIndex(key, hash(key));
+    if(index == capacity) {
+        return nullptr;
+    }
+    // Shared by both find() overloads; the const one hands the pointer out as const V*
+    return const_cast<V*>(arrays.getValues() + index);
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::resize(size_t newCapacity) {
+    ArraysHolder grown(newCapacity);
+    KeyRef* newKeys = grown.getKeys();
+    V* newValues = grown.getValues();
+    KeyRef* keys = arrays.getKeys();
+    V* values = arrays.getValues();
+
+    // Keys are unique, so every entry just takes the first empty slot of its run. Values
+    // are copied when moving could throw, so that a failure leaves the map as it was.
+    size_t mask = newCapacity - 1;
+    for(size_t i = 0; i < capacity; ++i) {
+        if(keys[i].isEmpty()) {
+            continue;
+        }
+        size_t index = keys[i].hash & mask;
+        while(!newKeys[index].isEmpty()) {
+            index = (index + 1) & mask;
+        }
+        std::construct_at(newValues + index, std::move_if_noexcept(values[i]));
+        newKeys[index] = keys[i];
+    }
+
+    arrays = std::move(grown);
+    capacity = newCapacity;
+    if(garbageBytes != 0 && 2 * garbageBytes >= arena.allocatedBytes()) {
+        rebuildArena();
+    }
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::rebuildArena() {
+    Arena compacted;
+    KeyRef* keys = arrays.getKeys();
+    // Appended first and repointed afterwards, so a failed allocation changes nothing
+    std::vector<const char*> moved;
+    moved.reserve(currentSize);
+    for(size_t i = 0; i < capacity; ++i) {
+        if(!keys[i].isEmpty() && !keys[i].isInline()) {
+            moved.push_back(compacted.append(keys[i].arenaKey()));
+        }
+    }
+    size_t next = 0;
+    for(size_t i = 0; i < capacity; ++i) {
+        if(!keys[i].isEmpty() && !keys[i].isInline()) {
+            keys[i].rest = moved[next++];
+        }
+    }
+    arena = std::move(compacted);
+    garbageBytes = 0;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+const char* CeTuStringHashMap<V, Hash>::Arena::append(std::string_view bytes) {
+    if(bytes.size() > remaining) {
+        // Keys larger than a chunk get one of their own, the current chunk stays open
+        if(bytes.size() > nextChunkSize / 2) {
+            chunks.push_back(std::make_unique_for_overwrite<char[]>(bytes.size()));
+            allocated += bytes.size();
+            std::memcpy(chunks.back().get(), bytes.data(), bytes.size());
+            return chunks.back().get();
+        }
+        chunks.push_back(std::make_unique_for_overwrite<char[]>(nextChunkSize));
+        allocated += nextChunkSize;
+        cursor = chunks.back().get();
+        remaining = nextChunkSize;
+        nextChunkSize = std::min(nextChunkSize * 2, maxChunkSize);
+    }
+    char* copy = cursor;
+    std::memcpy(copy, bytes.data(), bytes.size());
+    cursor += bytes.size();
+    remaining -= bytes.size();
+    return copy;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::Arena::clear() noexcept {
+    chunks.clear();
+    cursor = nullptr;
+    remaining = 0;
+    nextChunkSize = minChunkSize;
+    allocated = 0;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+CeTuStringHashMap<V, Hash>::ArraysHolder::ArraysHolder(size_t _capacity) : capacity(_capacity), keys(nullptr), values(nullptr) {
+    keys = std::allocator<KeyRef>().allocate(capacity);
+    try {
+        values = std::allocator<V>().allocate(capacity);
+    } catch(...) {
+        std::allocator<KeyRef>().deallocate(keys, capacity);
+        throw;
+    }
+    for(size_t i = 0; i < capacity; ++i) {
+        std::construct_at(keys + i)->length = emptyLength;
+    }
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+CeTuStringHashMap<V, Hash>::ArraysHolder::ArraysHolder(ArraysHolder&& other) noexcept :
+    capacity(other.capacity), keys(other.keys), values(other.values)
+{
+    other.capacity = 0;
+    other.keys = nullptr;
+    other.values = nullptr;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+typename CeTuStringHashMap<V, Hash>::ArraysHolder& CeTuStringHashMap<V, Hash>::ArraysHolder::operator=(ArraysHolder&& other) noexcept {
+    if(this == &other) {
+        return *this;
+    }
+
+    std::swap(capacity, other.capacity);
+    std::swap(keys, other.keys);
+    std::swap(values, other.values);
+
+    return *this;
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::ArraysHolder::destroyAll() noexcept {
+    for(size_t i = 0; i < capacity; ++i) {
+        if(!keys[i].isEmpty()) {
+            std::destroy_at(values + i);
+            keys[i].length = emptyLength;
+        }
+    }
+}
+
+template<typename V, typename Hash>
+requires Hashable<std::string_view, Hash> && std::is_move_constructible_v<V> && std::is_move_assignable_v<V>
+void CeTuStringHashMap<V, Hash>::ArraysHolder::clear() noexcept {
+    if(keys) {
+        destroyAll();
+        std::allocator<V>().deallocate(values, capacity);
+        std::allocator<KeyRef>().deallocate(keys, capacity);
+        keys = nullptr;
+        values = nullptr;
+    }
+}
+
+#endif // CETU_STRING_HASHMAP_H
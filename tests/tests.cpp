@@ -1,9 +1,57 @@
+// The stats() tests need the instrumentation compiled in
+#define CETU_HASHMAP_STATS
+
 #include "../src/CeTuHashMap.h"
+#include "../src/CeTuFlatHashMap.h"
+#include "../src/CeTuConcurrentHashMap.h"
+#include "../src/CeTuReadMostlyHashMap.h"
+#include "../src/CeTuMappedHashMap.h"
+#include "../src/CeTuSnapshotHashMap.h"
+#include "../src/CeTuSmallHashMap.h"
+#include "../src/CeTuDenseHashMap.h"
+#include "../src/CeTuRobinHoodHashMap.h"
+#include "../src/CeTuReplicatedHashMap.h"
+#include "../src/CeTuClockCache.h"
+#include "../src/CeTuStringHashMap.h"
 
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 #include <sys/resource.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 #include <gtest/gtest.h>
 
+// Counts heap allocations made by the test binary
+static std::atomic<size_t> allocationCount{0};
+
+// Kept out of line so that GCC does not pair the inlined malloc/free with new/delete
+[[gnu::noinline]] void* operator new(size_t size) {
+    allocationCount++;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* ptr) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
 TEST(CeTuHashMap, Print_IntIntMapTest) {
     // Test with int as both key and value
     CeTuHashMap<int, int> intMap;
@@ -242,6 +290,2166 @@ TEST(CeTuHashMap, TestConceptsAndMoveSemantic) {
     testMap2.insert(key, 1);
 }
 
+TEST(CeTuFlatHashMap, IntIntMapTest) {
+    CeTuFlatHashMap<int, int> intMap;
+    intMap.insert(1, 2);
+    auto data = intMap.lookup(1);
+    ASSERT_TRUE(data.has_value());
+    ASSERT_EQ(*data, 2);
+
+    ASSERT_FALSE(intMap.lookup(3).has_value());
+
+    intMap.erase(1);
+    ASSERT_FALSE(intMap.lookup(1).has_value());
+    ASSERT_EQ(intMap.size(), 0);
+}
+
+TEST(CeTuFlatHashMap, StringDoubleMapTest) {
+    static constexpr double Pi = 3.14159;
+    static constexpr double E = 2.71828;
+
+    CeTuFlatHashMap<std::string, double> stringMap;
+    stringMap.insert("pi", Pi);
+    stringMap.insert("e", E);
+    ASSERT_DOUBLE_EQ(stringMap.lookup("pi").value(), Pi);
+    ASSERT_DOUBLE_EQ(stringMap.lookup("e").value(), E);
+
+    // Update existing value
+    stringMap.insert("e", Pi);
+    ASSERT_DOUBLE_EQ(stringMap.lookup("e").value(), Pi);
+    ASSERT_EQ(stringMap.size(), 2);
+
+    stringMap.erase("pi");
+    ASSERT_FALSE(stringMap.lookup("pi").has_value());
+    ASSERT_EQ(stringMap.size(), 1);
+}
+
+TEST(CeTuFlatHashMap, CopyAndMoveTest) {
+    CeTuFlatHashMap<int, std::string> original;
+    original.insert(1, "one");
+    original.insert(2, "two");
+    original.erase(2);
+
+    CeTuFlatHashMap<int, std::string> copy = original;
+    ASSERT_EQ(copy.size(), 1);
+    ASSERT_EQ(copy.lookup(1).value(), "one");
+    ASSERT_FALSE(copy.lookup(2).has_value());
+
+    CeTuFlatHashMap<int, std::string> moved = std::move(original);
+    ASSERT_EQ(original.size(), 0);
+    ASSERT_EQ(moved.size(), 1);
+    ASSERT_EQ(moved.lookup(1).value(), "one");
+
+    // A moved-from map is still usable
+    original.insert(3, "three");
+    ASSERT_EQ(original.lookup(3).value(), "three");
+}
+
+TEST(CeTuFlatHashMap, StressTest) {
+    static constexpr int elementsCount = 10000;
+
+    CeTuFlatHashMap<int, int> map;
+    for (int i = 0; i < elementsCount; ++i) {
+        map.insert(i, i * 2);
+        ASSERT_EQ(map.size(), i + 1);
+    }
+
+    for (int i = 0; i < elementsCount; i += 2) {
+        map.erase(i);
+    }
+    ASSERT_EQ(map.size(), elementsCount / 2);
+
+    for (int i = 0; i < elementsCount; ++i) {
+        auto value = map.lookup(i);
+        if (i % 2 == 0) {
+            ASSERT_FALSE(value.has_value());
+        } else {
+            ASSERT_TRUE(value.has_value());
+            ASSERT_EQ(*value, i * 2);
+        }
+    }
+}
+
+TEST(CeTuFlatHashMap, ChurnTest) {
+    // Steady-size insert/erase churn must keep reclaiming tombstones
+    CeTuFlatHashMap<std::string, int> map;
+    for (int i = 0; i < 100000; ++i) {
+        map.insert(std::to_string(i), i);
+        if (i >= 100) {
+            map.erase(std::to_string(i - 100));
+        }
+    }
+    ASSERT_EQ(map.size(), 100);
+    for (int i = 100000 - 100; i < 100000; ++i) {
+        ASSERT_EQ(map.lookup(std::to_string(i)).value(), i);
+    }
+}
+
+// Sends every key to the same bucket / probe sequence
+struct ConstantHash {
+    size_t operator()(int) const { return 42; }
+};
+
+// Used as is, without the CeTuDetail::mix finalizer
+struct AvalanchingIntHash {
+    using is_avalanching = void;
+    size_t operator()(int key) const { return CeTuDetail::mix(static_cast<uint64_t>(key)); }
+};
+
+TEST(CeTuHashMap, CustomHashTest) {
+    static constexpr int elementsCount = 500;
+
+    CeTuHashMap<int, int, ConstantHash> collidingMap;
+    CeTuHashMap<int, int, AvalanchingIntHash> avalanchingMap;
+    for (int i = 0; i < elementsCount; ++i) {
+        collidingMap.insert(i, i);
+        avalanchingMap.insert(i, i);
+    }
+    for (int i = 0; i < elementsCount; i += 2) {
+        collidingMap.erase(i);
+        avalanchingMap.erase(i);
+    }
+    for (int i = 0; i < elementsCount; ++i) {
+        ASSERT_EQ(collidingMap.lookup(i).has_value(), i % 2 == 1);
+        ASSERT_EQ(avalanchingMap.lookup(i).has_value(), i % 2 == 1);
+    }
+}
+
+TEST(CeTuFlatHashMap, CustomHashTest) {
+    static constexpr int elementsCount = 500;
+
+    CeTuFlatHashMap<int, int, ConstantHash> collidingMap;
+    CeTuFlatHashMap<int, int, AvalanchingIntHash> avalanchingMap;
+    for (int i = 0; i < elementsCount; ++i) {
+        collidingMap.insert(i, i);
+        avalanchingMap.insert(i, i);
+    }
+    for (int i = 0; i < elementsCount; i += 2) {
+        collidingMap.erase(i);
+        avalanchingMap.erase(i);
+    }
+    for (int i = 0; i < elementsCount; ++i) {
+        ASSERT_EQ(collidingMap.lookup(i).has_value(), i % 2 == 1);
+        ASSERT_EQ(avalanchingMap.lookup(i).has_value(), i % 2 == 1);
+    }
+    ASSERT_EQ(collidingMap.size(), elementsCount / 2);
+}
+
+TEST(CeTuHashMap, TransparentLookupTest) {
+    static const std::string longKey(64, 'k');
+
+    CeTuHashMap<std::string, int, CeTuStringHash, std::equal_to<>> map;
+    map.insert(longKey, 1);
+    map.insert("pi", 2);
+
+    // None of these construct a std::string
+    size_t allocations = allocationCount;
+    auto byView = map.lookup(std::string_view(longKey));
+    auto byPointer = map.lookup(longKey.c_str());
+    auto byLiteral = map.lookup("pi");
+    auto missing = map.lookup(std::string_view("a missing key that does not fit into SSO"));
+    map.erase(std::string_view("pi"));
+    ASSERT_EQ(allocationCount, allocations);
+
+    ASSERT_EQ(byView.value(), 1);
+    ASSERT_EQ(byPointer.value(), 1);
+    ASSERT_EQ(byLiteral.value(), 2);
+    ASSERT_FALSE(missing.has_value());
+    ASSERT_FALSE(map.lookup("pi").has_value());
+    ASSERT_EQ(map.size(), 1);
+}
+
+TEST(CeTuFlatHashMap, TransparentLookupTest) {
+    static const std::string longKey(64, 'k');
+
+    CeTuFlatHashMap<std::string, int, CeTuStringHash, std::equal_to<>> map;
+    map.insert(longKey, 1);
+    map.insert("pi", 2);
+
+    // None of these construct a std::string
+    size_t allocations = allocationCount;
+    auto byView = map.lookup(std::string_view(longKey));
+    auto byPointer = map.lookup(longKey.c_str());
+    auto byLiteral = map.lookup("pi");
+    auto missing = map.lookup(std::string_view("a missing key that does not fit into SSO"));
+    map.erase(std::string_view("pi"));
+    ASSERT_EQ(allocationCount, allocations);
+
+    ASSERT_EQ(byView.value(), 1);
+    ASSERT_EQ(byPointer.value(), 1);
+    ASSERT_EQ(byLiteral.value(), 2);
+    ASSERT_FALSE(missing.has_value());
+    ASSERT_FALSE(map.lookup("pi").has_value());
+    ASSERT_EQ(map.size(), 1);
+}
+
+// Reads through a const reference, as a map passed by const& must allow
+template<typename Map>
+int sumValues(const Map& map, int count) {
+    int sum = 0;
+    for (int i = 0; i < count; ++i) {
+        if (const int* value = map.find(i)) {
+            sum += *value;
+        }
+        if (map.contains(i)) {
+            sum += map.lookup(i).value();
+        }
+    }
+    return sum;
+}
+
+TEST(CeTuHashMap, FindAndContainsTest) {
+    CeTuHashMap<int, std::vector<int>> map;
+    map.insert(1, std::vector<int>(100, 1));
+
+    // find() hands out the stored value, so it can be modified in place
+    std::vector<int>* values = map.find(1);
+    ASSERT_NE(values, nullptr);
+    values->push_back(2);
+    ASSERT_EQ(map.lookup(1).value().size(), 101);
+
+    ASSERT_EQ(map.find(2), nullptr);
+    ASSERT_TRUE(map.contains(1));
+    ASSERT_FALSE(map.contains(2));
+
+    CeTuHashMap<int, int> intMap;
+    intMap.insert(1, 10);
+    intMap.insert(2, 20);
+    ASSERT_EQ(sumValues(intMap, 3), 60);
+
+    CeTuHashMap<std::string, int, CeTuStringHash, std::equal_to<>> stringMap;
+    stringMap.insert("pi", 3);
+    ASSERT_TRUE(stringMap.contains(std::string_view("pi")));
+    ASSERT_EQ(*stringMap.find("pi"), 3);
+}
+
+TEST(CeTuFlatHashMap, FindAndContainsTest) {
+    CeTuFlatHashMap<int, std::vector<int>> map;
+    map.insert(1, std::vector<int>(100, 1));
+
+    // find() hands out the stored value, so it can be modified in place
+    std::vector<int>* values = map.find(1);
+    ASSERT_NE(values, nullptr);
+    values->push_back(2);
+    ASSERT_EQ(map.lookup(1).value().size(), 101);
+
+    ASSERT_EQ(map.find(2), nullptr);
+    ASSERT_TRUE(map.contains(1));
+    ASSERT_FALSE(map.contains(2));
+
+    CeTuFlatHashMap<int, int> intMap;
+    intMap.insert(1, 10);
+    intMap.insert(2, 20);
+    ASSERT_EQ(sumValues(intMap, 3), 60);
+
+    CeTuFlatHashMap<std::string, int, CeTuStringHash, std::equal_to<>> stringMap;
+    stringMap.insert("pi", 3);
+    ASSERT_TRUE(stringMap.contains(std::string_view("pi")));
+    ASSERT_EQ(*stringMap.find("pi"), 3);
+}
+
+// Counts how many values were constructed
+struct CountedValue {
+    static inline int constructed = 0;
+
+    explicit CountedValue(int _value = 0) : value(_value) { constructed++; }
+    CountedValue(const CountedValue& other) : value(other.value) { constructed++; }
+    CountedValue(CountedValue&& other) noexcept : value(other.value) { constructed++; }
+    CountedValue& operator=(const CountedValue&) = default;
+    CountedValue& operator=(CountedValue&&) = default;
+
+    int value;
+};
+
+// Copying throws once copiesLeft reaches zero; moving may throw, so maps copy it
+struct FragileValue {
+    static inline int copiesLeft = -1;
+    int value = 0;
+
+    FragileValue(int _value) : value(_value) {}
+    FragileValue(const FragileValue& other) : value(other.value) {
+        if (copiesLeft == 0) {
+            throw std::runtime_error("copy failed");
+        }
+        --copiesLeft;
+    }
+    FragileValue(FragileValue&& other) noexcept(false) : value(other.value) {}
+    FragileValue& operator=(const FragileValue&) = default;
+    FragileValue& operator=(FragileValue&&) noexcept(false) = default;
+};
+
+// Fills the table right up to its load limit, then makes the insert that grows it fail
+// halfway through copying the entries
+template<template<typename...> typename Map>
+void testFailedGrowth() {
+    Map<int, FragileValue> map;
+    map.insert(0, FragileValue(0));
+    int count = 1;
+    while (count + 1 <= map.bucket_count() * 0.875) {
+        map.insert(count, FragileValue(count));
+        ++count;
+    }
+    ASSERT_GT(count, 2);
+    FragileValue::copiesLeft = count / 2;
+    ASSERT_THROW(map.insert(count, FragileValue(count)), std::runtime_error);
+    FragileValue::copiesLeft = -1;
+    ASSERT_EQ(map.size(), static_cast<size_t>(count));
+    for (int i = 0; i < count; ++i) {
+        ASSERT_EQ(map.find(i)->value, i);
+    }
+    map.insert(count, FragileValue(count));
+    ASSERT_EQ(map.find(count)->value, count);
+}
+
+// A copy assignment that fails partway leaves the target as it was
+template<template<typename...> typename Map>
+void testFailedAssignment() {
+    Map<int, FragileValue> target;
+    for (int i = 0; i < 10; ++i) {
+        target.insert(i, FragileValue(i));
+    }
+    Map<int, FragileValue> source;
+    for (int i = 0; i < 1000; ++i) {
+        source.insert(-i, FragileValue(-i));
+    }
+    FragileValue::copiesLeft = 500;
+    ASSERT_THROW(target = source, std::runtime_error);
+    FragileValue::copiesLeft = -1;
+    ASSERT_EQ(target.size(), 10u);
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(target.find(i)->value, i);
+    }
+    ASSERT_FALSE(target.contains(-999));
+
+    target = source;
+    ASSERT_EQ(target.size(), 1000u);
+    ASSERT_EQ(target.find(-999)->value, -999);
+}
+
+template<template<typename...> typename Map>
+void testInPlaceInsertion() {
+    Map<std::string, CountedValue> map;
+
+    CountedValue::constructed = 0;
+    auto [value, inserted] = map.try_emplace("key", 1);
+    ASSERT_TRUE(inserted);
+    ASSERT_EQ(value->value, 1);
+    ASSERT_EQ(CountedValue::constructed, 1);
+
+    // The key exists, so no value is built at all
+    auto [existing, insertedAgain] = map.try_emplace("key", 2);
+    ASSERT_FALSE(insertedAgain);
+    ASSERT_EQ(existing, value);
+    ASSERT_EQ(existing->value, 1);
+    ASSERT_EQ(CountedValue::constructed, 1);
+
+    auto [emplaced, emplacedInserted] = map.emplace("other", 3);
+    ASSERT_TRUE(emplacedInserted);
+    ASSERT_EQ(emplaced->value, 3);
+
+    auto [assigned, assignedInserted] = map.insert_or_assign("key", CountedValue(4));
+    ASSERT_FALSE(assignedInserted);
+    ASSERT_EQ(assigned->value, 4);
+    ASSERT_EQ(map.find("key")->value, 4);
+
+    map["third"].value = 5;
+    ASSERT_EQ(map.find("third")->value, 5);
+    ASSERT_EQ(map["key"].value, 4);
+    ASSERT_EQ(map.size(), 3);
+}
+
+template<template<typename...> typename Map>
+void testMoveOnlyValues() {
+    static constexpr int elementsCount = 100;
+
+    Map<int, std::unique_ptr<int>> map;
+    for (int i = 0; i < elementsCount; ++i) {
+        map.insert(i, std::make_unique<int>(i));
+    }
+    map.insert(0, std::make_unique<int>(-1));
+    map.insert_or_assign(1, std::make_unique<int>(-2));
+    map.try_emplace(2, std::make_unique<int>(-3));
+    ASSERT_EQ(map.size(), elementsCount);
+
+    ASSERT_EQ(**map.find(0), -1);
+    ASSERT_EQ(**map.find(1), -2);
+    ASSERT_EQ(**map.find(2), 2);
+    for (int i = 3; i < elementsCount; ++i) {
+        ASSERT_EQ(**map.find(i), i);
+    }
+
+    Map<int, std::unique_ptr<int>> moved = std::move(map);
+    ASSERT_EQ(moved.size(), elementsCount);
+    static_assert(!std::is_copy_constructible_v<Map<int, std::unique_ptr<int>>>);
+
+    // A moved-from map is still usable
+    map[7] = std::make_unique<int>(7);
+    ASSERT_EQ(**map.find(7), 7);
+}
+
+TEST(CeTuHashMap, InPlaceInsertionTest) {
+    testInPlaceInsertion<CeTuHashMap>();
+}
+
+TEST(CeTuHashMap, MoveOnlyValueTest) {
+    testMoveOnlyValues<CeTuHashMap>();
+}
+
+TEST(CeTuFlatHashMap, InPlaceInsertionTest) {
+    testInPlaceInsertion<CeTuFlatHashMap>();
+}
+
+TEST(CeTuFlatHashMap, MoveOnlyValueTest) {
+    testMoveOnlyValues<CeTuFlatHashMap>();
+}
+
+TEST(CeTuHashMap, FailedAssignmentTest) {
+    testFailedAssignment<CeTuHashMap>();
+}
+
+TEST(CeTuFlatHashMap, FailedGrowthTest) {
+    testFailedGrowth<CeTuFlatHashMap>();
+}
+
+TEST(CeTuFlatHashMap, FailedAssignmentTest) {
+    testFailedAssignment<CeTuFlatHashMap>();
+}
+
+struct AllocationCounters {
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t constructions = 0;
+};
+
+// Forwards to std::allocator and records the traffic in shared counters
+template<typename T>
+struct CountingAllocator {
+    using value_type = T;
+    using Counters = AllocationCounters;
+
+    explicit CountingAllocator(Counters* _counters) : counters(_counters) {}
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : counters(other.counters) {}
+
+    T* allocate(size_t n) { counters->allocations++; return std::allocator<T>().allocate(n); }
+    void deallocate(T* ptr, size_t n) { counters->deallocations++; std::allocator<T>().deallocate(ptr, n); }
+
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        counters->constructions++;
+        ::new(static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+    }
+
+    template<typename U>
+    bool operator==(const CountingAllocator<U>& other) const { return counters == other.counters; }
+
+    Counters* counters;
+};
+
+TEST(CeTuHashMap, AllocatorTest) {
+    static constexpr int elementsCount = 1000;
+
+    using Allocator = CountingAllocator<std::pair<const int, std::string>>;
+    Allocator::Counters counters;
+    {
+        CeTuHashMap<int, std::string, std::hash<int>, std::equal_to<int>, Allocator> map{Allocator(&counters)};
+        for (int i = 0; i < elementsCount; ++i) {
+            map.insert(i, std::to_string(i));
+        }
+        ASSERT_EQ(counters.constructions, elementsCount);
+
+        // Nodes come from slabs, so there are far fewer allocations than entries
+        size_t allocations = counters.allocations;
+        ASSERT_LT(allocations, 50);
+
+        // Erased nodes are recycled without going back to the allocator
+        for (int i = 0; i < elementsCount; ++i) {
+            map.erase(i);
+            map.insert(i + elementsCount, std::to_string(i));
+        }
+        ASSERT_LT(counters.allocations, allocations + 5);
+
+        auto copy = map;
+        ASSERT_EQ(copy.size(), elementsCount);
+        ASSERT_EQ(copy.lookup(elementsCount).value(), "0");
+        ASSERT_EQ(copy.get_allocator(), map.get_allocator());
+
+        map = copy;
+        ASSERT_EQ(map.size(), elementsCount);
+        ASSERT_EQ(map.lookup(2 * elementsCount - 1).value(), std::to_string(elementsCount - 1));
+    }
+    ASSERT_EQ(counters.allocations, counters.deallocations);
+}
+
+TEST(CeTuHashMap, NodePoolChurnTest) {
+    CeTuHashMap<int, std::unique_ptr<int>> map;
+    for (int i = 0; i < 100000; ++i) {
+        map.insert(i, std::make_unique<int>(i));
+        if (i >= 100) {
+            map.erase(i - 100);
+        }
+    }
+    ASSERT_EQ(map.size(), 100);
+    for (int i = 100000 - 100; i < 100000; ++i) {
+        ASSERT_EQ(**map.find(i), i);
+    }
+}
+
+template<typename Map>
+void testCapacityManagement() {
+    static constexpr size_t elementsCount = 10000;
+
+    // Neither a presized map nor a reserved one rehashes while it is filled
+    Map presized(elementsCount);
+    size_t buckets = presized.bucket_count();
+    ASSERT_GE(buckets * presized.max_load_factor(), elementsCount);
+    Map reserved;
+    reserved.reserve(elementsCount);
+    ASSERT_EQ(reserved.bucket_count(), buckets);
+    for (size_t i = 0; i < elementsCount; ++i) {
+        presized.insert(i, i);
+        reserved.insert(i, i);
+    }
+    ASSERT_EQ(presized.bucket_count(), buckets);
+    ASSERT_EQ(reserved.bucket_count(), buckets);
+    ASSERT_LE(presized.load_factor(), presized.max_load_factor());
+
+    // A lower limit grows the map right away
+    reserved.max_load_factor(0.25f);
+    ASSERT_LE(reserved.load_factor(), 0.25f);
+    ASSERT_GT(reserved.bucket_count(), buckets);
+    ASSERT_THROW(reserved.max_load_factor(0.0f), std::invalid_argument);
+
+    // Drain and give the memory back
+    for (size_t i = 10; i < elementsCount; ++i) {
+        reserved.erase(i);
+    }
+    reserved.shrink_to_fit();
+    ASSERT_LE(reserved.bucket_count(), 64);
+    for (size_t i = 0; i < elementsCount; ++i) {
+        ASSERT_EQ(reserved.contains(i), i < 10);
+    }
+
+    // rehash() never goes below what size() needs
+    reserved.rehash(1 << 12);
+    ASSERT_EQ(reserved.bucket_count(), 1 << 12);
+    reserved.rehash(1);
+    ASSERT_GE(reserved.bucket_count() * reserved.max_load_factor(), reserved.size());
+    ASSERT_EQ(reserved.lookup(9).value(), 9);
+}
+
+TEST(CeTuHashMap, CapacityManagementTest) {
+    testCapacityManagement<CeTuHashMap<size_t, size_t>>();
+}
+
+TEST(CeTuHashMap, ShrinkToFitReleasesNodesTest) {
+    using Allocator = CountingAllocator<std::pair<const int, int>>;
+    AllocationCounters counters;
+    CeTuHashMap<int, int, std::hash<int>, std::equal_to<int>, Allocator> map{Allocator(&counters)};
+    for (int i = 0; i < 100000; ++i) {
+        map.insert(i, i);
+    }
+    for (int i = 10; i < 100000; ++i) {
+        map.erase(i);
+    }
+
+    size_t deallocations = counters.deallocations;
+    map.shrink_to_fit();
+    // The old node chunks are freed together
+    ASSERT_GT(counters.deallocations, deallocations + 10);
+    ASSERT_EQ(map.size(), 10);
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(map.lookup(i).value(), i);
+    }
+}
+
+TEST(CeTuFlatHashMap, CapacityManagementTest) {
+    testCapacityManagement<CeTuFlatHashMap<size_t, size_t>>();
+
+    CeTuFlatHashMap<int, int> map;
+    ASSERT_THROW(map.max_load_factor(1.5f), std::invalid_argument);
+    map.max_load_factor(1.0f);
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(i, i);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(map.lookup(i).value(), i);
+    }
+    ASSERT_FALSE(map.contains(1000));
+}
+
+TEST(CeTuHashMap, IncrementalRehashTest) {
+    CeTuHashMap<int, std::string> map;
+    map.set_incremental_rehash(true);
+    ASSERT_TRUE(map.incremental_rehash());
+
+    bool sawMigration = false;
+    for (int i = 0; i < 20000; ++i) {
+        map.insert(i, std::to_string(i));
+        if (map.rehashing()) {
+            sawMigration = true;
+            // Keys in migrated and not yet migrated buckets are both reachable
+            ASSERT_EQ(map.lookup(i / 2).value(), std::to_string(i / 2));
+            ASSERT_TRUE(map.contains(0));
+        }
+    }
+    ASSERT_TRUE(sawMigration);
+
+    // Erase and copy in the middle of a migration
+    while (!map.rehashing()) {
+        map.insert(static_cast<int>(map.size()), std::to_string(map.size()));
+    }
+    int count = static_cast<int>(map.size());
+    for (int i = 0; i < count; i += 2) {
+        map.erase(i);
+    }
+    CeTuHashMap<int, std::string> copied(map);
+    CeTuHashMap<int, std::string> moved(std::move(map));
+    for (auto* m : {&copied, &moved}) {
+        ASSERT_EQ(m->size(), static_cast<size_t>(count / 2));
+        for (int i = 0; i < count; ++i) {
+            ASSERT_EQ(m->contains(i), i % 2 == 1);
+        }
+    }
+
+    // Disabling finishes the migration
+    copied.set_incremental_rehash(false);
+    ASSERT_FALSE(copied.rehashing());
+    for (int i = 1; i < count; i += 2) {
+        ASSERT_EQ(*copied.find(i), std::to_string(i));
+    }
+}
+
+static_assert(CeTuStoreHash<std::string>::value);
+static_assert(!CeTuStoreHash<int>::value);
+
+size_t stringHashCalls = 0;
+
+struct CountingStringHash {
+    size_t operator()(const std::string& key) const {
+        ++stringHashCalls;
+        return std::hash<std::string>{}(key);
+    }
+};
+
+// With stored hashes every key is hashed once on insertion, however often the map grows
+template<template<typename...> typename Map>
+void testStoredHash() {
+    Map<std::string, int, CountingStringHash> map;
+    stringHashCalls = 0;
+    for (int i = 0; i < 10000; ++i) {
+        map.insert(std::to_string(i), i);
+    }
+    ASSERT_EQ(stringHashCalls, 10000u);
+
+    Map<std::string, int, CountingStringHash> copied(map);
+    copied.rehash(copied.bucket_count() * 4);
+    ASSERT_EQ(stringHashCalls, 10000u);
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_EQ(copied.lookup(std::to_string(i)).value(), i);
+    }
+}
+
+TEST(CeTuHashMap, StoredHashTest) {
+    testStoredHash<CeTuHashMap>();
+}
+
+TEST(CeTuFlatHashMap, StoredHashTest) {
+    testStoredHash<CeTuFlatHashMap>();
+}
+
+TEST(CeTuConcurrentHashMap, ConcurrentAccessTest) {
+    static constexpr int threadsCount = 8;
+    static constexpr int perThread = 5000;
+
+    ASSERT_THROW((CeTuConcurrentHashMap<int, int>(0)), std::invalid_argument);
+    CeTuConcurrentHashMap<int, int> map(12);
+    ASSERT_EQ(map.shard_count(), 16);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadsCount; ++t) {
+        threads.emplace_back([&map, t] {
+            for (int i = t * perThread; i < (t + 1) * perThread; ++i) {
+                map.insert(i, i);
+                ASSERT_EQ(map.lookup(i).value(), i);
+            }
+            for (int i = t * perThread; i < (t + 1) * perThread; i += 2) {
+                map.erase(i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(map.size(), static_cast<size_t>(threadsCount * perThread / 2));
+    for (int i = 0; i < threadsCount * perThread; ++i) {
+        ASSERT_EQ(map.contains(i), i % 2 == 1);
+    }
+}
+
+TEST(CeTuConcurrentHashMap, AtomicUpdateTest) {
+    static constexpr int threadsCount = 8;
+    static constexpr int keysCount = 100;
+    static constexpr int rounds = 200;
+
+    CeTuConcurrentHashMap<std::string, int> counters;
+    CeTuConcurrentHashMap<int, int> computed;
+    std::atomic<int> computeCalls{0};
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadsCount; ++t) {
+        threads.emplace_back([&] {
+            for (int round = 0; round < rounds; ++round) {
+                for (int key = 0; key < keysCount; ++key) {
+                    counters.insert_or_update(std::to_string(key), [](int& count) { ++count; });
+                    int value = computed.compute_if_absent(key, [&] { computeCalls++; return key * 3; });
+                    ASSERT_EQ(value, key * 3);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(computeCalls.load(), keysCount);
+    for (int key = 0; key < keysCount; ++key) {
+        ASSERT_EQ(counters.lookup(std::to_string(key)).value(), threadsCount * rounds);
+    }
+    ASSERT_TRUE(counters.insert_or_update("new", [](int& count) { count = 7; }));
+    ASSERT_EQ(counters.lookup("new").value(), 7);
+}
+
+TEST(CeTuReadMostlyHashMap, BasicOperationsTest) {
+    CeTuReadMostlyHashMap<std::string, int> map;
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(std::to_string(i), i);
+    }
+    map.insert("5", 50);
+    map.erase("6");
+    map.erase("missing");
+
+    ASSERT_EQ(map.size(), 999);
+    ASSERT_EQ(map.lookup("5").value(), 50);
+    ASSERT_FALSE(map.contains("6"));
+    for (int i = 7; i < 1000; ++i) {
+        ASSERT_EQ(map.lookup(std::to_string(i)).value(), i);
+    }
+    size_t length = 0;
+    ASSERT_TRUE(map.visit("999", [&length](const int& value) { length = std::to_string(value).size(); }));
+    ASSERT_EQ(length, 3);
+}
+
+TEST(CeTuReadMostlyHashMap, ConcurrentReadersTest) {
+    static constexpr int readersCount = 6;
+    static constexpr int keysCount = 2000;
+
+    CeTuReadMostlyHashMap<int, std::string> map;
+    for (int i = 0; i < keysCount; i += 2) {
+        map.insert(i, std::to_string(i));
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<bool> consistent{true};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < readersCount; ++r) {
+        readers.emplace_back([&] {
+            while (!done.load()) {
+                for (int i = 0; i < keysCount; ++i) {
+                    // Values always describe their key, whatever version is seen
+                    auto value = map.lookup(i);
+                    if (value && value->substr(0, value->find(':')) != std::to_string(i)) {
+                        consistent = false;
+                    }
+                }
+            }
+        });
+    }
+
+    // Updates, erases and the resizes they trigger run under the readers
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < keysCount; ++i) {
+            map.insert(i, std::to_string(i) + ":" + std::to_string(round));
+        }
+        for (int i = 1; i < keysCount; i += 2) {
+            map.erase(i);
+        }
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    ASSERT_TRUE(consistent.load());
+    ASSERT_EQ(map.size(), static_cast<size_t>(keysCount / 2));
+    ASSERT_EQ(map.lookup(10).value(), "10:2");
+}
+
+template<template<typename...> typename Map>
+void testBatchOperations() {
+    static constexpr int keysCount = 1000;
+
+    std::vector<std::string> keys;
+    std::vector<int> values;
+    for (int i = 0; i < keysCount; ++i) {
+        keys.push_back(std::to_string(i));
+        values.push_back(i);
+    }
+    Map<std::string, int> map;
+    map.insert("0", -1);
+    map.insert_batch(keys, values);
+    ASSERT_EQ(map.size(), static_cast<size_t>(keysCount));
+
+    std::vector<int*> found(keysCount);
+    map.lookup_batch(keys, found);
+    for (int i = 0; i < keysCount; ++i) {
+        ASSERT_EQ(*found[i], i);
+    }
+
+    std::vector<std::string> erased(keys.begin(), keys.begin() + keysCount / 2);
+    erased.push_back("missing");
+    map.erase_batch(erased);
+    ASSERT_EQ(map.size(), static_cast<size_t>(keysCount / 2));
+
+    const auto& constMap = map;
+    std::vector<const int*> constFound(keysCount);
+    constMap.lookup_batch(keys, constFound);
+    for (int i = 0; i < keysCount; ++i) {
+        ASSERT_EQ(constFound[i] == nullptr, i < keysCount / 2);
+    }
+    ASSERT_THROW(map.lookup_batch(keys, std::span<int*>(found.data(), 1)), std::invalid_argument);
+    ASSERT_THROW(map.insert_batch(keys, std::span<const int>(values.data(), 1)), std::invalid_argument);
+}
+
+TEST(CeTuHashMap, BatchOperationsTest) {
+    testBatchOperations<CeTuHashMap>();
+}
+
+TEST(CeTuFlatHashMap, BatchOperationsTest) {
+    testBatchOperations<CeTuFlatHashMap>();
+}
+
+TEST(CeTuHashMap, BuildFromTest) {
+    static constexpr int entriesCount = 100000;
+
+    std::vector<std::pair<std::string, int>> entries;
+    for (int i = 0; i < entriesCount; ++i) {
+        entries.emplace_back(std::to_string(i % (entriesCount / 2)), i);
+    }
+
+    for (size_t threads : {1, 3, 8}) {
+        auto map = CeTuHashMap<std::string, int>::build_from(entries, threads);
+        ASSERT_EQ(map.size(), static_cast<size_t>(entriesCount / 2));
+        // The later duplicate wins
+        for (int i = 0; i < entriesCount / 2; ++i) {
+            ASSERT_EQ(map.lookup(std::to_string(i)).value(), i + entriesCount / 2);
+        }
+        map.insert("new", 1);
+        map.erase("0");
+        ASSERT_EQ(map.size(), static_cast<size_t>(entriesCount / 2));
+    }
+
+    std::vector<std::pair<int, int>> empty;
+    ASSERT_EQ((CeTuHashMap<int, int>::build_from(empty, 4).size()), 0);
+}
+
+TEST(CeTuHashMap, ParallelRehashTest) {
+    static constexpr int elementsCount = 200000;
+
+    CeTuHashMap<int, int> map;
+    map.set_rehash_threads(4);
+    ASSERT_EQ(map.rehash_threads(), 4);
+    for (int i = 0; i < elementsCount; ++i) {
+        map.insert(i, i);
+    }
+    map.rehash(map.bucket_count() * 4);
+    for (int i = 0; i < elementsCount; ++i) {
+        ASSERT_EQ(map.lookup(i).value(), i);
+    }
+
+    for (int i = 0; i < elementsCount; i += 4) {
+        map.erase(i);
+    }
+    map.shrink_to_fit();
+    ASSERT_EQ(map.size(), static_cast<size_t>(elementsCount / 4 * 3));
+    for (int i = 0; i < elementsCount; ++i) {
+        ASSERT_EQ(map.contains(i), i % 4 != 0);
+    }
+}
+
+TEST(CeTuMappedHashMap, TrivialSnapshotTest) {
+    const auto path = std::filesystem::temp_directory_path() / ("cetu_trivial_" + std::to_string(::getpid()) + ".snap");
+
+    CeTuFlatHashMap<int, double> map;
+    for (int i = 0; i < 10000; ++i) {
+        map.insert(i, i * 0.5);
+    }
+    CeTuMappedHashMap<int, double>::save(map, path);
+
+    auto mapped = CeTuMappedHashMap<int, double>::open(path);
+    ASSERT_EQ(mapped.size(), map.size());
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_EQ(mapped.lookup(i).value(), i * 0.5);
+    }
+    ASSERT_FALSE(mapped.contains(-1));
+    ASSERT_FALSE(mapped.lookup(10000).has_value());
+
+    // Other value types or a damaged header are rejected
+    ASSERT_THROW((CeTuMappedHashMap<int, int>::open(path)), std::runtime_error);
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(offsetof(CeTuDetail::SnapshotHeader, capacity));
+        uint64_t capacity = 3;
+        file.write(reinterpret_cast<const char*>(&capacity), sizeof(capacity));
+    }
+    ASSERT_THROW((CeTuMappedHashMap<int, double>::open(path)), std::runtime_error);
+    // The mapping survives the file being replaced
+    ASSERT_EQ(mapped.lookup(42).value(), 21.0);
+
+    std::filesystem::remove(path);
+    ASSERT_THROW((CeTuMappedHashMap<int, double>::open(path)), std::system_error);
+}
+
+TEST(CeTuMappedHashMap, StringSnapshotTest) {
+    const auto path = std::filesystem::temp_directory_path() / ("cetu_strings_" + std::to_string(::getpid()) + ".snap");
+
+    CeTuHashMap<std::string, std::string> map;
+    for (int i = 0; i < 5000; ++i) {
+        map.insert("key" + std::to_string(i), std::string(i % 50, 'v'));
+    }
+    map.insert("", "empty key");
+    CeTuMappedHashMap<std::string, std::string>::save(map, path);
+
+    CeTuMappedHashMap<std::string, std::string> mapped = CeTuMappedHashMap<std::string, std::string>::open(path);
+    CeTuMappedHashMap<std::string, std::string> moved(std::move(mapped));
+    ASSERT_EQ(moved.size(), 5001);
+    for (int i = 0; i < 5000; ++i) {
+        ASSERT_EQ(moved.lookup("key" + std::to_string(i)).value(), std::string(i % 50, 'v'));
+    }
+    ASSERT_EQ(moved.lookup("").value(), "empty key");
+    ASSERT_FALSE(moved.contains("key5000"));
+    std::filesystem::remove(path);
+}
+
+template<template<typename...> typename Map>
+void testIteration() {
+    Map<int, int> map;
+    for (auto [key, value] : map) {
+        FAIL() << key << value;
+    }
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(i, i);
+    }
+    map.erase(500);
+
+    // Values can be updated through the iterator
+    for (auto [key, value] : map) {
+        value += key;
+    }
+    std::vector<bool> seen(1000);
+    size_t count = 0;
+    const Map<int, int>& constMap = map;
+    for (auto it = constMap.begin(); it != constMap.end(); ++it) {
+        ASSERT_EQ(it->second, 2 * it->first);
+        ASSERT_FALSE(seen[it->first]);
+        seen[it->first] = true;
+        ++count;
+    }
+    ASSERT_EQ(count, 999u);
+    ASSERT_FALSE(seen[500]);
+    ASSERT_TRUE(map.cbegin() == map.begin());
+}
+
+TEST(CeTuHashMap, IterationTest) {
+    testIteration<CeTuHashMap>();
+
+    // Both bucket arrays are visited in the middle of a migration
+    CeTuHashMap<int, int> map;
+    map.set_incremental_rehash(true);
+    while (!map.rehashing()) {
+        map.insert(static_cast<int>(map.size()), 0);
+    }
+    ASSERT_EQ(static_cast<size_t>(std::distance(map.begin(), map.end())), map.size());
+}
+
+TEST(CeTuFlatHashMap, IterationTest) {
+    testIteration<CeTuFlatHashMap>();
+}
+
+template<template<typename...> typename Map>
+void testSerialization() {
+    Map<std::string, int> map;
+    for (int i = 0; i < 10000; ++i) {
+        map.insert(std::string(i % 40, 'k') + std::to_string(i), i);
+    }
+    map.insert("", -1);
+
+    std::stringstream stream;
+    map.serialize(stream);
+    const std::string bytes = stream.str();
+    Map<std::string, int> restored = Map<std::string, int>::deserialize(stream);
+    ASSERT_EQ(restored.size(), map.size());
+    for (auto [key, value] : map) {
+        ASSERT_EQ(restored.lookup(key).value(), value);
+    }
+
+    Map<int, double> empty;
+    std::stringstream emptyStream;
+    empty.serialize(emptyStream);
+    ASSERT_EQ((Map<int, double>::deserialize(emptyStream).size()), 0u);
+
+    // Truncated and corrupted streams are rejected
+    std::stringstream truncated(bytes.substr(0, bytes.size() / 2));
+    ASSERT_THROW((Map<std::string, int>::deserialize(truncated)), std::runtime_error);
+    std::string corrupt = bytes;
+    corrupt[0] = 'X';
+    std::stringstream corrupted(corrupt);
+    ASSERT_THROW((Map<std::string, int>::deserialize(corrupted)), std::runtime_error);
+    // A corrupt entry count must not be reserved up front
+    std::string huge = bytes;
+    const uint64_t hugeCount = std::numeric_limits<uint64_t>::max();
+    std::memcpy(huge.data() + sizeof(CeTuDetail::serializationMagic) + sizeof(uint32_t), &hugeCount, sizeof(hugeCount));
+    std::stringstream hugeStream(huge);
+    ASSERT_THROW((Map<std::string, int>::deserialize(hugeStream)), std::runtime_error);
+}
+
+TEST(CeTuHashMap, SerializationTest) {
+    testSerialization<CeTuHashMap>();
+}
+
+TEST(CeTuFlatHashMap, SerializationTest) {
+    testSerialization<CeTuFlatHashMap>();
+}
+
+TEST(CeTuSnapshotHashMap, BasicOperationsTest) {
+    CeTuSnapshotHashMap<std::string, int> map;
+    for (int i = 0; i < 10000; ++i) {
+        map.insert(std::to_string(i), i);
+    }
+    map.insert("5", -5);
+    for (int i = 0; i < 10000; i += 2) {
+        map.erase(std::to_string(i));
+    }
+    map.erase("absent");
+    ASSERT_EQ(map.size(), 5000u);
+    ASSERT_GT(map.chunk_count(), 10000u / 16);
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_EQ(map.contains(std::to_string(i)), i % 2 == 1);
+    }
+    ASSERT_EQ(*map.find("5"), -5);
+
+    CeTuSnapshotHashMap<std::string, int> moved(std::move(map));
+    ASSERT_EQ(moved.lookup("7").value(), 7);
+    ASSERT_TRUE(map.empty());
+    map.insert("again", 1);
+    ASSERT_EQ(map.size(), 1u);
+}
+
+TEST(CeTuSnapshotHashMap, SnapshotIsolationTest) {
+    CeTuSnapshotHashMap<int, int> map;
+    for (int i = 0; i < 100000; ++i) {
+        map.insert(i, i);
+    }
+
+    // Taking a snapshot allocates nothing, a write afterwards only clones the few nodes on
+    // the path to its chunk and the chunk itself
+    size_t before = allocationCount;
+    CeTuSnapshotHashMap<int, int> snapshot = map.snapshot();
+    ASSERT_EQ(allocationCount, before);
+    map.insert(0, -1);
+    ASSERT_LE(allocationCount - before, 10u);
+    before = allocationCount;
+    map.insert(1, -1);
+    ASSERT_LE(allocationCount - before, 10u);
+
+    for (int i = 100000; i < 200000; ++i) {
+        map.insert(i, i);
+    }
+    for (int i = 0; i < 50000; ++i) {
+        map.erase(i);
+    }
+    ASSERT_EQ(snapshot.size(), 100000u);
+    for (int i = 0; i < 100000; ++i) {
+        ASSERT_EQ(snapshot.lookup(i).value(), i);
+    }
+    ASSERT_FALSE(snapshot.contains(100000));
+    ASSERT_EQ(map.size(), 150000u);
+    ASSERT_FALSE(map.contains(0));
+    ASSERT_EQ(map.lookup(199999).value(), 199999);
+
+    // Writes to the snapshot do not leak back either
+    snapshot.insert(0, 42);
+    ASSERT_FALSE(map.contains(0));
+}
+
+TEST(CeTuSnapshotHashMap, GrowthUnderSnapshotTest) {
+    CeTuSnapshotHashMap<int, CountedValue> map;
+    for (int i = 0; i < 50000; ++i) {
+        map.insert(i, CountedValue(i));
+    }
+    CeTuSnapshotHashMap<int, CountedValue> snapshot = map.snapshot();
+
+    // Tripling the map while the snapshot holds every chunk never copies more than the
+    // chunk a write touches and the halves it may split into
+    int worst = 0;
+    for (int i = 50000; i < 150000; ++i) {
+        CountedValue value(i);
+        CountedValue::constructed = 0;
+        map.insert(i, std::move(value));
+        worst = std::max(worst, CountedValue::constructed);
+    }
+    ASSERT_LE(worst, 64);
+    ASSERT_EQ(map.size(), 150000u);
+    ASSERT_EQ(snapshot.size(), 50000u);
+    size_t visited = 0;
+    snapshot.for_each([&](int key, const CountedValue& value) {
+        ASSERT_EQ(key, value.value);
+        ASSERT_LT(key, 50000);
+        ++visited;
+    });
+    ASSERT_EQ(visited, 50000u);
+    for (int i = 0; i < 150000; i += 101) {
+        ASSERT_EQ(map.find(i)->value, i);
+    }
+}
+
+TEST(CeTuSnapshotHashMap, FailedSplitTest) {
+    CeTuSnapshotHashMap<int, FragileValue> map;
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(i, FragileValue(i));
+    }
+    CeTuSnapshotHashMap<int, FragileValue> snapshot = map.snapshot();
+
+    // Copies out of shared chunks fail now and then; every failed insert leaves the map as
+    // it was, and the next attempt succeeds
+    int failures = 0;
+    for (int i = 1000; i < 3000; ++i) {
+        FragileValue::copiesLeft = i % 7;
+        try {
+            map.insert(i, FragileValue(i));
+        } catch (const std::runtime_error&) {
+            ++failures;
+            FragileValue::copiesLeft = -1;
+            ASSERT_EQ(map.size(), static_cast<size_t>(i));
+            ASSERT_FALSE(map.contains(i));
+            map.insert(i, FragileValue(i));
+        }
+        FragileValue::copiesLeft = -1;
+    }
+    ASSERT_GT(failures, 0);
+    ASSERT_EQ(map.size(), 3000u);
+    for (int i = 0; i < 3000; ++i) {
+        ASSERT_EQ(map.find(i)->value, i);
+    }
+    ASSERT_EQ(snapshot.size(), 1000u);
+}
+
+TEST(CeTuSnapshotHashMap, BackgroundReaderTest) {
+    CeTuSnapshotHashMap<int, int> map;
+    for (int i = 0; i < 10000; ++i) {
+        map.insert(i, 0);
+    }
+
+    // Each round hands a snapshot to a reader while the writer keeps going
+    for (int round = 1; round <= 5; ++round) {
+        CeTuSnapshotHashMap<int, int> snapshot = map.snapshot();
+        std::thread reader([snapshot = std::move(snapshot), round]() {
+            long sum = 0;
+            snapshot.for_each([&sum](int, int value) { sum += value; });
+            ASSERT_EQ(sum, 10000L * (round - 1));
+        });
+        for (int i = 0; i < 10000; ++i) {
+            map.insert(i, round);
+        }
+        for (int i = 10000; i < 10100; ++i) {
+            map.insert(i * round, 0);
+            map.erase(i * round);
+        }
+        reader.join();
+    }
+}
+
+// Refilling a cleared map up to its old size allocates nothing
+template<template<typename...> typename Map>
+void testClear() {
+    Map<int, int> map;
+    for (int round = 0; round < 3; ++round) {
+        size_t before = allocationCount;
+        for (int i = 0; i < 1000; ++i) {
+            map.insert(i, round);
+        }
+        if (round > 0) {
+            ASSERT_EQ(allocationCount, before);
+        }
+        ASSERT_EQ(map.lookup(999).value(), round);
+        size_t buckets = map.bucket_count();
+        map.clear();
+        ASSERT_TRUE(map.empty());
+        ASSERT_FALSE(map.contains(0));
+        ASSERT_EQ(map.bucket_count(), buckets);
+    }
+
+    Map<std::string, std::string> strings;
+    for (int i = 0; i < 100; ++i) {
+        strings.insert(std::to_string(i), std::string(100, 'x'));
+    }
+    strings.clear();
+    strings.insert("a", "b");
+    ASSERT_EQ(strings.size(), 1u);
+    ASSERT_EQ(strings.lookup("a").value(), "b");
+}
+
+TEST(CeTuHashMap, ClearTest) {
+    testClear<CeTuHashMap>();
+
+    // Clearing in the middle of a migration drops the old buckets
+    CeTuHashMap<int, int> map;
+    map.set_incremental_rehash(true);
+    while (!map.rehashing()) {
+        map.insert(static_cast<int>(map.size()), 0);
+    }
+    map.clear();
+    ASSERT_FALSE(map.rehashing());
+    map.insert(1, 1);
+    ASSERT_EQ(map.size(), 1u);
+    ASSERT_EQ(std::distance(map.begin(), map.end()), 1);
+}
+
+TEST(CeTuFlatHashMap, ClearTest) {
+    testClear<CeTuFlatHashMap>();
+}
+
+TEST(CeTuSmallHashMap, InlineStorageTest) {
+    // Neither an empty map nor one within the inline capacity allocates
+    size_t before = allocationCount;
+    {
+        CeTuSmallHashMap<int, int, 4> map;
+        ASSERT_TRUE(map.empty());
+        for (int i = 0; i < 4; ++i) {
+            map.insert(i, i * 10);
+        }
+        map.insert(2, 25);
+        map.erase(0);
+        map.insert(7, 70);
+        ASSERT_TRUE(map.is_inline());
+        ASSERT_EQ(map.size(), 4u);
+        ASSERT_EQ(map.lookup(2).value(), 25);
+        ASSERT_FALSE(map.contains(0));
+        CeTuSmallHashMap<int, int, 4> moved(std::move(map));
+        ASSERT_EQ(*moved.find(7), 70);
+        ASSERT_TRUE(map.empty());
+    }
+    ASSERT_EQ(allocationCount, before);
+}
+
+TEST(CeTuSmallHashMap, SpillTest) {
+    CeTuSmallHashMap<std::string, std::string, 8> map;
+    for (int i = 0; i < 8; ++i) {
+        map.insert(std::to_string(i), std::string(30, 'a' + i));
+    }
+    ASSERT_TRUE(map.is_inline());
+    CeTuSmallHashMap<std::string, std::string, 8> small(map);
+
+    for (int i = 8; i < 100; ++i) {
+        map.insert(std::to_string(i), std::string(30, 'a' + i % 26));
+    }
+    ASSERT_FALSE(map.is_inline());
+    ASSERT_EQ(map.size(), 100u);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(map.lookup(std::to_string(i)).value(), std::string(30, 'a' + i % 26));
+    }
+    map.erase("50");
+    ASSERT_FALSE(map.contains("50"));
+
+    size_t visited = 0;
+    map.for_each([&visited](const std::string&, const std::string&) { ++visited; });
+    ASSERT_EQ(visited, 99u);
+
+    // Copies and assignments across both modes
+    small = map;
+    ASSERT_EQ(small.size(), 99u);
+    CeTuSmallHashMap<std::string, std::string, 8> other;
+    other.insert("x", "y");
+    map = std::move(other);
+    ASSERT_TRUE(map.is_inline());
+    ASSERT_EQ(map.lookup("x").value(), "y");
+    small.clear();
+    ASSERT_TRUE(small.empty());
+}
+
+TEST(CeTuSmallHashMap, FailedSpillTest) {
+    CeTuSmallHashMap<int, FragileValue, 4> map;
+    for (int i = 0; i < 4; ++i) {
+        map.insert(i, FragileValue(i));
+    }
+    // The fifth insert fails while copying the inline entries
+    FragileValue::copiesLeft = 2;
+    ASSERT_THROW(map.insert(4, FragileValue(4)), std::runtime_error);
+    FragileValue::copiesLeft = -1;
+    ASSERT_TRUE(map.is_inline());
+    ASSERT_EQ(map.size(), 4u);
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_EQ(map.find(i)->value, i);
+    }
+    map.insert(4, FragileValue(4));
+    ASSERT_FALSE(map.is_inline());
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_EQ(map.find(i)->value, i);
+    }
+}
+
+static_assert(TriviallyCopyableKeyValue<int, double>);
+static_assert(!TriviallyCopyableKeyValue<std::string, int>);
+
+TEST(CeTuDenseHashMap, RandomOperationsTest) {
+    // Erase shifts entries back, so mixing it with inserts checks that no key is lost
+    CeTuDenseHashMap<uint32_t, uint32_t> map;
+    std::unordered_map<uint32_t, uint32_t> expected;
+    std::mt19937 random(42);
+    for (int i = 0; i < 200000; ++i) {
+        uint32_t key = random() % 5000;
+        if (random() % 3 == 0) {
+            map.erase(key);
+            expected.erase(key);
+        } else {
+            map.insert(key, static_cast<uint32_t>(i));
+            expected[key] = static_cast<uint32_t>(i);
+        }
+    }
+    ASSERT_EQ(map.size(), expected.size());
+    for (uint32_t key = 0; key < 5000; ++key) {
+        auto it = expected.find(key);
+        ASSERT_EQ(map.lookup(key), it == expected.end() ? std::nullopt : std::optional<uint32_t>(it->second));
+    }
+
+    CeTuDenseHashMap<uint32_t, uint32_t> copied(map);
+    CeTuDenseHashMap<uint32_t, uint32_t> moved(std::move(map));
+    ASSERT_TRUE(copied.size() == moved.size() && copied.size() == expected.size());
+    size_t visited = 0;
+    copied.for_each([&](uint32_t key, uint32_t value) {
+        ASSERT_EQ(expected.at(key), value);
+        ++visited;
+    });
+    ASSERT_EQ(visited, expected.size());
+
+    // The moved-from map is empty but usable
+    map.insert(1, 2);
+    ASSERT_EQ(map.lookup(1).value(), 2u);
+    moved.clear();
+    ASSERT_TRUE(moved.empty());
+    ASSERT_FALSE(moved.contains(expected.begin()->first));
+}
+
+struct Point {
+    int x;
+    int y;
+    bool operator==(const Point&) const = default;
+};
+
+struct PointHash {
+    size_t operator()(const Point& point) const { return std::hash<int>{}(point.x) * 31 + std::hash<int>{}(point.y); }
+};
+
+TEST(CeTuDenseHashMap, EmptyKeyTest) {
+    CeTuDenseHashMap<int, int> ints;
+    ASSERT_EQ(ints.empty_key(), std::numeric_limits<int>::max());
+    ASSERT_THROW(ints.insert(std::numeric_limits<int>::max(), 1), std::invalid_argument);
+    ASSERT_FALSE(ints.contains(std::numeric_limits<int>::max()));
+
+    // Keys without a CeTuEmptyKey specialization name their empty key
+    CeTuDenseHashMap<Point, double, PointHash> points(Point{-1, -1}, 1000);
+    size_t buckets = points.bucket_count();
+    for (int i = 0; i < 1000; ++i) {
+        points.insert(Point{i, -i}, i * 0.5);
+    }
+    ASSERT_EQ(points.bucket_count(), buckets);
+    ASSERT_EQ(points.lookup(Point{10, -10}).value(), 5.0);
+    ASSERT_FALSE(points.contains(Point{-1, -1}));
+    ASSERT_THROW(points.insert(Point{-1, -1}, 0.0), std::invalid_argument);
+}
+
+template<template<typename...> typename Map>
+void testStats() {
+    Map<int, int> good;
+    for (int i = 0; i < 2000; ++i) {
+        good.insert(i, i);
+    }
+    for (int i = 0; i < 100; ++i) {
+        good.erase(i);
+    }
+
+    CeTuHashMapStats stats = good.stats();
+    ASSERT_EQ(stats.size, 1900u);
+    ASSERT_EQ(stats.bucketCount, good.bucket_count());
+    size_t counted = stats.overflowEntries;
+    for (size_t count : stats.probeLengths) {
+        counted += count;
+    }
+    ASSERT_EQ(counted, 1900u);
+    ASSERT_EQ(stats.longestProbe, stats.probeLengths.size());
+    ASSERT_LT(stats.longestProbe, 16u);
+    ASSERT_GT(stats.rehashCount, 0u);
+    ASSERT_GT(stats.rehashTime.count(), 0);
+    ASSERT_GT(stats.bucketBytes, 0u);
+    ASSERT_GE(stats.entryBytes, 1900 * 2 * sizeof(int));
+}
+
+TEST(CeTuHashMap, StatsTest) {
+    testStats<CeTuHashMap>();
+    // Every key collides, so all but the first chain's worth end up in the overflow tree
+    CeTuHashMap<int, int, ConstantHash> bad;
+    for (int i = 0; i < 2000; ++i) {
+        bad.insert(i, i);
+    }
+    CeTuHashMapStats badStats = bad.stats();
+    ASSERT_LE(badStats.longestProbe, 8u);
+    ASSERT_EQ(badStats.overflowEntries, 2000u - badStats.longestProbe);
+
+    CeTuHashMap<int, int> map;
+    map.set_incremental_rehash(true);
+    while (!map.rehashing()) {
+        map.insert(static_cast<int>(map.size()), 0);
+    }
+    ASSERT_EQ(map.stats().bucketBytes, (map.bucket_count() * 3 / 2) * sizeof(void*));
+}
+
+TEST(CeTuFlatHashMap, StatsTest) {
+    testStats<CeTuFlatHashMap>();
+    // Every key collides, so the probe lengths run up to about the size
+    CeTuFlatHashMap<int, int, ConstantHash> bad;
+    for (int i = 0; i < 2000; ++i) {
+        bad.insert(i, i);
+    }
+    ASSERT_GT(bad.stats().longestProbe, 2000u / 64);
+    CeTuFlatHashMap<int, int> map;
+    map.insert(1, 1);
+    map.erase(1);
+    ASSERT_LE(map.stats().tombstones, 1u);
+}
+
+TEST(CeTuHashMap, SeededHashTest) {
+    // Same keys, different seeds: the bucket of at least one key differs
+    CeTuDetail::SeededHash<std::hash<int>> first;
+    CeTuDetail::SeededHash<std::hash<int>> second;
+    ASSERT_NE(first.seed, second.seed);
+    CeTuDetail::SeededHash<std::hash<int>> copied = first;
+    bool differs = false;
+    for (int i = 0; i < 64; ++i) {
+        ASSERT_EQ(copied(i), first(i));
+        differs = differs || (first(i) & 1023) != (second(i) & 1023);
+    }
+    ASSERT_TRUE(differs);
+
+    CeTuHashMap<int, int> a;
+    CeTuHashMap<int, int> b;
+    for (int i = 0; i < 1000; ++i) {
+        a.insert(i, i);
+        b.insert(i, i);
+    }
+    CeTuHashMap<int, int> c = a;
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(b.lookup(i).value(), i);
+        ASSERT_EQ(c.lookup(i).value(), i);
+    }
+}
+
+// Colliding keys must neither be lost nor degrade the map to a list
+template<typename K>
+void testCollisions(K (*makeKey)(int)) {
+    struct Colliding {
+        size_t operator()(const K&) const { return 7; }
+    };
+    static constexpr int elementsCount = 20000;
+
+    CeTuHashMap<K, int, Colliding> map;
+    std::vector<std::pair<K, int>> entries;
+    for (int i = 0; i < elementsCount; ++i) {
+        map.insert(makeKey(i), i);
+        entries.emplace_back(makeKey(i), i);
+    }
+    ASSERT_EQ(map.size(), static_cast<size_t>(elementsCount));
+    for (int i = 0; i < elementsCount; i += 2) {
+        map.erase(makeKey(i));
+    }
+    map.insert(makeKey(1), -1);
+    for (int i = 0; i < elementsCount; ++i) {
+        ASSERT_EQ(map.contains(makeKey(i)), i % 2 == 1);
+    }
+    ASSERT_EQ(map.lookup(makeKey(1)).value(), -1);
+
+    size_t visited = 0;
+    for (auto [key, value] : map) {
+        ASSERT_EQ(map.lookup(key).value(), value);
+        ++visited;
+    }
+    ASSERT_EQ(visited, map.size());
+
+    CeTuHashMap<K, int, Colliding> copy = map;
+    copy.shrink_to_fit();
+    ASSERT_EQ(copy.size(), map.size());
+    for (int i = 1; i < elementsCount; i += 2) {
+        ASSERT_EQ(copy.lookup(makeKey(i)), map.lookup(makeKey(i)));
+    }
+
+    auto built = CeTuHashMap<K, int, Colliding>::build_from(entries, 4);
+    ASSERT_EQ(built.size(), static_cast<size_t>(elementsCount));
+    for (int i = 0; i < elementsCount; ++i) {
+        ASSERT_EQ(built.lookup(makeKey(i)).value(), i);
+    }
+    built.clear();
+    ASSERT_TRUE(built.empty());
+    ASSERT_FALSE(built.contains(makeKey(3)));
+}
+
+TEST(CeTuHashMap, CollisionFallbackTest) {
+    testCollisions<int>([](int i) { return i; });
+    testCollisions<std::string>([](int i) { return "key" + std::to_string(i); });
+}
+
+TEST(CeTuHashMap, MergeTest) {
+    using Allocator = CountingAllocator<std::pair<const int, std::string>>;
+    using Map = CeTuHashMap<int, std::string, std::hash<int>, std::equal_to<int>, Allocator>;
+    Allocator::Counters counters;
+    Map target{Allocator(&counters)};
+    Map source = target;
+    for (int i = 0; i < 1000; ++i) {
+        target.insert(i, "target");
+        source.insert(i + 500, "source");
+    }
+
+    // Equal allocators: the nodes of source are relinked, none is constructed
+    size_t constructions = counters.constructions;
+    target.merge(std::move(source));
+    ASSERT_EQ(counters.constructions, constructions);
+    ASSERT_TRUE(source.empty());
+    ASSERT_EQ(target.size(), 1500u);
+    for (int i = 0; i < 1500; ++i) {
+        ASSERT_EQ(target.lookup(i).value(), i < 1000 ? "target" : "source");
+    }
+
+    // source stays usable, and maps with other allocators are merged through new nodes
+    source.insert(2000, "again");
+    Allocator::Counters otherCounters;
+    Map other{Allocator(&otherCounters)};
+    other.insert(3000, "other");
+    target.merge(std::move(source));
+    target.merge(std::move(other));
+    ASSERT_EQ(target.size(), 1502u);
+    ASSERT_EQ(target.lookup(2000).value(), "again");
+    ASSERT_EQ(target.lookup(3000).value(), "other");
+    ASSERT_TRUE(other.empty());
+    ASSERT_EQ(otherCounters.constructions, 1u);
+
+    // Colliding keys go through the overflow tree on both sides
+    CeTuHashMap<int, int, ConstantHash> colliding;
+    CeTuHashMap<int, int, ConstantHash> more;
+    for (int i = 0; i < 100; ++i) {
+        colliding.insert(i, i);
+        more.insert(i + 50, -i);
+    }
+    colliding.merge(std::move(more));
+    ASSERT_EQ(colliding.size(), 150u);
+    for (int i = 0; i < 150; ++i) {
+        ASSERT_EQ(colliding.lookup(i).value(), i < 100 ? i : -(i - 50));
+    }
+}
+
+TEST(CeTuHashMap, NodeHandleTest) {
+    CeTuHashMap<std::string, std::unique_ptr<int>> first;
+    CeTuHashMap<std::string, std::unique_ptr<int>> second;
+    first.insert("a", std::make_unique<int>(1));
+    first.insert("b", std::make_unique<int>(2));
+    second.insert("b", std::make_unique<int>(3));
+
+    ASSERT_TRUE(first.extract("missing").empty());
+    auto node = first.extract("a");
+    ASSERT_TRUE(node);
+    ASSERT_EQ(node.key(), "a");
+    ASSERT_EQ(*node.mapped(), 1);
+    ASSERT_FALSE(first.contains("a"));
+    ASSERT_EQ(first.size(), 1u);
+
+    auto result = second.insert(std::move(node));
+    ASSERT_TRUE(result.inserted);
+    ASSERT_TRUE(result.node.empty());
+    ASSERT_EQ(**result.position, 1);
+    ASSERT_EQ(**second.find("a"), 1);
+
+    // A present key hands the node back untouched
+    result = second.insert(first.extract("b"));
+    ASSERT_FALSE(result.inserted);
+    ASSERT_EQ(**result.position, 3);
+    ASSERT_EQ(*result.node.mapped(), 2);
+    ASSERT_TRUE(first.empty());
+
+    // The key of a handle may be changed before it is inserted again
+    result.node.key() = "c";
+    ASSERT_TRUE(second.insert(std::move(result.node)).inserted);
+    ASSERT_EQ(**second.find("c"), 2);
+    ASSERT_FALSE(second.insert(CeTuHashMap<std::string, std::unique_ptr<int>>::node_type()).inserted);
+}
+
+TEST(CeTuHashMap, UpsertTest) {
+    CeTuHashMap<std::string, std::unique_ptr<int>> map;
+    auto add = [](std::unique_ptr<int> sum, std::unique_ptr<int> value) {
+        *sum += *value;
+        return sum;
+    };
+    auto [value, inserted] = map.upsert("a", std::make_unique<int>(1), add);
+    ASSERT_TRUE(inserted);
+    ASSERT_EQ(value, map.find("a"));
+    std::tie(value, inserted) = map.upsert("a", std::make_unique<int>(2), add);
+    ASSERT_FALSE(inserted);
+    ASSERT_EQ(**value, 3);
+    ASSERT_EQ(map.size(), 1u);
+
+    CeTuHashMap<std::string, std::unique_ptr<int>> other;
+    other.insert("a", std::make_unique<int>(10));
+    other.insert("b", std::make_unique<int>(20));
+    map.merge(std::move(other), add);
+    ASSERT_TRUE(other.empty());
+    ASSERT_EQ(**map.find("a"), 13);
+    ASSERT_EQ(**map.find("b"), 20);
+}
+
+TEST(CeTuConcurrentHashMap, AggregateTest) {
+    constexpr int keyCount = 5000;
+    std::vector<std::pair<int, long>> entries;
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> pick(0, keyCount - 1);
+    std::unordered_map<int, long> expected;
+    for(int i = 0; i < 200000; ++i) {
+        entries.emplace_back(pick(random), i);
+        expected[entries.back().first] += i;
+    }
+
+    CeTuConcurrentHashMap<int, long> map(8);
+    map.upsert(0, 1, std::plus<long>());
+    ++expected[0];
+    map.aggregate(entries, 4, std::plus<long>());
+    ASSERT_EQ(map.size(), expected.size());
+    for(const auto& [key, sum] : expected) {
+        ASSERT_EQ(map.lookup(key), sum);
+    }
+
+    // Concatenation is associative but not commutative, so the order of the slices shows
+    CeTuConcurrentHashMap<int, std::string> words(4);
+    std::vector<std::pair<int, std::string>> letters;
+    for(int i = 0; i < 26 * 40; ++i) {
+        letters.emplace_back(i % 40, std::string(1, static_cast<char>('a' + i / 40)));
+    }
+    words.aggregate(letters, 3, std::plus<std::string>());
+    for(int key = 0; key < 40; ++key) {
+        ASSERT_EQ(words.lookup(key), "abcdefghijklmnopqrstuvwxyz");
+    }
+    words.aggregate(std::vector<std::pair<int, std::string>>(), 3, std::plus<std::string>());
+    ASSERT_EQ(words.size(), 40u);
+}
+
+TEST(CeTuConcurrentHashMap, AggregateReusesHashesTest) {
+    std::vector<std::pair<std::string, int>> entries;
+    for (int i = 0; i < 1000; ++i) {
+        entries.emplace_back(std::to_string(i), i);
+    }
+    CeTuConcurrentHashMap<std::string, int, CountingStringHash> map(4);
+    // Each key is hashed to pick its shard and once more by the private map; merging the
+    // private maps into the shards hashes nothing again
+    stringHashCalls = 0;
+    map.aggregate(entries, 1, std::plus<int>());
+    ASSERT_EQ(stringHashCalls, 2000u);
+    ASSERT_EQ(map.size(), 1000u);
+    ASSERT_EQ(map.lookup("999"), 999);
+}
+
+template<typename Map, typename K>
+void testLookupAsync(Map& map, const std::vector<K>& keys) {
+    using Value = std::remove_pointer_t<decltype(map.find(keys.front()))>;
+    std::vector<const Value*> expected;
+    for (const auto& key : keys) {
+        expected.push_back(std::as_const(map).find(key));
+    }
+    for (size_t groupSize : {1, 3, 16, 5000}) {
+        std::vector<const Value*> found(keys.size(), nullptr);
+        CeTuLookupScheduler(groupSize).run(std::as_const(map), keys, found);
+        ASSERT_EQ(found, expected);
+    }
+    std::vector<Value*> mutableFound(keys.size());
+    CeTuLookupScheduler().run(map, keys, mutableFound);
+    ASSERT_EQ(mutableFound.size(), expected.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_EQ(mutableFound[i], expected[i]);
+    }
+}
+
+template<template<typename...> typename Map>
+void testLookupAsyncMap() {
+    Map<std::string, int> map;
+    std::vector<std::string> keys;
+    ASSERT_EQ(map.lookup_async("missing").get(), nullptr);
+    for (int i = 0; i < 2000; ++i) {
+        map.insert(std::to_string(i), i);
+        keys.push_back(std::to_string(i % 3 == 0 ? i + 5000 : i));
+    }
+    ASSERT_EQ(*map.lookup_async("7").get(), 7);
+    // The task owns its key, so temporaries may die before it runs
+    auto pending = map.lookup_async(std::string("7"));
+    ASSERT_EQ(*pending.get(), 7);
+    testLookupAsync(map, keys);
+    testLookupAsync(map, std::vector<std::string>());
+
+    Map<int, int, ConstantHash> collidingMap;
+    std::vector<int> collidingKeys;
+    for (int i = 0; i < 100; ++i) {
+        collidingMap.insert(i, i);
+        collidingKeys.push_back(i * 2);
+    }
+    testLookupAsync(collidingMap, collidingKeys);
+}
+
+TEST(CeTuHashMap, LookupAsyncTest) {
+    testLookupAsyncMap<CeTuHashMap>();
+
+    // Keys still in the old buckets of an incremental rehash are found as well
+    CeTuHashMap<int, int> map;
+    map.set_incremental_rehash(true);
+    std::vector<int> keys;
+    for (int i = 0; i < 3000; ++i) {
+        map.insert(i, i);
+        keys.push_back(3000 - i);
+    }
+    testLookupAsync(map, keys);
+    ASSERT_THROW(CeTuLookupScheduler(0), std::invalid_argument);
+    std::vector<const int*> tooFew(1);
+    ASSERT_THROW(CeTuLookupScheduler().run(std::as_const(map), keys, tooFew), std::invalid_argument);
+}
+
+TEST(CeTuFlatHashMap, LookupAsyncTest) {
+    testLookupAsyncMap<CeTuFlatHashMap>();
+}
+
+#ifdef __linux__
+// Memory policy mode of the page holding address (MPOL_F_ADDR), with the node mask
+std::pair<int, unsigned long> pagePolicy(const void* address) {
+    int mode = -1;
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {};
+    constexpr unsigned long byAddress = 2;
+    if (syscall(SYS_get_mempolicy, &mode, mask, 1024, address, byAddress) != 0) {
+        return {-1, 0};
+    }
+    return {mode, mask[0]};
+}
+#endif
+
+TEST(CeTuNumaAllocator, PlacementTest) {
+    ASSERT_EQ(CeTuDetail::parseNodeList("0-3,6"), (std::vector<size_t>{0, 1, 2, 3, 6}));
+    ASSERT_EQ(CeTuDetail::parseNodeList("0"), (std::vector<size_t>{0}));
+    ASSERT_TRUE(CeTuDetail::parseNodeList("x").empty());
+    ASSERT_FALSE(CeTuDetail::numaNodes().empty());
+
+    using Allocator = CeTuNumaAllocator<std::pair<const int, int>>;
+    ASSERT_EQ(Allocator(CeTuNumaPolicy::OnNode, 0), Allocator(CeTuNumaPolicy::OnNode, 0));
+    ASSERT_NE(Allocator(CeTuNumaPolicy::OnNode, 0), Allocator(CeTuNumaPolicy::Interleave));
+    // Bucket arrays and slabs grow past the mapping threshold
+    for (CeTuNumaPolicy policy : {CeTuNumaPolicy::FirstTouch, CeTuNumaPolicy::Interleave, CeTuNumaPolicy::OnNode}) {
+        CeTuHashMap<int, int, std::hash<int>, std::equal_to<int>, Allocator> map{Allocator(policy)};
+        for (int i = 0; i < 100000; ++i) {
+            map.insert(i, i);
+        }
+        for (int i = 0; i < 100000; i += 7) {
+            ASSERT_EQ(map.lookup(i), i);
+        }
+    }
+
+    std::vector<std::pair<int, int>> entries;
+    for (int i = 0; i < 100000; ++i) {
+        entries.emplace_back(i, -i);
+    }
+    auto built = CeTuHashMap<int, int, std::hash<int>, std::equal_to<int>, Allocator>::build_from(
+        entries, 4, Allocator(CeTuNumaPolicy::FirstTouch));
+    ASSERT_EQ(built.size(), entries.size());
+    ASSERT_EQ(built.lookup(99999), -99999);
+
+    // Builder threads run the hook, and the calling thread gets its affinity back
+    std::atomic<int> hooks = 0;
+    auto counting = [&hooks](size_t) {
+        ++hooks;
+        return 0;
+    };
+    auto hooked = CeTuHashMap<int, int>::build_from(entries, 4, {}, counting);
+    ASSERT_EQ(hooks, 4);
+    ASSERT_EQ(hooked.lookup(12345), -12345);
+#ifdef __linux__
+    cpu_set_t before;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(before), &before), 0);
+    auto pinned = CeTuHashMap<int, int, std::hash<int>, std::equal_to<int>, Allocator>::build_from(
+        entries, 4, Allocator(CeTuNumaPolicy::FirstTouch), CeTuNumaSpread());
+    ASSERT_EQ(pinned.size(), entries.size());
+    cpu_set_t after;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+    ASSERT_TRUE(CPU_EQUAL(&before, &after));
+
+    // Mapped blocks carry the policy of their allocator
+    constexpr int defaultMode = 0;
+    constexpr int preferredMode = 1;
+    constexpr int interleaveMode = 3;
+    const size_t node = CeTuDetail::numaNodes().back();
+    CeTuNumaAllocator<uint64_t> interleaved(CeTuNumaPolicy::Interleave);
+    CeTuNumaAllocator<uint64_t> onNode(CeTuNumaPolicy::OnNode, node);
+    CeTuNumaAllocator<uint64_t> firstTouch(CeTuNumaPolicy::FirstTouch);
+    constexpr size_t words = 1 << 16;
+    uint64_t* a = interleaved.allocate(words);
+    uint64_t* b = onNode.allocate(words);
+    uint64_t* c = firstTouch.allocate(words);
+    auto [interleavedMode, interleavedMask] = pagePolicy(a);
+    auto [onNodeMode, onNodeMask] = pagePolicy(b);
+    ASSERT_EQ(interleavedMode, interleaveMode);
+    for (size_t id : CeTuDetail::numaNodes()) {
+        if (id < 8 * sizeof(unsigned long)) {
+            ASSERT_TRUE(interleavedMask & (1ul << id));
+        }
+    }
+    ASSERT_EQ(onNodeMode, preferredMode);
+    if (node < 8 * sizeof(unsigned long)) {
+        ASSERT_EQ(onNodeMask, 1ul << node);
+    }
+    ASSERT_EQ(pagePolicy(c).first, defaultMode);
+    interleaved.deallocate(a, words);
+    onNode.deallocate(b, words);
+    firstTouch.deallocate(c, words);
+#endif
+}
+
+TEST(CeTuReplicatedHashMap, ReplicationTest) {
+    CeTuReplicatedHashMap<int, std::string> map(4);
+    ASSERT_EQ(map.replica_count(), CeTuDetail::numaNodes().size());
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(i, std::to_string(i));
+    }
+    map.erase(0);
+    map.insert(1, "one");
+    ASSERT_EQ(map.size(), 999u);
+    ASSERT_FALSE(map.contains(0));
+    ASSERT_EQ(map.lookup(1), "one");
+    for (size_t r = 0; r < map.replica_count(); ++r) {
+        ASSERT_EQ(map.replica(r).size(), 999u);
+        ASSERT_EQ(map.replica(r).lookup(500), "500");
+    }
+
+    // Readers only ever see complete values while a writer keeps updating
+    std::atomic<bool> done = false;
+    std::thread writer([&] {
+        for (int i = 0; i < 20000; ++i) {
+            map.insert(i % 100, std::to_string(i % 100));
+        }
+        done = true;
+    });
+    std::vector<std::thread> readers;
+    std::atomic<int> mismatches = 0;
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&] {
+            while (!done) {
+                for (int key = 2; key < 100; ++key) {
+                    if (map.lookup(key) != std::to_string(key)) {
+                        ++mismatches;
+                    }
+                }
+            }
+        });
+    }
+    writer.join();
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(mismatches, 0);
+}
+
+TEST(CeTuClockCache, EvictionTest) {
+    std::vector<std::pair<int, std::string>> evicted;
+    auto onEvict = [&evicted](const int& key, std::string& value) { evicted.emplace_back(key, value); };
+    CeTuClockCache<int, std::string, std::hash<int>, std::equal_to<int>, decltype(onEvict)> cache(3, {}, onEvict);
+    ASSERT_THROW((CeTuClockCache<int, int>(0)), std::invalid_argument);
+    ASSERT_EQ(cache.capacity(), 3u);
+
+    cache.insert(1, "one");
+    cache.insert(2, "two");
+    cache.insert(3, "three");
+    // 1 and 3 get a second chance, 2 does not
+    ASSERT_EQ(cache.lookup(1), "one");
+    ASSERT_EQ(*cache.find(3), "three");
+    cache.insert(4, "four");
+    ASSERT_EQ(evicted, (std::vector<std::pair<int, std::string>>{{2, "two"}}));
+    ASSERT_EQ(cache.size(), 3u);
+    ASSERT_FALSE(cache.contains(2));
+    // The hand resumes after 2: 3 loses its bit, and 1 has already lost its own
+    cache.insert(5, "five");
+    ASSERT_EQ(evicted.back(), (std::pair<int, std::string>{1, "one"}));
+    ASSERT_TRUE(cache.contains(3));
+
+    // Erased entries are reused without evicting, and without calling onEvict
+    cache.erase(4);
+    cache.insert(6, "six");
+    ASSERT_EQ(evicted.size(), 2u);
+    ASSERT_EQ(cache.size(), 3u);
+    cache.insert(6, "SIX");
+    ASSERT_EQ(cache.lookup(6), "SIX");
+    ASSERT_EQ(cache.size(), 3u);
+
+    auto moved = std::move(cache);
+    ASSERT_EQ(moved.lookup(5), "five");
+    moved.clear();
+    ASSERT_TRUE(moved.empty());
+    ASSERT_EQ(evicted.size(), 2u);
+    moved.insert(7, "seven");
+    ASSERT_EQ(moved.lookup(7), "seven");
+}
+
+TEST(CeTuClockCache, ChurnTest) {
+    static constexpr size_t capacity = 500;
+    size_t evictions = 0;
+    auto onEvict = [&evictions](const std::string&, int&) { ++evictions; };
+    CeTuClockCache<std::string, int, std::hash<std::string>, std::equal_to<std::string>, decltype(onEvict)> cache(capacity, {}, onEvict);
+    std::unordered_map<std::string, int> latest;
+    std::mt19937 random(3);
+    size_t hits = 0;
+    for (int i = 0; i < 100000; ++i) {
+        // A hot set of 100 keys among 5000
+        int number = random() % 4 == 0 ? static_cast<int>(random() % 5000) : static_cast<int>(random() % 100);
+        std::string key = std::to_string(number);
+        if (auto value = cache.lookup(key)) {
+            ASSERT_EQ(*value, latest[key]);
+            ++hits;
+        } else if (random() % 16 == 0) {
+            cache.erase(key);
+        } else {
+            cache.insert(key, i);
+            latest[key] = i;
+        }
+        ASSERT_LE(cache.size(), capacity);
+    }
+    size_t visited = 0;
+    cache.for_each([&](const std::string& key, int value) {
+        ASSERT_EQ(value, latest[key]);
+        ++visited;
+    });
+    ASSERT_EQ(visited, cache.size());
+    ASSERT_GT(evictions, 0u);
+    // The hot keys stay cached
+    ASSERT_GT(hits, 60000u);
+}
+
+TEST(CeTuClockCache, ExpiryTest) {
+    using namespace std::chrono_literals;
+    std::vector<int> expired;
+    auto onEvict = [&expired](const int& key, int&) { expired.push_back(key); };
+    CeTuClockCache<int, int, std::hash<int>, std::equal_to<int>, decltype(onEvict)> cache(8, 100ms, onEvict);
+    ASSERT_EQ(cache.ttl(), 100ms);
+    cache.insert(1, 1);
+    cache.insert(2, 2);
+    cache.insert(3, 3);
+    ASSERT_TRUE(cache.contains(1));
+    std::this_thread::sleep_for(200ms);
+    cache.insert(3, 30);
+
+    ASSERT_FALSE(cache.contains(1));
+    ASSERT_EQ(cache.lookup(1), std::nullopt);
+    ASSERT_EQ(expired, (std::vector<int>{1}));
+    ASSERT_EQ(cache.evict_expired(), 1u);
+    ASSERT_EQ(expired, (std::vector<int>{1, 2}));
+    ASSERT_EQ(cache.size(), 1u);
+    ASSERT_EQ(cache.lookup(3), 30);
+}
+
+TEST(CeTuStringHashMap, KeyStorageTest) {
+    CeTuStringHashMap<int> map;
+    // Empty, prefix only, inline and arena keys, including the boundaries between them
+    std::vector<std::string> keys = {"", "a", "abcd", "abcde", "abcdefghijkl", "abcdefghijklm",
+        std::string("ab\0cd\0ef", 8), std::string(100, 'x'), std::string(10000, 'y')};
+    for (size_t i = 0; i < keys.size(); ++i) {
+        map.insert(keys[i], static_cast<int>(i));
+    }
+    ASSERT_EQ(map.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_EQ(map.lookup(keys[i]), static_cast<int>(i));
+    }
+    // Same prefix or same length is not enough to match
+    ASSERT_FALSE(map.contains("abcdefghijkm"));
+    ASSERT_FALSE(map.contains("abce"));
+    ASSERT_FALSE(map.contains(std::string(100, 'z')));
+    ASSERT_FALSE(map.contains("ab"));
+
+    size_t visited = 0;
+    map.for_each([&](std::string_view key, int value) {
+        ASSERT_EQ(key, keys[value]);
+        ++visited;
+    });
+    ASSERT_EQ(visited, keys.size());
+
+    // Keys of up to 12 bytes take no arena space
+    CeTuStringHashMap<int> shortKeys;
+    shortKeys.insert("abcdefghijkl", 1);
+    ASSERT_EQ(shortKeys.arena_bytes(), 0u);
+    shortKeys.insert("abcdefghijklm", 2);
+    ASSERT_GT(shortKeys.arena_bytes(), 0u);
+
+    map.insert(keys[7], 70);
+    ASSERT_EQ(*map.find(keys[7]), 70);
+    ASSERT_EQ(map.size(), keys.size());
+}
+
+TEST(CeTuStringHashMap, EraseAndCompactTest) {
+    CeTuStringHashMap<std::string> map;
+    auto key = [](int i) { return "https://example.com/path/" + std::to_string(i); };
+    for (int i = 0; i < 10000; ++i) {
+        map.insert(key(i), std::to_string(i));
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        map.erase(key(i));
+    }
+    map.erase("missing");
+    ASSERT_EQ(map.size(), 5000u);
+    ASSERT_GT(map.garbage_bytes(), 0u);
+
+    size_t before = map.arena_bytes();
+    map.compact();
+    ASSERT_EQ(map.garbage_bytes(), 0u);
+    ASSERT_LT(map.arena_bytes(), before);
+    for (int i = 0; i < 10000; ++i) {
+        if (i % 2 == 0) {
+            ASSERT_EQ(map.find(key(i)), nullptr);
+        } else {
+            ASSERT_EQ(map.lookup(key(i)), std::to_string(i));
+        }
+    }
+
+    // Copies get an arena of their own
+    CeTuStringHashMap<std::string> copy = map;
+    map.clear();
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(map.arena_bytes(), 0u);
+    ASSERT_EQ(copy.size(), 5000u);
+    ASSERT_EQ(copy.lookup(key(1)), "1");
+    map.insert(key(0), "zero");
+    ASSERT_EQ(map.lookup(key(0)), "zero");
+
+    CeTuStringHashMap<std::string> moved = std::move(copy);
+    ASSERT_EQ(moved.lookup(key(9999)), "9999");
+    copy = moved;
+    ASSERT_EQ(copy.size(), 5000u);
+    ASSERT_EQ(copy.lookup(key(3)), "3");
+}
+
+TEST(CeTuStringHashMap, ChurnTest) {
+    CeTuStringHashMap<int> map;
+    map.reserve(100);
+    size_t buckets = map.bucket_count();
+    ASSERT_GE(buckets * 0.7, 100.0);
+    std::unordered_map<std::string, int> reference;
+    std::mt19937 random(5);
+    for (int i = 0; i < 200000; ++i) {
+        // Short and long keys sharing their prefixes
+        std::string key = std::to_string(random() % 3000);
+        if (random() % 2 == 0) {
+            key += std::string(random() % 40, 'k');
+        }
+        switch (random() % 3) {
+            case 0:
+            case 1:
+                map.insert(key, i);
+                reference[key] = i;
+                break;
+            default:
+                map.erase(key);
+                reference.erase(key);
+                break;
+        }
+        ASSERT_EQ(map.size(), reference.size());
+    }
+    ASSERT_LE(map.load_factor(), 0.7f);
+    for (const auto& [key, value] : reference) {
+        ASSERT_EQ(map.lookup(key), value);
+    }
+    size_t visited = 0;
+    map.for_each([&](std::string_view key, int value) {
+        ASSERT_EQ(reference.at(std::string(key)), value);
+        ++visited;
+    });
+    ASSERT_EQ(visited, reference.size());
+}
+
+TEST(CeTuRobinHoodHashMap, ChurnTest) {
+    // Steady size with constant inserts and erases, as for a session cache
+    CeTuRobinHoodHashMap<std::string, int> map;
+    std::unordered_map<std::string, int> expected;
+    std::mt19937 random(7);
+    for (int i = 0; i < 300000; ++i) {
+        std::string key = std::to_string(random() % 4000);
+        if (random() % 2 == 0) {
+            map.erase(key);
+            expected.erase(key);
+        } else {
+            map.insert(key, i);
+            expected[key] = i;
+        }
+    }
+    ASSERT_EQ(map.size(), expected.size());
+    for (int i = 0; i < 4000; ++i) {
+        auto it = expected.find(std::to_string(i));
+        ASSERT_EQ(map.lookup(std::to_string(i)), it == expected.end() ? std::nullopt : std::optional<int>(it->second));
+    }
+    // Churn never grows the slots past what the peak size needs
+    ASSERT_LE(map.bucket_count(), 8192u);
+
+    CeTuRobinHoodHashMap<std::string, int> copied(map);
+    CeTuRobinHoodHashMap<std::string, int> moved(std::move(map));
+    ASSERT_EQ(copied.size(), expected.size());
+    size_t visited = 0;
+    moved.for_each([&](const std::string& key, int value) {
+        ASSERT_EQ(expected.at(key), value);
+        ASSERT_EQ(copied.lookup(key).value(), value);
+        ++visited;
+    });
+    ASSERT_EQ(visited, expected.size());
+
+    // The moved-from map is empty but usable
+    map["a"] = 1;
+    ASSERT_EQ(map.lookup("a").value(), 1);
+    ASSERT_FALSE(map.try_emplace("a", 2).second);
+    copied.clear();
+    ASSERT_TRUE(copied.empty());
+    ASSERT_FALSE(copied.contains(expected.begin()->first));
+}
+
+TEST(CeTuRobinHoodHashMap, FailedGrowthTest) {
+    testFailedGrowth<CeTuRobinHoodHashMap>();
+}
+
+TEST(CeTuRobinHoodHashMap, StatsTest) {
+    CeTuRobinHoodHashMap<int, int> good;
+    CeTuRobinHoodHashMap<int, int, ConstantHash> bad;
+    for (int i = 0; i < 2000; ++i) {
+        good.insert(i, i);
+        bad.insert(i, i);
+    }
+    for (int i = 0; i < 2000; i += 2) {
+        good.erase(i);
+        bad.erase(i);
+    }
+    CeTuHashMapStats stats = good.stats();
+    ASSERT_EQ(stats.size, 1000u);
+    ASSERT_EQ(stats.tombstones, 0u);
+    ASSERT_EQ(stats.maxDisplacement + 1, stats.longestProbe);
+    ASSERT_LT(stats.maxDisplacement, 16u);
+    ASSERT_GT(stats.rehashCount, 0u);
+
+    // Backward shift keeps the colliding run dense
+    ASSERT_EQ(bad.stats().maxDisplacement, 999u);
+    for (int i = 1; i < 2000; i += 2) {
+        ASSERT_EQ(bad.lookup(i).value(), i);
+        ASSERT_FALSE(bad.contains(i - 1));
+    }
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
 